@@ -0,0 +1,285 @@
+/*******************************************/ /**
+ * @file batch.c
+ * @author marsman7 (you@domain.com)
+ * @brief Batches the publishes of a scheduler tick : one
+ *        envelope message for many jobs, one network flush
+ *        for many messages, and counters to verify it.
+ *
+ * libmosquitto writes each publish to the socket at once if
+ * no loop thread runs, so many small jobs cost a syscall and
+ * a TCP segment each. An envelope packs the payloads of a
+ * tick into one CBOR or MessagePack map of topic to payload.
+ * TCP_CORK holds the segments of the tick back until
+ * batch_end(), the kernel sends them full sized then. It
+ * saves TCP segments only, libmosquitto still does one write
+ * syscall per publish.
+ *
+ * The counters are read only if a template references them.
+ * The writes are the difference of syscw in the io file of the
+ * publishing thread around each call that writes to the socket,
+ * so neither the log nor the workers of the collectors are
+ * counted. The file is kept open and read with pread(). The
+ * packets are the difference of tcpi_data_segs_out of TCP_INFO
+ * (Linux 4.6) from batch_begin() to batch_end().
+ *
+ * @headerfile batch.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+
+#include "batch.h"
+
+#define ENVELOPE_MIN_SIZE 1024
+#define THREAD_IO "/proc/thread-self/io"	/*!< counters of the calling thread, Linux 3.17 */
+
+static int io_fd = -1;
+
+/*******************************************/ /**
+ * @brief Get the count of write syscalls of the calling thread.
+ *        The file is opened on the first call, the thread must
+ *        be the same on all calls.
+ *
+ * @return long long - The count, -1 if unknown
+ ***********************************************/
+static long long read_writes()
+{
+	if ((io_fd < 0) && ((io_fd = open(THREAD_IO, O_RDONLY | O_CLOEXEC)) < 0))
+	{
+		return -1;
+	}
+
+	char buffer[256];
+	ssize_t length = pread(io_fd, buffer, sizeof(buffer) - 1, 0);
+	if (length <= 0)
+	{
+		return -1;
+	}
+	buffer[length] = '\0';
+
+	const char *line = strstr(buffer, "syscw:");
+	return line ? strtoll(line + 6, NULL, 10) : -1;
+}
+
+/*******************************************/ /**
+ * @brief Get the count of TCP data segments sent on a socket
+ *
+ * @param sock - The socket
+ * @return long long - The count, -1 if unknown
+ ***********************************************/
+static long long read_packets(int sock)
+{
+	struct tcp_info info;
+	socklen_t length = sizeof(info);
+
+	if ( (sock < 0) || getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length) ||
+			(length < offsetof(struct tcp_info, tcpi_data_segs_out) + sizeof(info.tcpi_data_segs_out)) )
+	{
+		return -1;
+	}
+	return info.tcpi_data_segs_out;
+}
+
+/*******************************************/ /**
+ * @brief Start a tick, the caller counts its publishes in
+ *        batch->messages
+ *
+ * @param batch - The tick
+ * @param sock - Socket of the broker, -1 if not connected
+ * @param cork - Hold the segments back until batch_end()
+ * @param counted - Read the write and packet counters
+ ***********************************************/
+void batch_begin(batch_t *batch, int sock, bool cork, bool counted)
+{
+	int on = 1;
+
+	batch->sock = sock;
+	batch->counted = counted;
+	batch->writing = false;
+	batch->messages = 0;
+	batch->writes = counted ? 0 : -1;
+	batch->packets = counted ? read_packets(sock) : -1;
+	// fails on a socket that is not TCP, it is sent as before then
+	batch->corked = cork && (sock >= 0) &&
+			(! setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)));
+}
+
+/*******************************************/ /**
+ * @brief Start a call that writes to the socket, the writes up
+ *        to batch_write_end() are counted
+ *
+ * @param batch - The tick
+ ***********************************************/
+void batch_write_begin(batch_t *batch)
+{
+	if (batch->counted && (batch->writes >= 0) && (! batch->writing))
+	{
+		batch->mark = read_writes();
+		batch->writing = true;
+	}
+}
+
+/*******************************************/ /**
+ * @brief End a call that writes to the socket
+ *
+ * @param batch - The tick
+ * @return bool - TRUE if the writes were counted, a callback
+ *                that logs within the call ends and starts
+ *                it again around the log
+ ***********************************************/
+bool batch_write_end(batch_t *batch)
+{
+	if (! batch->writing)
+	{
+		return false;
+	}
+	batch->writing = false;
+
+	long long writes = read_writes();
+	batch->writes = ((writes < 0) || (batch->mark < 0)) ? -1 : batch->writes + writes - batch->mark;
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief End a tick, flush the corked segments and get the
+ *        counters
+ *
+ * @param batch - The tick
+ * @param stats - Stores the counters of the tick
+ ***********************************************/
+void batch_end(batch_t *batch, batch_stats_t *stats)
+{
+	int off = 0;
+
+	if (batch->corked)
+	{
+		setsockopt(batch->sock, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+		batch->corked = false;
+	}
+
+	batch_write_end(batch);
+	long long packets = batch->counted ? read_packets(batch->sock) : -1;
+
+	stats->messages = batch->messages;
+	stats->writes = batch->writes;
+	stats->packets = ((packets < 0) || (batch->packets < 0)) ? -1 : packets - batch->packets;
+	batch->counted = false;
+}
+
+/*******************************************/ /**
+ * @brief Close the io file of the counters
+ ***********************************************/
+void batch_free()
+{
+	if (io_fd >= 0)
+	{
+		close(io_fd);
+	}
+	io_fd = -1;
+}
+
+/*******************************************/ /**
+ * @brief Start a empty envelope, the buffer is kept from the
+ *        last tick
+ *
+ * @param envelope - The envelope
+ * @param format - PAYLOAD_CBOR or PAYLOAD_MSGPACK
+ ***********************************************/
+void envelope_open(envelope_t *envelope, enum payload_format_t format)
+{
+	envelope->format = format;
+	envelope->length = 0;
+	envelope->count = 0;
+}
+
+/*******************************************/ /**
+ * @brief Add a payload to the envelope
+ *
+ * @param envelope - The envelope
+ * @param topic - The key of the payload
+ * @param payload - The payload
+ * @param length - Length of the payload
+ * @param nested - TRUE if the payload is a item of the format
+ *        of the envelope and is embedded as it is, else it
+ *        is added as text
+ * @return int - ZERO on success, -1 if out of memory
+ ***********************************************/
+int envelope_add(envelope_t *envelope, const char *topic, const void *payload, size_t length, bool nested)
+{
+	size_t topic_length = strlen(topic);
+	size_t need = ENCODE_HEADER_SIZE + envelope->length +
+			ENCODE_HEADER_SIZE + topic_length + ENCODE_HEADER_SIZE + length;
+
+	if (need > envelope->size)
+	{
+		size_t size = envelope->size ? envelope->size : ENVELOPE_MIN_SIZE;
+		while (size < need)
+		{
+			size *= 2;
+		}
+		uint8_t *buffer = realloc(envelope->buffer, size);
+		if (! buffer)
+		{
+			return -1;
+		}
+		envelope->buffer = buffer;
+		envelope->size = size;
+	}
+
+	// the map header is written in front of the entries by envelope_close()
+	uint8_t *dst = envelope->buffer + ENCODE_HEADER_SIZE + envelope->length;
+	dst += encode_text(dst, envelope->format, topic, topic_length);
+	if (nested)
+	{
+		memcpy(dst, payload, length);
+		dst += length;
+	}
+	else
+	{
+		dst += encode_text(dst, envelope->format, payload, length);
+	}
+
+	envelope->length = dst - envelope->buffer - ENCODE_HEADER_SIZE;
+	envelope->count++;
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the message of the envelope
+ *
+ * @param envelope - The envelope, not empty
+ * @param length - Stores the length of the message
+ * @return const void* - The message, valid until the next add
+ ***********************************************/
+const void *envelope_close(envelope_t *envelope, size_t *length)
+{
+	uint8_t header[ENCODE_HEADER_SIZE];
+	size_t header_length = encode_map(header, envelope->format, envelope->count);
+	uint8_t *start = envelope->buffer + ENCODE_HEADER_SIZE - header_length;
+
+	memcpy(start, header, header_length);
+	*length = header_length + envelope->length;
+	return start;
+}
+
+/*******************************************/ /**
+ * @brief Free the buffer of the envelope
+ *
+ * @param envelope - The envelope
+ ***********************************************/
+void envelope_free(envelope_t *envelope)
+{
+	free(envelope->buffer);
+	envelope->buffer = NULL;
+	envelope->size = 0;
+	envelope->length = 0;
+	envelope->count = 0;
+}
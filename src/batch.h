@@ -0,0 +1,67 @@
+/*******************************************/ /**
+ * @file batch.h
+ * @author marsman7 (you@domain.com)
+ * @brief Batches the publishes of a scheduler tick : one
+ *        envelope message for many jobs, one network flush
+ *        for many messages, and counters to verify it.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "encode.h"
+
+/*******************************************/ /**
+ * @brief Counters of a tick, -1 if the kernel does not
+ *        report them
+ ***********************************************/
+typedef struct batch_stats_t
+{
+	long long messages;	/*!< MQTT publishes */
+	long long writes;	/*!< write syscalls to the socket of the broker */
+	long long packets;	/*!< TCP data segments sent */
+} batch_stats_t;
+
+/*******************************************/ /**
+ * @brief A tick in progress
+ ***********************************************/
+typedef struct batch_t
+{
+	int sock;		/*!< socket of the broker, -1 if none */
+	bool corked;
+	bool counted;		/*!< the counters are read */
+	bool writing;		/*!< within batch_write_begin() and batch_write_end() */
+	long long messages;
+	long long writes;	/*!< socket writes so far */
+	long long mark;		/*!< write syscalls at batch_write_begin() */
+	long long packets;	/*!< counter at the begin */
+} batch_t;
+
+/*******************************************/ /**
+ * @brief A map of topic to payload, published as one message
+ ***********************************************/
+typedef struct envelope_t
+{
+	enum payload_format_t format;
+	uint8_t *buffer;
+	size_t size;
+	size_t length;		/*!< of the entries after the reserved map header */
+	size_t count;
+} envelope_t;
+
+void batch_begin(batch_t *, int, bool, bool);
+void batch_write_begin(batch_t *);
+bool batch_write_end(batch_t *);
+void batch_end(batch_t *, batch_stats_t *);
+void batch_free();
+void envelope_open(envelope_t *, enum payload_format_t);
+int envelope_add(envelope_t *, const char *, const void *, size_t, bool);
+const void *envelope_close(envelope_t *, size_t *);
+void envelope_free(envelope_t *);
+
+#endif
@@ -0,0 +1,512 @@
+/*******************************************/ /**
+ * @file cgroup.c
+ * @author marsman7 (you@domain.com)
+ * @brief Resource usage of services from their cgroup v2,
+ *        read through fds that are kept open.
+ *
+ * systemd puts each service into its own cgroup below
+ * /sys/fs/cgroup/system.slice/<unit>/. The files of a unit are
+ * opened on the first update and read with pread() from offset
+ * ZERO, no child process is started. If the unit stops, the
+ * cgroup is removed and a read fails. The files are closed then
+ * and opened again on the next update, the rates start again
+ * after a restart.
+ *
+ * Tags, the unit gets the suffix ".service" if it has none :
+ *   cgroup_cpu_usec_<unit>       - CPU time in microseconds, counter
+ *   cgroup_cpu_pct_<unit>        - CPU usage since the last update in
+ *                                  percent of one core
+ *   cgroup_mem_mb_<unit>         - memory.current in MiB
+ *   cgroup_mem_kb_<unit>         - memory.current in KiB
+ *   cgroup_mem_pressure_<unit>   - memory.pressure "some avg10" in percent
+ *   cgroup_io_read_bytes_<unit>  - bytes read of all devices, counter
+ *   cgroup_io_write_bytes_<unit> - bytes written of all devices, counter
+ *   cgroup_io_read_rate_<unit>   - bytes read per second since the last update
+ *   cgroup_io_write_rate_<unit>  - bytes written per second since the last update
+ *
+ * @headerfile cgroup.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cgroup.h"
+#include "rate.h"
+
+#define CGROUP_PREFIX "cgroup_"
+#define CGROUP_BUFFER_SIZE 4096		/*!< enough for the files of a unit */
+
+/*******************************************/ /**
+ * @brief Files of a cgroup that are read
+ ***********************************************/
+enum cgroup_file_t
+{
+	FILE_CPU_STAT = 0,
+	FILE_MEMORY_CURRENT,
+	FILE_MEMORY_PRESSURE,
+	FILE_IO_STAT,
+	CGROUP_FILES
+};
+
+/*******************************************/ /**
+ * @brief Fields of a unit
+ ***********************************************/
+enum cgroup_field_t
+{
+	FIELD_CPU_USEC = 0,
+	FIELD_CPU_PCT,
+	FIELD_MEM_MB,
+	FIELD_MEM_KB,
+	FIELD_MEM_PRESSURE,
+	FIELD_IO_READ_BYTES,
+	FIELD_IO_WRITE_BYTES,
+	FIELD_IO_READ_RATE,
+	FIELD_IO_WRITE_RATE
+};
+
+static const struct
+{
+	const char *name;
+	enum cgroup_field_t field;
+	enum cgroup_file_t file;
+} fields[] = {
+	{ "cpu_usec", FIELD_CPU_USEC, FILE_CPU_STAT },
+	{ "cpu_pct", FIELD_CPU_PCT, FILE_CPU_STAT },
+	{ "mem_mb", FIELD_MEM_MB, FILE_MEMORY_CURRENT },
+	{ "mem_kb", FIELD_MEM_KB, FILE_MEMORY_CURRENT },
+	{ "mem_pressure", FIELD_MEM_PRESSURE, FILE_MEMORY_PRESSURE },
+	{ "io_read_bytes", FIELD_IO_READ_BYTES, FILE_IO_STAT },
+	{ "io_write_bytes", FIELD_IO_WRITE_BYTES, FILE_IO_STAT },
+	{ "io_read_rate", FIELD_IO_READ_RATE, FILE_IO_STAT },
+	{ "io_write_rate", FIELD_IO_WRITE_RATE, FILE_IO_STAT }
+};
+
+static const char *file_names[CGROUP_FILES] = {
+	"cpu.stat", "memory.current", "memory.pressure", "io.stat"
+};
+
+/*******************************************/ /**
+ * @brief A unit referenced by tags
+ ***********************************************/
+typedef struct cgroup_unit_t
+{
+	char *name;
+	int fds[CGROUP_FILES];
+	bool used[CGROUP_FILES];	/*!< referenced by a tag */
+	bool valid;			/*!< read by the last update */
+	uint64_t cpu_usec;
+	uint64_t mem_bytes;
+	double mem_pressure;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	rate_t cpu_rate;
+	rate_t read_rate;
+	rate_t write_rate;
+	bool rates_valid;		/*!< the rates have two samples */
+	double cpu_pct;
+	double read_per_s;
+	double write_per_s;
+} cgroup_unit_t;
+
+/*******************************************/ /**
+ * @brief A value referenced by a tag
+ ***********************************************/
+typedef struct cgroup_metric_t
+{
+	uint32_t unit;
+	enum cgroup_field_t field;
+} cgroup_metric_t;
+
+static char *root = NULL;
+static cgroup_unit_t *units = NULL;
+static int unit_count = 0;
+static cgroup_metric_t *metrics = NULL;
+static int metric_count = 0;
+
+/*******************************************/ /**
+ * @brief Set the directory of the cgroups of the services
+ *
+ * @param path - The directory, e.g. "/sys/fs/cgroup/system.slice"
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int cgroup_init(const char *path)
+{
+	cgroup_free();
+	if (! (root = strdup(path)))
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Find or add a unit
+ *
+ * @return int - Index of the unit, -1 if out of memory
+ ***********************************************/
+static int add_unit(const char *name, size_t length)
+{
+	// systemctl accepts "foo" for "foo.service", the cgroup is named by the full name
+	bool suffix = ! memchr(name, '.', length);
+	char unit[256];
+	if (length + sizeof(".service") > sizeof(unit))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	snprintf(unit, sizeof(unit), "%.*s%s", (int)length, name, suffix ? ".service" : "");
+
+	for (int i = 0; i < unit_count; i++)
+	{
+		if (! strcmp(units[i].name, unit))
+		{
+			return i;
+		}
+	}
+
+	cgroup_unit_t *new_units = realloc(units, (unit_count + 1) * sizeof(cgroup_unit_t));
+	if (! new_units)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	units = new_units;
+
+	cgroup_unit_t *entry = &units[unit_count];
+	memset(entry, 0, sizeof(*entry));
+	for (int i = 0; i < CGROUP_FILES; i++)
+	{
+		entry->fds[i] = -1;
+	}
+	if (! (entry->name = strdup(unit)))
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	return unit_count++;
+}
+
+/*******************************************/ /**
+ * @brief Register a tag, e.g. "cgroup_mem_mb_nginx"
+ *
+ * @param name - The tag name, not terminated
+ * @param length - Length of the name
+ * @return int - Index for cgroup_value(), -1 and errno is
+ *               ENOENT if it is not a cgroup tag
+ ***********************************************/
+int cgroup_register(const char *name, size_t length)
+{
+	size_t prefix_length = strlen(CGROUP_PREFIX);
+	if ((length <= prefix_length) || strncasecmp(name, CGROUP_PREFIX, prefix_length))
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	name += prefix_length;
+	length -= prefix_length;
+
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+	{
+		size_t field_length = strlen(fields[i].name);
+		if ((length <= field_length + 1) || strncasecmp(name, fields[i].name, field_length) ||
+				(name[field_length] != '_'))
+		{
+			continue;
+		}
+
+		int unit = add_unit(name + field_length + 1, length - field_length - 1);
+		if (unit < 0)
+		{
+			return -1;
+		}
+		// the templates of a reload register their tags again
+		for (int m = 0; m < metric_count; m++)
+		{
+			if ((metrics[m].unit == (uint32_t)unit) && (metrics[m].field == fields[i].field))
+			{
+				return m;
+			}
+		}
+
+		cgroup_metric_t *new_metrics = realloc(metrics, (metric_count + 1) * sizeof(cgroup_metric_t));
+		if (! new_metrics)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		metrics = new_metrics;
+		metrics[metric_count].unit = unit;
+		metrics[metric_count].field = fields[i].field;
+		units[unit].used[fields[i].file] = true;
+		return metric_count++;
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Close the files of a unit and forget its rates
+ ***********************************************/
+static void close_unit(cgroup_unit_t *unit)
+{
+	for (int i = 0; i < CGROUP_FILES; i++)
+	{
+		if (unit->fds[i] >= 0)
+		{
+			close(unit->fds[i]);
+		}
+		unit->fds[i] = -1;
+	}
+	memset(&unit->cpu_rate, 0, sizeof(unit->cpu_rate));
+	memset(&unit->read_rate, 0, sizeof(unit->read_rate));
+	memset(&unit->write_rate, 0, sizeof(unit->write_rate));
+	unit->valid = false;
+	unit->rates_valid = false;
+}
+
+/*******************************************/ /**
+ * @brief Open the referenced files of a unit
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+static int open_unit(cgroup_unit_t *unit)
+{
+	char path[512];
+	for (int i = 0; i < CGROUP_FILES; i++)
+	{
+		if ((! unit->used[i]) || (unit->fds[i] >= 0))
+		{
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s/%s", root, unit->name, file_names[i]);
+		if ((unit->fds[i] = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		{
+			int error = errno;
+			close_unit(unit);
+			errno = error;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the value of a "<key> <value>" or "<key>=<value>"
+ *        field in a buffer
+ *
+ * @param buffer - Zero terminated content of the file
+ * @param key - The key incl. the separator, e.g. "usage_usec "
+ * @return const char* - The value, NULL if not found
+ ***********************************************/
+static const char *find_key(const char *buffer, const char *key)
+{
+	size_t length = strlen(key);
+	for (const char *p = buffer; (p = strstr(p, key)); p += length)
+	{
+		if ((p == buffer) || (p[-1] == '\n') || (p[-1] == ' '))
+		{
+			return p + length;
+		}
+	}
+	return NULL;
+}
+
+/*******************************************/ /**
+ * @brief Read a file of a unit
+ *
+ * @return ssize_t - Length of the content, -1 on error
+ ***********************************************/
+static ssize_t read_file(const cgroup_unit_t *unit, int file, char *buffer)
+{
+	ssize_t length = pread(unit->fds[file], buffer, CGROUP_BUFFER_SIZE - 1, 0);
+	if (length >= 0)
+	{
+		buffer[length] = '\0';
+	}
+	return length;
+}
+
+/*******************************************/ /**
+ * @brief Read the referenced files of a unit
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+static int read_unit(cgroup_unit_t *unit)
+{
+	char buffer[CGROUP_BUFFER_SIZE];
+	const char *value;
+
+	if (unit->used[FILE_CPU_STAT])
+	{
+		if (read_file(unit, FILE_CPU_STAT, buffer) < 0)
+		{
+			return -1;
+		}
+		value = find_key(buffer, "usage_usec ");
+		unit->cpu_usec = value ? strtoull(value, NULL, 10) : 0;
+	}
+
+	if (unit->used[FILE_MEMORY_CURRENT])
+	{
+		if (read_file(unit, FILE_MEMORY_CURRENT, buffer) < 0)
+		{
+			return -1;
+		}
+		unit->mem_bytes = strtoull(buffer, NULL, 10);
+	}
+
+	if (unit->used[FILE_MEMORY_PRESSURE])
+	{
+		if (read_file(unit, FILE_MEMORY_PRESSURE, buffer) < 0)
+		{
+			return -1;
+		}
+		// "some avg10=0.12 avg60=..." is the first line
+		value = find_key(buffer, "avg10=");
+		unit->mem_pressure = value ? strtod(value, NULL) : 0;
+	}
+
+	if (unit->used[FILE_IO_STAT])
+	{
+		if (read_file(unit, FILE_IO_STAT, buffer) < 0)
+		{
+			return -1;
+		}
+		// one line per device "<major>:<minor> rbytes=<n> wbytes=<n> ..."
+		unit->read_bytes = 0;
+		unit->write_bytes = 0;
+		for (const char *p = buffer; (p = strstr(p, "rbytes=")); p++)
+		{
+			unit->read_bytes += strtoull(p + 7, NULL, 10);
+		}
+		for (const char *p = buffer; (p = strstr(p, "wbytes=")); p++)
+		{
+			unit->write_bytes += strtoull(p + 7, NULL, 10);
+		}
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Read the values of all referenced units. A unit that
+ *        is not running has no values, that is not a error.
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int cgroup_update()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+	for (int i = 0; i < unit_count; i++)
+	{
+		cgroup_unit_t *unit = &units[i];
+		if (open_unit(unit))
+		{
+			if ((errno != ENOENT) && (errno != ENODEV))
+			{
+				return -1;
+			}
+			continue;
+		}
+
+		if (read_unit(unit))
+		{
+			// the cgroup is removed, the unit is stopped or restarted
+			close_unit(unit);
+			continue;
+		}
+		unit->valid = true;
+
+		int result = rate_sample(&unit->cpu_rate, unit->cpu_usec, time, &unit->cpu_pct);
+		result |= rate_sample(&unit->read_rate, unit->read_bytes, time, &unit->read_per_s);
+		result |= rate_sample(&unit->write_rate, unit->write_bytes, time, &unit->write_per_s);
+		unit->rates_valid = ! result;
+		unit->cpu_pct /= 10000;		// usec per second to percent
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the value of a registered tag
+ *
+ * @param index - Index returned by cgroup_register()
+ * @param value - Stores the typed value
+ * @return int - ZERO at successfully, -1 if the unit is not
+ *               running or the rate has only one sample
+ ***********************************************/
+int cgroup_value(int index, metric_value_t *value)
+{
+	if ((index < 0) || (index >= metric_count) || (! units[metrics[index].unit].valid))
+	{
+		value->type = VALUE_NONE;
+		return -1;
+	}
+
+	const cgroup_unit_t *unit = &units[metrics[index].unit];
+	value->type = VALUE_INT;
+	switch (metrics[index].field)
+	{
+	case FIELD_CPU_USEC:
+		value->i = unit->cpu_usec;
+		break;
+	case FIELD_MEM_MB:
+		value->i = unit->mem_bytes >> 20;
+		break;
+	case FIELD_MEM_KB:
+		value->i = unit->mem_bytes >> 10;
+		break;
+	case FIELD_IO_READ_BYTES:
+		value->i = unit->read_bytes;
+		break;
+	case FIELD_IO_WRITE_BYTES:
+		value->i = unit->write_bytes;
+		break;
+	case FIELD_MEM_PRESSURE:
+		value->type = VALUE_DOUBLE;
+		value->d = unit->mem_pressure;
+		break;
+	case FIELD_CPU_PCT:
+	case FIELD_IO_READ_RATE:
+	case FIELD_IO_WRITE_RATE:
+		if (! unit->rates_valid)
+		{
+			value->type = VALUE_NONE;
+			return -1;
+		}
+		value->type = VALUE_DOUBLE;
+		value->d = (metrics[index].field == FIELD_CPU_PCT) ? unit->cpu_pct :
+				(metrics[index].field == FIELD_IO_READ_RATE) ? unit->read_per_s : unit->write_per_s;
+		break;
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Close all files and forget the tags
+ ***********************************************/
+void cgroup_free()
+{
+	for (int i = 0; i < unit_count; i++)
+	{
+		close_unit(&units[i]);
+		free(units[i].name);
+	}
+	free(units); units = NULL;
+	unit_count = 0;
+	free(metrics); metrics = NULL;
+	metric_count = 0;
+	free(root); root = NULL;
+}
@@ -0,0 +1,22 @@
+/*******************************************/ /**
+ * @file cgroup.h
+ * @author marsman7 (you@domain.com)
+ * @brief Resource usage of services from their cgroup v2,
+ *        read through fds that are kept open.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stddef.h>
+
+#include "metrics.h"
+
+int cgroup_init(const char *);
+int cgroup_register(const char *, size_t);
+int cgroup_update();
+int cgroup_value(int, metric_value_t *);
+void cgroup_free();
+
+#endif
@@ -0,0 +1,302 @@
+/*******************************************/ /**
+ * @file collector.c
+ * @author marsman7 (you@domain.com)
+ * @brief Small pool of worker threads that run the metric
+ *        collectors, so a slow collector can't stall the
+ *        main loop.
+ *
+ * A job is handed to the pool with collector_start() and
+ * belongs to the pool until its state is COLLECTOR_DONE. The
+ * state is a atomic, so the main loop can check it without
+ * taking the lock. A finished job is signalled on the eventfd
+ * of collector_pool_fd(), the main loop watches it and takes
+ * the job back with collector_reap(). collector_wait() blocks
+ * until a deadline and is meant for the start and the exit
+ * only, a job keeps running after the deadline.
+ *
+ * The workers are detached and belong to a generation of the
+ * pool. collector_pool_free() does not wait : it drops the
+ * queued jobs and starts a new generation, a worker of an old
+ * one exits after its running job. So a hung job keeps one
+ * thread, but never the caller.
+ *
+ * Without threads the jobs run in collector_start().
+ *
+ * @headerfile collector.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "collector.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done;
+static bool done_ready = false;
+static int done_fd = -1;		/*!< eventfd, counts the finished jobs */
+
+static int thread_count = 0;
+static int generation = 0;		/*!< workers of a older one exit */
+static collector_t *head = NULL;	/*!< queue of the jobs to run */
+static collector_t *tail = NULL;
+
+/*******************************************/ /**
+ * @brief Run a job and publish its result
+ ***********************************************/
+static void run_job(collector_t *job)
+{
+	errno = 0;
+	int result = job->run(job->arg);
+	int error = errno;
+
+	pthread_mutex_lock(&lock);
+	job->result = result;
+	job->error = result ? error : 0;
+	atomic_store_explicit(&job->state, COLLECTOR_DONE, memory_order_release);
+	pthread_cond_broadcast(&done);
+	pthread_mutex_unlock(&lock);
+
+	uint64_t one = 1;
+	if (write(done_fd, &one, sizeof(one)) < 0)
+	{
+		// the counter can't overflow, the main loop reads it
+	}
+}
+
+/*******************************************/ /**
+ * @brief Thread of a worker, runs the queued jobs until
+ *        its generation of the pool is stopped
+ *
+ * @param arg - The generation
+ ***********************************************/
+static void *worker(void *arg)
+{
+	int own_generation = (intptr_t)arg;
+
+	pthread_mutex_lock(&lock);
+	for (;;)
+	{
+		while ((! head) && (own_generation == generation))
+		{
+			pthread_cond_wait(&work, &lock);
+		}
+		if (own_generation != generation)
+		{
+			break;
+		}
+
+		collector_t *job = head;
+		if (! (head = job->next))
+		{
+			tail = NULL;
+		}
+		pthread_mutex_unlock(&lock);
+		run_job(job);
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+/*******************************************/ /**
+ * @brief Start the worker threads
+ *
+ * @param count - Count of threads, ZERO runs the jobs on the
+ *                thread of the caller
+ * @return int - ZERO at successfully, otherwise -1 and errno is
+ *               set, the pool runs with the threads started so far
+ ***********************************************/
+int collector_pool_init(int count)
+{
+	collector_pool_free();
+
+	// the eventfd is kept over a restart of the pool, it stays in the
+	// event loop of the caller
+	if ((done_fd < 0) && ((done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0))
+	{
+		return -1;
+	}
+
+	if (! done_ready)
+	{
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&done, &attr);
+		pthread_condattr_destroy(&attr);
+		done_ready = true;
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	int error = 0;
+	pthread_mutex_lock(&lock);
+	while ((thread_count < count) && (! error))
+	{
+		pthread_t thread;
+		if (! (error = pthread_create(&thread, &attr, worker, (void *)(intptr_t)generation)))
+		{
+			thread_count++;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	pthread_attr_destroy(&attr);
+
+	if (error)
+	{
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the fd that gets readable if a job is done. The
+ *        caller reads it with collector_pool_ack() and takes
+ *        back the done jobs.
+ *
+ * @return int - The eventfd, -1 before collector_pool_init()
+ ***********************************************/
+int collector_pool_fd()
+{
+	return done_fd;
+}
+
+/*******************************************/ /**
+ * @brief Reset the eventfd of the done jobs
+ ***********************************************/
+void collector_pool_ack()
+{
+	uint64_t count;
+	if (read(done_fd, &count, sizeof(count)) < 0)
+	{
+		// EAGAIN, no job is done since the last call
+	}
+}
+
+/*******************************************/ /**
+ * @brief Hand a job to the pool
+ *
+ * @param job - The job, 'run' and 'arg' are set
+ * @return int - ZERO at successfully, otherwise -1 and errno is
+ *               EBUSY if the job is not taken back yet
+ ***********************************************/
+int collector_start(collector_t *job)
+{
+	if (atomic_load_explicit(&job->state, memory_order_acquire) != COLLECTOR_IDLE)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	atomic_store_explicit(&job->state, COLLECTOR_RUNNING, memory_order_relaxed);
+
+	if (! thread_count)
+	{
+		run_job(job);
+		return 0;
+	}
+
+	pthread_mutex_lock(&lock);
+	job->next = NULL;
+	if (tail)
+	{
+		tail->next = job;
+	}
+	else
+	{
+		head = job;
+	}
+	tail = job;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the state of a job without waiting
+ *
+ * @return int - One of enum collector_state_t
+ ***********************************************/
+int collector_state(collector_t *job)
+{
+	return atomic_load_explicit(&job->state, memory_order_acquire);
+}
+
+/*******************************************/ /**
+ * @brief Wait until a job is done, the main loop does not wait
+ *        but watches collector_pool_fd()
+ *
+ * @param job - The job
+ * @param deadline - CLOCK_MONOTONIC time to give up
+ * @return int - ZERO if the job is done, otherwise -1 and errno
+ *               is ETIMEDOUT
+ ***********************************************/
+int collector_wait(collector_t *job, const struct timespec *deadline)
+{
+	pthread_mutex_lock(&lock);
+	while (atomic_load_explicit(&job->state, memory_order_acquire) == COLLECTOR_RUNNING)
+	{
+		if (pthread_cond_timedwait(&done, &lock, deadline) == ETIMEDOUT)
+		{
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (collector_state(job) != COLLECTOR_DONE)
+	{
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Take back a job that is done
+ *
+ * @param job - The job in state COLLECTOR_DONE
+ * @return int - Result of the run, on -1 errno is set by the run
+ ***********************************************/
+int collector_reap(collector_t *job)
+{
+	int result = job->result;
+	if (result)
+	{
+		errno = job->error;
+	}
+	atomic_store_explicit(&job->state, COLLECTOR_IDLE, memory_order_relaxed);
+	return result;
+}
+
+/*******************************************/ /**
+ * @brief Stop the worker threads without waiting. The queued
+ *        jobs are dropped and back in state COLLECTOR_IDLE, a
+ *        running job is finished on its thread and is taken
+ *        back with collector_reap() as before.
+ ***********************************************/
+void collector_pool_free()
+{
+	pthread_mutex_lock(&lock);
+	while (head)
+	{
+		collector_t *job = head;
+		head = job->next;
+		atomic_store_explicit(&job->state, COLLECTOR_IDLE, memory_order_relaxed);
+	}
+	tail = NULL;
+	generation++;
+	thread_count = 0;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,49 @@
+/*******************************************/ /**
+ * @file collector.h
+ * @author marsman7 (you@domain.com)
+ * @brief Small pool of worker threads that run the metric
+ *        collectors, so a slow collector can't stall the
+ *        main loop.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <stdatomic.h>
+#include <time.h>
+
+/*******************************************/ /**
+ * @brief States of a collector job
+ ***********************************************/
+enum collector_state_t
+{
+	COLLECTOR_IDLE = 0,	/*!< owned by the caller */
+	COLLECTOR_RUNNING,	/*!< owned by the pool */
+	COLLECTOR_DONE		/*!< finished, result not taken yet */
+};
+
+/*******************************************/ /**
+ * @brief A job of the pool, the memory is owned by the
+ *        caller and must stay valid until it is done
+ ***********************************************/
+typedef struct collector_t
+{
+	int (*run)(void *arg);	/*!< returns ZERO or -1 and sets errno */
+	void *arg;
+	atomic_int state;	/*!< one of enum collector_state_t */
+	int result;
+	int error;		/*!< errno of a failed run */
+	struct collector_t *next;
+} collector_t;
+
+int collector_pool_init(int);
+int collector_pool_fd();
+void collector_pool_ack();
+int collector_start(collector_t *);
+int collector_state(collector_t *);
+int collector_wait(collector_t *, const struct timespec *);
+int collector_reap(collector_t *);
+void collector_pool_free();
+
+#endif
@@ -0,0 +1,269 @@
+/*******************************************/ /**
+ * @file compress.c
+ * @author marsman7 (you@domain.com)
+ * @brief Compresses payloads with zlib or zstd and an 
+ *        optional shared dictionary.
+ *
+ * A compressed payload starts with the marker "MHZ" and one
+ * byte of the algorithm ('z' or 's'), so a subscriber can tell
+ * it from a plain payload. The zlib stream names the dictionary
+ * by its Adler-32 in the header, the zstd frame by its id. The
+ * streams and the dictionary are prepared once and reused for
+ * every payload.
+ *
+ * @headerfile compress.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+
+#define MAX_DICT_SIZE (1024 * 1024)
+
+/*******************************************/ /**
+ * @brief Get the algorithm from its name
+ *
+ * @param name - "none", "zlib" or "zstd"
+ * @return int - One of enum compress_algo_t, -1 if unknown 
+ *               or not compiled in
+ ***********************************************/
+int compress_algo(const char *name)
+{
+	if (! strcasecmp(name, "none"))
+	{
+		return COMPRESS_NONE;
+	}
+	if (! strcasecmp(name, "zlib"))
+	{
+		return COMPRESS_ZLIB;
+	}
+#ifdef HAVE_ZSTD
+	if (! strcasecmp(name, "zstd"))
+	{
+		return COMPRESS_ZSTD;
+	}
+#endif
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Read the dictionary file
+ *
+ * @param compressor - Stores the dictionary
+ * @param path - The file
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+static int read_dict(compress_t *compressor, const char *path)
+{
+	struct stat info;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if (fstat(fd, &info))
+	{
+		close(fd);
+		return -1;
+	}
+	if ((info.st_size <= 0) || (info.st_size > MAX_DICT_SIZE))
+	{
+		close(fd);
+		errno = EFBIG;
+		return -1;
+	}
+	if (! (compressor->dict = malloc(info.st_size)))
+	{
+		close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	ssize_t length = read(fd, compressor->dict, info.st_size);
+	close(fd);
+	if (length != info.st_size)
+	{
+		free(compressor->dict);
+		compressor->dict = NULL;
+		errno = EIO;
+		return -1;
+	}
+	compressor->dict_length = length;
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Prepare the compressor
+ *
+ * @param compressor - The compressor to init
+ * @param dict_path - Dictionary file, NULL or "" for none
+ * @param level - Compression level, -1 for the default of the algorithm
+ * @return int - ZERO at successfully, otherwise -1 and errno is set.
+ *               The compressor is usable without the dictionary 
+ *               if only the dictionary failed.
+ ***********************************************/
+int compress_init(compress_t *compressor, const char *dict_path, int level)
+{
+	memset(compressor, 0, sizeof(*compressor));
+	compressor->level = level;
+
+	if (deflateInit(&compressor->zlib, (level < 0) ? Z_DEFAULT_COMPRESSION : level) != Z_OK)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	compressor->zlib_ready = true;
+
+#ifdef HAVE_ZSTD
+	if (! (compressor->zstd = ZSTD_createCCtx()))
+	{
+		compress_free(compressor);
+		errno = ENOMEM;
+		return -1;
+	}
+#endif
+
+	if (dict_path && *dict_path)
+	{
+		if (read_dict(compressor, dict_path))
+		{
+			return -1;
+		}
+#ifdef HAVE_ZSTD
+		compressor->zstd_dict = ZSTD_createCDict(compressor->dict, compressor->dict_length,
+				(level < 0) ? ZSTD_CLEVEL_DEFAULT : level);
+#endif
+	}
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the max. size of a compressed payload 
+ *        including the marker
+ *
+ * @param algo - The algorithm
+ * @param length - Length of the uncompressed payload
+ * @return size_t - Size of the buffer for compress_payload()
+ ***********************************************/
+size_t compress_bound(enum compress_algo_t algo, size_t length)
+{
+	switch (algo)
+	{
+	case COMPRESS_ZLIB:
+		return COMPRESS_MARKER_SIZE + compressBound(length);
+#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+		return COMPRESS_MARKER_SIZE + ZSTD_compressBound(length);
+#endif
+	default:
+		return 0;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Compress a payload
+ *
+ * @param compressor - A prepared compressor
+ * @param algo - The algorithm
+ * @param src - The payload
+ * @param length - Length of the payload
+ * @param dst - Destination, see compress_bound()
+ * @param dst_size - Size of the destination
+ * @return long - Length of the compressed payload, -1 on error
+ ***********************************************/
+long compress_payload(compress_t *compressor, enum compress_algo_t algo, const void *src, size_t length,
+		uint8_t *dst, size_t dst_size)
+{
+	if (dst_size < compress_bound(algo, length))
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	memcpy(dst, COMPRESS_MARKER, COMPRESS_MARKER_SIZE - 1);
+	dst[COMPRESS_MARKER_SIZE - 1] = algo;
+
+	switch (algo)
+	{
+	case COMPRESS_ZLIB:
+	{
+		z_stream *stream = &compressor->zlib;
+		// The reset drops the dictionary, it is set again for each stream
+		if ( (deflateReset(stream) != Z_OK) || (compressor->dict &&
+				(deflateSetDictionary(stream, compressor->dict, compressor->dict_length) != Z_OK)) )
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		stream->next_in = (Bytef *)src;
+		stream->avail_in = length;
+		stream->next_out = dst + COMPRESS_MARKER_SIZE;
+		stream->avail_out = dst_size - COMPRESS_MARKER_SIZE;
+		if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+		{
+			errno = ENOBUFS;
+			return -1;
+		}
+		return COMPRESS_MARKER_SIZE + stream->total_out;
+	}
+#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+	{
+		size_t result;
+		if (compressor->zstd_dict)
+		{
+			result = ZSTD_compress_usingCDict(compressor->zstd, dst + COMPRESS_MARKER_SIZE, 
+					dst_size - COMPRESS_MARKER_SIZE, src, length, compressor->zstd_dict);
+		}
+		else
+		{
+			result = ZSTD_compressCCtx(compressor->zstd, dst + COMPRESS_MARKER_SIZE, 
+					dst_size - COMPRESS_MARKER_SIZE, src, length, 
+					(compressor->level < 0) ? ZSTD_CLEVEL_DEFAULT : compressor->level);
+		}
+		if (ZSTD_isError(result))
+		{
+			errno = ENOBUFS;
+			return -1;
+		}
+		return COMPRESS_MARKER_SIZE + result;
+	}
+#endif
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Give free the compressor and the dictionary
+ *
+ * @param compressor - The compressor
+ ***********************************************/
+void compress_free(compress_t *compressor)
+{
+	if (compressor->zlib_ready)
+	{
+		deflateEnd(&compressor->zlib);
+	}
+#ifdef HAVE_ZSTD
+	ZSTD_freeCDict(compressor->zstd_dict);
+	ZSTD_freeCCtx(compressor->zstd);
+#endif
+	free(compressor->dict);
+	memset(compressor, 0, sizeof(*compressor));
+}
@@ -0,0 +1,51 @@
+/*******************************************/ /**
+ * @file compress.h
+ * @author marsman7 (you@domain.com)
+ * @brief Compresses payloads with zlib or zstd and an 
+ *        optional shared dictionary.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+#define COMPRESS_MARKER "MHZ"	/*!< prefix of a compressed payload, followed by the algorithm */
+#define COMPRESS_MARKER_SIZE 4
+
+/*******************************************/ /**
+ * @brief Compression algorithms, the value is the last 
+ *        byte of the marker
+ ***********************************************/
+enum compress_algo_t
+{
+	COMPRESS_NONE = 0,
+	COMPRESS_ZLIB = 'z',	/*!< zlib stream, RFC 1950 */
+	COMPRESS_ZSTD = 's'	/*!< zstd frame, only with HAVE_ZSTD */
+};
+
+/*******************************************/ /**
+ * @brief Compressor state shared by all jobs
+ ***********************************************/
+typedef struct compress_t
+{
+	int level;
+	uint8_t *dict;		/*!< dictionary, NULL for none */
+	size_t dict_length;
+	z_stream zlib;
+	bool zlib_ready;
+	void *zstd;		/*!< ZSTD_CCtx */
+	void *zstd_dict;	/*!< ZSTD_CDict */
+} compress_t;
+
+int compress_algo(const char *);
+int compress_init(compress_t *, const char *, int);
+size_t compress_bound(enum compress_algo_t, size_t);
+long compress_payload(compress_t *, enum compress_algo_t, const void *, size_t, uint8_t *, size_t);
+void compress_free(compress_t *);
+
+#endif
@@ -0,0 +1,423 @@
+/*******************************************/ /**
+ * @file cpustat.c
+ * @author marsman7 (you@domain.com)
+ * @brief Utilisation of the CPU cores from the deltas
+ *        of /proc/stat between two samples.
+ *
+ * /proc/stat is kept open and read with pread(). The counters 
+ * of the cores are stored as structure of arrays, so the pass 
+ * over the deltas and percentages is a plain loop over 
+ * contiguous arrays that the compiler can vectorise. Only a 
+ * summary of fixed size is reported : min, max, mean and the 
+ * 95th percentile across the cores plus the ids of the busiest 
+ * cores. The arrays are resized if the count of online cores
+ * changes, the next sample starts from new then.
+ *
+ * Each baseline keeps its own previous sample and summary, so
+ * callers that sample at a different pace, e.g. the window tags
+ * between two publishes, do not shorten the deltas of each other.
+ *
+ * @headerfile cpustat.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cpustat.h"
+
+#define PROC_STAT "/proc/stat"
+#define STAT_BUFFER_SIZE 16384	/*!< first size of the read buffer, doubled if too small */
+#define STAT_FIELDS 8		/*!< user nice system idle iowait irq softirq steal */
+
+static int fd = -1;
+static char *buffer = NULL;
+static size_t buffer_size = 0;
+
+// Structure of arrays, one entry per online core
+static int capacity = 0;
+static int count = 0;
+static int *ids = NULL;
+static uint64_t *busy = NULL;
+static uint64_t *total = NULL;
+static uint64_t *prev_busy[CPUSTAT_BASELINES] = { NULL };
+static uint64_t *prev_total[CPUSTAT_BASELINES] = { NULL };
+static int32_t *delta_busy = NULL;
+static int32_t *delta_total = NULL;
+static float *usage = NULL;
+static float *scratch = NULL;	/*!< copy of 'usage' for the percentile */
+
+static uint64_t all_busy = 0, all_total = 0;
+static uint64_t prev_all_busy[CPUSTAT_BASELINES] = {0}, prev_all_total[CPUSTAT_BASELINES] = {0};
+static bool have_prev[CPUSTAT_BASELINES] = {false};
+static cpustat_summary_t summary[CPUSTAT_BASELINES] = {0};
+static bool have_summary[CPUSTAT_BASELINES] = {false};
+static int busiest_count = 3;
+
+/*******************************************/ /**
+ * @brief Grow the arrays to the count of cores
+ *
+ * @return int - ZERO at successfully, otherwise -1
+ ***********************************************/
+static int reserve(int cores)
+{
+	if (cores <= capacity)
+	{
+		return 0;
+	}
+
+	void **arrays[] = { (void **)&ids, (void **)&busy, (void **)&total, (void **)&prev_busy[0],
+			(void **)&prev_total[0], (void **)&prev_busy[1], (void **)&prev_total[1],
+			(void **)&delta_busy, (void **)&delta_total, (void **)&usage, (void **)&scratch };
+	size_t sizes[] = { sizeof(int), sizeof(uint64_t), sizeof(uint64_t), sizeof(uint64_t),
+			sizeof(uint64_t), sizeof(uint64_t), sizeof(uint64_t), sizeof(int32_t), 
+			sizeof(int32_t), sizeof(float), sizeof(float) };
+
+	for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+	{
+		void *array = realloc(*arrays[i], cores * sizes[i]);
+		if (! array)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		*arrays[i] = array;
+	}
+	capacity = cores;
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Parse the counters of a "cpu" line
+ *
+ * @param p - Position after the name
+ * @param end - End of the line
+ * @param line_busy - Stores the busy time
+ * @param line_total - Stores the total time
+ ***********************************************/
+static void parse_line(const char *p, const char *end, uint64_t *line_busy, uint64_t *line_total)
+{
+	uint64_t fields[STAT_FIELDS] = {0};
+
+	for (int i = 0; i < STAT_FIELDS; i++)
+	{
+		while ((p < end) && (*p == ' '))
+		{
+			p++;
+		}
+		uint64_t value = 0;
+		while ((p < end) && (*p >= '0') && (*p <= '9'))
+		{
+			value = value * 10 + (*p++ - '0');
+		}
+		fields[i] = value;
+	}
+
+	// idle and iowait are not busy, guest is already part of user
+	uint64_t idle = fields[3] + fields[4];
+	*line_busy = fields[0] + fields[1] + fields[2] + fields[5] + fields[6] + fields[7];
+	*line_total = *line_busy + idle;
+}
+
+/*******************************************/ /**
+ * @brief Read /proc/stat into the buffer, the buffer 
+ *        grows if the file does not fit
+ *
+ * @return ssize_t - Length of the content, -1 on error
+ ***********************************************/
+static ssize_t read_stat()
+{
+	if ((fd < 0) && ((fd = open(PROC_STAT, O_RDONLY | O_CLOEXEC)) < 0))
+	{
+		return -1;
+	}
+
+	for (;;)
+	{
+		if (! buffer)
+		{
+			size_t size = buffer_size ? buffer_size * 2 : STAT_BUFFER_SIZE;
+			if (! (buffer = malloc(size)))
+			{
+				errno = ENOMEM;
+				return -1;
+			}
+			buffer_size = size;
+		}
+
+		ssize_t length = pread(fd, buffer, buffer_size, 0);
+		if ((length < 0) || ((size_t)length < buffer_size))
+		{
+			return length;
+		}
+
+		free(buffer);
+		buffer = NULL;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the value at a rank of the utilisations, the
+ *        scratch array is partially sorted
+ *
+ * @param n - Count of values in the scratch array
+ * @param rank - ZERO based rank in ascending order
+ * @return float - The value
+ ***********************************************/
+static float select_rank(int n, int rank)
+{
+	int left = 0, right = n - 1;
+
+	while (left < right)
+	{
+		float pivot = scratch[(left + right) / 2];
+		int i = left, j = right;
+		while (i <= j)
+		{
+			while (scratch[i] < pivot) i++;
+			while (scratch[j] > pivot) j--;
+			if (i <= j)
+			{
+				float swap = scratch[i];
+				scratch[i++] = scratch[j];
+				scratch[j--] = swap;
+			}
+		}
+		if (rank <= j)
+		{
+			right = j;
+		}
+		else if (rank >= i)
+		{
+			left = i;
+		}
+		else
+		{
+			break;
+		}
+	}
+	return scratch[rank];
+}
+
+/*******************************************/ /**
+ * @brief Compute the summary from the deltas of the
+ *        current and the previous sample of a baseline
+ *
+ * @param baseline - Index of the baseline
+ ***********************************************/
+static void summarize(int baseline)
+{
+	cpustat_summary_t *result = &summary[baseline];
+
+	// The hot loops over the arrays. The deltas of a tick fit in
+	// 32 bit, which converts to float in SIMD registers. Local
+	// restrict pointers tell the compiler the arrays don't overlap.
+	const int n = count;
+	const uint64_t *restrict cur_busy = busy, *restrict cur_total = total;
+	const uint64_t *restrict old_busy = prev_busy[baseline], *restrict old_total = prev_total[baseline];
+	int32_t *restrict d_busy = delta_busy, *restrict d_total = delta_total;
+	float *restrict percent = usage;
+
+	for (int i = 0; i < n; i++)
+	{
+		d_busy[i] = cur_busy[i] - old_busy[i];
+		d_total[i] = cur_total[i] - old_total[i];
+	}
+	for (int i = 0; i < n; i++)
+	{
+		// a core without ticks gets 0 / 1
+		int32_t divisor = d_total[i] + (d_total[i] <= 0);
+		percent[i] = (float)(d_busy[i] * (d_total[i] > 0)) * 100.0f / (float)divisor;
+	}
+
+	float min = percent[0], max = percent[0];
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		min = (percent[i] < min) ? percent[i] : min;
+		max = (percent[i] > max) ? percent[i] : max;
+		sum += percent[i];
+	}
+
+	memcpy(scratch, usage, count * sizeof(float));
+	result->cores = count;
+	result->min = min;
+	result->max = max;
+	result->mean = sum / count;
+	result->p95 = select_rank(count, (count * 95 + 99) / 100 - 1);
+
+	uint64_t delta_total = all_total - prev_all_total[baseline];
+	result->total = delta_total ? (all_busy - prev_all_busy[baseline]) * 100.0 / delta_total : 0;
+
+	// Busiest cores, a small insertion list is enough for a few ids
+	int top[CPUSTAT_MAX_BUSIEST];
+	int top_count = 0;
+	for (int i = 0; (i < count) && (busiest_count > 0); i++)
+	{
+		if ((top_count == busiest_count) && (usage[i] <= usage[top[top_count - 1]]))
+		{
+			continue;
+		}
+		int pos = (top_count < busiest_count) ? top_count++ : top_count - 1;
+		while ((pos > 0) && (usage[top[pos - 1]] < usage[i]))
+		{
+			top[pos] = top[pos - 1];
+			pos--;
+		}
+		top[pos] = i;
+	}
+
+	size_t length = 0;
+	result->busiest[0] = '\0';
+	for (int i = 0; i < top_count; i++)
+	{
+		length += snprintf(result->busiest + length, sizeof(result->busiest) - length,
+				i ? ",%d" : "%d", ids[top[i]]);
+		if (length >= sizeof(result->busiest))
+		{
+			break;
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Set the count of busiest cores in the summary
+ *
+ * @param busiest - Count, limited to CPUSTAT_MAX_BUSIEST
+ ***********************************************/
+void cpustat_init(int busiest)
+{
+	busiest_count = (busiest < 0) ? 0 : (busiest > CPUSTAT_MAX_BUSIEST) ? CPUSTAT_MAX_BUSIEST : busiest;
+}
+
+/*******************************************/ /**
+ * @brief Take a new sample and compute the summary of the
+ *        deltas to the previous sample of the baseline
+ *
+ * @param baseline - Index of the baseline, 0 to CPUSTAT_BASELINES - 1
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int cpustat_update(int baseline)
+{
+	ssize_t length = read_stat();
+	if (length < 0)
+	{
+		have_summary[baseline] = false;
+		return -1;
+	}
+
+	// The "cpu" lines are the first of the file
+	const char *p = buffer;
+	const char *end = buffer + length;
+	int cores = 0;
+	bool changed = false;
+
+	while ((p + 3 < end) && (! memcmp(p, "cpu", 3)))
+	{
+		const char *line_end = memchr(p, '\n', end - p);
+		if (! line_end)
+		{
+			line_end = end;
+		}
+
+		if (p[3] == ' ')
+		{
+			parse_line(p + 3, line_end, &all_busy, &all_total);
+		}
+		else
+		{
+			int id = 0;
+			for (p += 3; (p < line_end) && (*p >= '0') && (*p <= '9'); p++)
+			{
+				id = id * 10 + (*p - '0');
+			}
+			if (reserve(cores + 1))
+			{
+				have_summary[baseline] = false;
+				return -1;
+			}
+			// an other core at this slot, e.g. after hotplug
+			changed |= (cores >= count) || (ids[cores] != id);
+			ids[cores] = id;
+			parse_line(p, line_end, &busy[cores], &total[cores]);
+			cores++;
+		}
+		p = line_end + 1;
+	}
+
+	if (! cores)
+	{
+		have_summary[baseline] = false;
+		errno = ENODATA;
+		return -1;
+	}
+	changed |= (cores != count);
+	count = cores;
+
+	// the previous samples of all baselines are of other cores
+	for (int i = 0; changed && (i < CPUSTAT_BASELINES); i++)
+	{
+		have_prev[i] = false;
+	}
+
+	have_summary[baseline] = have_prev[baseline];
+	if (have_summary[baseline])
+	{
+		summarize(baseline);
+	}
+
+	memcpy(prev_busy[baseline], busy, count * sizeof(uint64_t));
+	memcpy(prev_total[baseline], total, count * sizeof(uint64_t));
+	prev_all_busy[baseline] = all_busy;
+	prev_all_total[baseline] = all_total;
+	have_prev[baseline] = true;
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the summary of the last update of a baseline
+ *
+ * @param baseline - Index of the baseline
+ * @return const cpustat_summary_t* - NULL if there is no 
+ *         previous sample to compare with
+ ***********************************************/
+const cpustat_summary_t *cpustat_summary(int baseline)
+{
+	return have_summary[baseline] ? &summary[baseline] : NULL;
+}
+
+/*******************************************/ /**
+ * @brief Close /proc/stat and give free the arrays
+ ***********************************************/
+void cpustat_free()
+{
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	fd = -1;
+	free(buffer); buffer = NULL;
+	buffer_size = 0;
+	free(ids); ids = NULL;
+	free(busy); busy = NULL;
+	free(total); total = NULL;
+	for (int i = 0; i < CPUSTAT_BASELINES; i++)
+	{
+		free(prev_busy[i]); prev_busy[i] = NULL;
+		free(prev_total[i]); prev_total[i] = NULL;
+		have_prev[i] = false;
+		have_summary[i] = false;
+	}
+	free(delta_busy); delta_busy = NULL;
+	free(delta_total); delta_total = NULL;
+	free(usage); usage = NULL;
+	free(scratch); scratch = NULL;
+	capacity = count = 0;
+}
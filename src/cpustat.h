@@ -0,0 +1,36 @@
+/*******************************************/ /**
+ * @file cpustat.h
+ * @author marsman7 (you@domain.com)
+ * @brief Utilisation of the CPU cores from the deltas
+ *        of /proc/stat between two samples.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef CPUSTAT_H
+#define CPUSTAT_H
+
+#define CPUSTAT_MAX_BUSIEST 8		/*!< max. count of busiest cores reported */
+#define CPUSTAT_BUSIEST_SIZE (CPUSTAT_MAX_BUSIEST * 6)	/*!< text of the ids incl. zero */
+#define CPUSTAT_BASELINES 2		/*!< count of callers with own previous samples */
+
+/*******************************************/ /**
+ * @brief Summary over all cores, the size does not 
+ *        depend on the count of cores
+ ***********************************************/
+typedef struct cpustat_summary_t
+{
+	int cores;		/*!< count of online cores */
+	double total;		/*!< utilisation of all cores in percent */
+	double min;		/*!< of the per core utilisation */
+	double max;
+	double mean;
+	double p95;
+	char busiest[CPUSTAT_BUSIEST_SIZE];	/*!< ids of the busiest cores, comma separated */
+} cpustat_summary_t;
+
+void cpustat_init(int);
+int cpustat_update(int);
+const cpustat_summary_t *cpustat_summary(int);
+void cpustat_free();
+
+#endif
@@ -0,0 +1,270 @@
+/*******************************************/ /**
+ * @file encode.c
+ * @author marsman7 (you@domain.com)
+ * @brief Encodes typed tag values as CBOR or MessagePack
+ *        map into a pre-sized buffer.
+ *
+ * Numbers are written in their binary form and never pass a
+ * text conversion. Integers use the shortest encoding, doubles
+ * are written as 64 bit float. The caller sizes the buffer with
+ * ENCODE_HEADER_SIZE for each header plus the text lengths.
+ *
+ * @headerfile encode.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+#include <strings.h>
+
+#include "encode.h"
+
+#define CBOR_UINT 0x00
+#define CBOR_NEGINT 0x20
+#define CBOR_TEXT 0x60
+#define CBOR_MAP 0xa0
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT64 0xfb
+
+#define MSGPACK_NIL 0xc0
+#define MSGPACK_FLOAT64 0xcb
+
+static const char *format_names[] = { "text", "cbor", "msgpack" };
+
+/*******************************************/ /**
+ * @brief Get the format from its name
+ *
+ * @param name - "text", "cbor" or "msgpack"
+ * @return int - One of enum payload_format_t, -1 if unknown
+ ***********************************************/
+int payload_format(const char *name)
+{
+	for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++)
+	{
+		if (! strcasecmp(format_names[i], name))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Write a number big endian
+ *
+ * @param dst - Destination
+ * @param value - The number
+ * @param size - Count of bytes to write
+ * @return size_t - Count of written bytes
+ ***********************************************/
+static size_t put_be(uint8_t *dst, uint64_t value, size_t size)
+{
+	for (size_t i = size; i > 0; i--)
+	{
+		dst[i - 1] = value & 0xff;
+		value >>= 8;
+	}
+	return size;
+}
+
+/*******************************************/ /**
+ * @brief Write a CBOR header with the major type and the
+ *        shortest form of the argument
+ *
+ * @param dst - Destination
+ * @param major - Major type, already shifted to the upper bits
+ * @param value - Argument of the header
+ * @return size_t - Count of written bytes
+ ***********************************************/
+static size_t cbor_header(uint8_t *dst, uint8_t major, uint64_t value)
+{
+	if (value < 24)
+	{
+		*dst = major | value;
+		return 1;
+	}
+	if (value <= UINT8_MAX)
+	{
+		*dst = major | 24;
+		return 1 + put_be(dst + 1, value, 1);
+	}
+	if (value <= UINT16_MAX)
+	{
+		*dst = major | 25;
+		return 1 + put_be(dst + 1, value, 2);
+	}
+	if (value <= UINT32_MAX)
+	{
+		*dst = major | 26;
+		return 1 + put_be(dst + 1, value, 4);
+	}
+	*dst = major | 27;
+	return 1 + put_be(dst + 1, value, 8);
+}
+
+/*******************************************/ /**
+ * @brief Write a MessagePack integer in the shortest form
+ *
+ * @param dst - Destination
+ * @param value - The integer
+ * @return size_t - Count of written bytes
+ ***********************************************/
+static size_t msgpack_int(uint8_t *dst, long long value)
+{
+	if ((value >= 0) && (value <= 0x7f))
+	{
+		*dst = value;		// positive fixint
+		return 1;
+	}
+	if ((value < 0) && (value >= -32))
+	{
+		*dst = (uint8_t)value;	// negative fixint
+		return 1;
+	}
+	if (value > 0)
+	{
+		if (value <= UINT8_MAX)
+		{
+			*dst = 0xcc;
+			return 1 + put_be(dst + 1, value, 1);
+		}
+		if (value <= UINT16_MAX)
+		{
+			*dst = 0xcd;
+			return 1 + put_be(dst + 1, value, 2);
+		}
+		if (value <= UINT32_MAX)
+		{
+			*dst = 0xce;
+			return 1 + put_be(dst + 1, value, 4);
+		}
+		*dst = 0xcf;
+		return 1 + put_be(dst + 1, value, 8);
+	}
+	if (value >= INT8_MIN)
+	{
+		*dst = 0xd0;
+		return 1 + put_be(dst + 1, value, 1);
+	}
+	if (value >= INT16_MIN)
+	{
+		*dst = 0xd1;
+		return 1 + put_be(dst + 1, value, 2);
+	}
+	if (value >= INT32_MIN)
+	{
+		*dst = 0xd2;
+		return 1 + put_be(dst + 1, value, 4);
+	}
+	*dst = 0xd3;
+	return 1 + put_be(dst + 1, value, 8);
+}
+
+/*******************************************/ /**
+ * @brief Write the header of a map
+ *
+ * @param dst - Destination, ENCODE_HEADER_SIZE bytes at most
+ * @param format - PAYLOAD_CBOR or PAYLOAD_MSGPACK
+ * @param count - Count of key value pairs that follow
+ * @return size_t - Count of written bytes
+ ***********************************************/
+size_t encode_map(uint8_t *dst, enum payload_format_t format, size_t count)
+{
+	if (format == PAYLOAD_CBOR)
+	{
+		return cbor_header(dst, CBOR_MAP, count);
+	}
+
+	if (count < 16)
+	{
+		*dst = 0x80 | count;
+		return 1;
+	}
+	if (count <= UINT16_MAX)
+	{
+		*dst = 0xde;
+		return 1 + put_be(dst + 1, count, 2);
+	}
+	*dst = 0xdf;
+	return 1 + put_be(dst + 1, count, 4);
+}
+
+/*******************************************/ /**
+ * @brief Write a text string, used for the keys of the map
+ *
+ * @param dst - Destination, ENCODE_HEADER_SIZE + length bytes at most
+ * @param format - PAYLOAD_CBOR or PAYLOAD_MSGPACK
+ * @param text - The text, not terminated
+ * @param length - Length of the text
+ * @return size_t - Count of written bytes
+ ***********************************************/
+size_t encode_text(uint8_t *dst, enum payload_format_t format, const char *text, size_t length)
+{
+	size_t header;
+
+	if (format == PAYLOAD_CBOR)
+	{
+		header = cbor_header(dst, CBOR_TEXT, length);
+	}
+	else if (length < 32)
+	{
+		*dst = 0xa0 | length;
+		header = 1;
+	}
+	else if (length <= UINT8_MAX)
+	{
+		*dst = 0xd9;
+		header = 1 + put_be(dst + 1, length, 1);
+	}
+	else if (length <= UINT16_MAX)
+	{
+		*dst = 0xda;
+		header = 1 + put_be(dst + 1, length, 2);
+	}
+	else
+	{
+		*dst = 0xdb;
+		header = 1 + put_be(dst + 1, length, 4);
+	}
+
+	memcpy(dst + header, text, length);
+	return header + length;
+}
+
+/*******************************************/ /**
+ * @brief Write a typed value
+ *
+ * @param dst - Destination, ENCODE_HEADER_SIZE + text_size bytes at most
+ * @param format - PAYLOAD_CBOR or PAYLOAD_MSGPACK
+ * @param value - The value
+ * @param text_size - Max. length of a text value, longer texts are cut
+ * @return size_t - Count of written bytes
+ ***********************************************/
+size_t encode_value(uint8_t *dst, enum payload_format_t format, const metric_value_t *value, size_t text_size)
+{
+	switch (value->type)
+	{
+	case VALUE_INT:
+		if (format == PAYLOAD_MSGPACK)
+		{
+			return msgpack_int(dst, value->i);
+		}
+		if (value->i < 0)
+		{
+			// CBOR stores -1 - n
+			return cbor_header(dst, CBOR_NEGINT, -(value->i + 1));
+		}
+		return cbor_header(dst, CBOR_UINT, value->i);
+	case VALUE_DOUBLE:
+	{
+		uint64_t bits;
+		memcpy(&bits, &value->d, sizeof(bits));
+		*dst = (format == PAYLOAD_CBOR) ? CBOR_FLOAT64 : MSGPACK_FLOAT64;
+		return 1 + put_be(dst + 1, bits, 8);
+	}
+	case VALUE_TEXT:
+		return encode_text(dst, format, value->text, strnlen(value->text, text_size));
+	default:
+		*dst = (format == PAYLOAD_CBOR) ? CBOR_NULL : MSGPACK_NIL;
+		return 1;
+	}
+}
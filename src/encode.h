@@ -0,0 +1,34 @@
+/*******************************************/ /**
+ * @file encode.h
+ * @author marsman7 (you@domain.com)
+ * @brief Encodes typed tag values as CBOR or MessagePack
+ *        map into a pre-sized buffer.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "metrics.h"
+
+#define ENCODE_HEADER_SIZE 9	/*!< max. size of a type and length header */
+
+/*******************************************/ /**
+ * @brief Payload formats of a job
+ ***********************************************/
+enum payload_format_t
+{
+	PAYLOAD_TEXT = 0,	/*!< rendered template text */
+	PAYLOAD_CBOR,		/*!< CBOR map, RFC 8949 */
+	PAYLOAD_MSGPACK		/*!< MessagePack map */
+};
+
+int payload_format(const char *);
+size_t encode_map(uint8_t *, enum payload_format_t, size_t);
+size_t encode_text(uint8_t *, enum payload_format_t, const char *, size_t);
+size_t encode_value(uint8_t *, enum payload_format_t, const metric_value_t *, size_t);
+
+#endif
@@ -0,0 +1,498 @@
+/*******************************************/ /**
+ * @file hb-decode.c
+ * @author marsman7 (you@domain.com)
+ * @brief Decodes a CBOR or MessagePack payload of 
+ *        mqtt-heartbeat and prints it as JSON.
+ *
+ * Reads one message from a file or stdin, for example
+ *   mosquitto_sub -t tele/host/STATE -C 1 | hb-decode cbor
+ * A zlib compressed payload is inflated first, with the 
+ * dictionary given by -D if the payload needs it.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <getopt.h>
+#include <zlib.h>
+
+#include "compress.h"
+
+#define MAX_MESSAGE_SIZE (256 * 1024)
+#define MAX_DEPTH 16
+#define MAX_DICT_SIZE (1024 * 1024)
+
+/*******************************************/ /**
+ * @brief Read position in the message
+ ***********************************************/
+typedef struct reader_t
+{
+	const uint8_t *pos;
+	const uint8_t *end;
+	bool cbor;
+} reader_t;
+
+static bool decode_item(reader_t *, int);
+
+/*******************************************/ /**
+ * @brief Read a big endian number
+ *
+ * @param reader - Read position
+ * @param size - Count of bytes
+ * @param value - Stores the number
+ * @return bool - false if the message is too short
+ ***********************************************/
+static bool get_be(reader_t *reader, size_t size, uint64_t *value)
+{
+	if ((size_t)(reader->end - reader->pos) < size)
+	{
+		return false;
+	}
+	*value = 0;
+	while (size--)
+	{
+		*value = (*value << 8) | *reader->pos++;
+	}
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Print a string as JSON string
+ *
+ * @param reader - Read position at the first character
+ * @param length - Length of the string
+ * @return bool - false if the message is too short
+ ***********************************************/
+static bool print_string(reader_t *reader, uint64_t length)
+{
+	if ((uint64_t)(reader->end - reader->pos) < length)
+	{
+		return false;
+	}
+	putchar('"');
+	for (uint64_t i = 0; i < length; i++)
+	{
+		uint8_t c = *reader->pos++;
+		if ((c == '"') || (c == '\\'))
+		{
+			printf("\\%c", c);
+		}
+		else if (c < 0x20)
+		{
+			printf("\\u%04x", c);
+		}
+		else
+		{
+			putchar(c);
+		}
+	}
+	putchar('"');
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Print the items of a map or an array
+ *
+ * @param reader - Read position at the first item
+ * @param count - Count of entries
+ * @param map - Entries are key value pairs
+ * @param depth - Nesting depth
+ * @return bool - false on a malformed message
+ ***********************************************/
+static bool print_container(reader_t *reader, uint64_t count, bool map, int depth)
+{
+	putchar(map ? '{' : '[');
+	for (uint64_t i = 0; i < count; i++)
+	{
+		if (i)
+		{
+			putchar(',');
+		}
+		if (map)
+		{
+			if (! decode_item(reader, depth + 1))
+			{
+				return false;
+			}
+			putchar(':');
+		}
+		if (! decode_item(reader, depth + 1))
+		{
+			return false;
+		}
+	}
+	putchar(map ? '}' : ']');
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Print a float, JSON has no NaN and infinity
+ *
+ * @param value - The number
+ ***********************************************/
+static void print_double(double value)
+{
+	if (isfinite(value))
+	{
+		printf("%.17g", value);
+	}
+	else
+	{
+		printf("null");
+	}
+}
+
+/*******************************************/ /**
+ * @brief Decode and print one CBOR item
+ *
+ * @param reader - Read position
+ * @param depth - Nesting depth
+ * @return bool - false on a malformed or unsupported message
+ ***********************************************/
+static bool decode_cbor(reader_t *reader, int depth)
+{
+	uint8_t initial = *reader->pos++;
+	uint8_t major = initial >> 5;
+	uint8_t info = initial & 0x1f;
+	uint64_t arg = info;
+
+	if ((info >= 24) && (info <= 27))
+	{
+		if (! get_be(reader, 1 << (info - 24), &arg))
+		{
+			return false;
+		}
+	}
+	else if (info > 27)
+	{
+		return false;	// indefinite length is not written by the daemon
+	}
+
+	switch (major)
+	{
+	case 0:
+		printf("%llu", (unsigned long long)arg);
+		return true;
+	case 1:
+		printf("-%llu", (unsigned long long)arg + 1);
+		return true;
+	case 3:
+		return print_string(reader, arg);
+	case 4:
+		return print_container(reader, arg, false, depth);
+	case 5:
+		return print_container(reader, arg, true, depth);
+	case 7:
+		switch (info)
+		{
+		case 20: printf("false"); return true;
+		case 21: printf("true"); return true;
+		case 22:
+		case 23: printf("null"); return true;
+		case 26:
+		{
+			uint32_t bits = arg;
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			print_double(value);
+			return true;
+		}
+		case 27:
+		{
+			double value;
+			memcpy(&value, &arg, sizeof(value));
+			print_double(value);
+			return true;
+		}
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Decode and print one MessagePack item
+ *
+ * @param reader - Read position
+ * @param depth - Nesting depth
+ * @return bool - false on a malformed or unsupported message
+ ***********************************************/
+static bool decode_msgpack(reader_t *reader, int depth)
+{
+	uint8_t type = *reader->pos++;
+	uint64_t arg;
+
+	if (type <= 0x7f)
+	{
+		printf("%u", type);
+		return true;
+	}
+	if (type >= 0xe0)
+	{
+		printf("%d", (int8_t)type);
+		return true;
+	}
+	if ((type & 0xf0) == 0x80)
+	{
+		return print_container(reader, type & 0x0f, true, depth);
+	}
+	if ((type & 0xf0) == 0x90)
+	{
+		return print_container(reader, type & 0x0f, false, depth);
+	}
+	if ((type & 0xe0) == 0xa0)
+	{
+		return print_string(reader, type & 0x1f);
+	}
+
+	switch (type)
+	{
+	case 0xc0: printf("null"); return true;
+	case 0xc2: printf("false"); return true;
+	case 0xc3: printf("true"); return true;
+	case 0xca:
+	case 0xcb:
+		if (! get_be(reader, (type == 0xca) ? 4 : 8, &arg))
+		{
+			return false;
+		}
+		if (type == 0xca)
+		{
+			uint32_t bits = arg;
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			print_double(value);
+		}
+		else
+		{
+			double value;
+			memcpy(&value, &arg, sizeof(value));
+			print_double(value);
+		}
+		return true;
+	case 0xcc:
+	case 0xcd:
+	case 0xce:
+	case 0xcf:
+		if (! get_be(reader, 1 << (type - 0xcc), &arg))
+		{
+			return false;
+		}
+		printf("%llu", (unsigned long long)arg);
+		return true;
+	case 0xd0:
+	case 0xd1:
+	case 0xd2:
+	case 0xd3:
+	{
+		size_t size = 1 << (type - 0xd0);
+		if (! get_be(reader, size, &arg))
+		{
+			return false;
+		}
+		// sign extend
+		if ((size < 8) && (arg & (1ULL << (size * 8 - 1))))
+		{
+			arg |= ~0ULL << (size * 8);
+		}
+		printf("%lld", (long long)arg);
+		return true;
+	}
+	case 0xd9:
+	case 0xda:
+	case 0xdb:
+		if (! get_be(reader, 1 << (type - 0xd9), &arg))
+		{
+			return false;
+		}
+		return print_string(reader, arg);
+	case 0xdc:
+	case 0xdd:
+		if (! get_be(reader, (type == 0xdc) ? 2 : 4, &arg))
+		{
+			return false;
+		}
+		return print_container(reader, arg, false, depth);
+	case 0xde:
+	case 0xdf:
+		if (! get_be(reader, (type == 0xde) ? 2 : 4, &arg))
+		{
+			return false;
+		}
+		return print_container(reader, arg, true, depth);
+	default:
+		return false;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Decode and print one item
+ *
+ * @param reader - Read position
+ * @param depth - Nesting depth
+ * @return bool - false on a malformed or unsupported message
+ ***********************************************/
+static bool decode_item(reader_t *reader, int depth)
+{
+	if ((reader->pos >= reader->end) || (depth > MAX_DEPTH))
+	{
+		return false;
+	}
+	return reader->cbor ? decode_cbor(reader, depth) : decode_msgpack(reader, depth);
+}
+
+/*******************************************/ /**
+ * @brief Read a file or stdin into a buffer
+ *
+ * @param name - File name, NULL for stdin
+ * @param buffer - Destination
+ * @param size - Size of the destination
+ * @return long - Count of read bytes, -1 on error
+ ***********************************************/
+static long read_file(const char *name, uint8_t *buffer, size_t size)
+{
+	FILE *file = name ? fopen(name, "rb") : stdin;
+	if (! file)
+	{
+		perror(name);
+		return -1;
+	}
+
+	size_t length = fread(buffer, 1, size, file);
+	if (file != stdin)
+	{
+		fclose(file);
+	}
+	return length;
+}
+
+/*******************************************/ /**
+ * @brief Inflate a zlib compressed payload
+ *
+ * @param src - Compressed payload without the marker
+ * @param length - Length of the payload
+ * @param dst - Destination
+ * @param size - Size of the destination
+ * @param dict - Dictionary, NULL for none
+ * @param dict_length - Length of the dictionary
+ * @return long - Length of the inflated payload, -1 on error
+ ***********************************************/
+static long inflate_payload(const uint8_t *src, size_t length, uint8_t *dst, size_t size,
+		const uint8_t *dict, size_t dict_length)
+{
+	z_stream stream = {0};
+	if (inflateInit(&stream) != Z_OK)
+	{
+		return -1;
+	}
+	stream.next_in = (Bytef *)src;
+	stream.avail_in = length;
+	stream.next_out = dst;
+	stream.avail_out = size;
+
+	int result = inflate(&stream, Z_FINISH);
+	if ((result == Z_NEED_DICT) && dict && 
+			(inflateSetDictionary(&stream, dict, dict_length) == Z_OK))
+	{
+		result = inflate(&stream, Z_FINISH);
+	}
+	if (result != Z_STREAM_END)
+	{
+		fprintf(stderr, "Inflate failed : %s\n", 
+				(result == Z_NEED_DICT) ? "needs the dictionary (-D)" : (stream.msg ? stream.msg : "error"));
+		inflateEnd(&stream);
+		return -1;
+	}
+
+	length = stream.total_out;
+	inflateEnd(&stream);
+	return length;
+}
+
+/*******************************************/ /**
+ * @brief Main function
+ *
+ * @param argc - Count of arguments
+ * @param argv - Optional -D dictionary, the format "text", "cbor" 
+ *               or "msgpack" and optional a file name
+ * @return int - EXIT_SUCCESS if the message is decoded
+ ***********************************************/
+int main(int argc, char *argv[])
+{
+	static uint8_t dict[MAX_DICT_SIZE];
+	static uint8_t input[MAX_MESSAGE_SIZE];
+	static uint8_t inflated[MAX_MESSAGE_SIZE];
+	const char *dict_name = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "D:")) != -1)
+	{
+		if (opt != 'D')
+		{
+			optind = argc + 1;
+			break;
+		}
+		dict_name = optarg;
+	}
+
+	if ( (argc - optind < 1) || (argc - optind > 2) || (strcasecmp(argv[optind], "text") &&
+			strcasecmp(argv[optind], "cbor") && strcasecmp(argv[optind], "msgpack")) )
+	{
+		fprintf(stderr, "Usage : %s [-D dictionary] text|cbor|msgpack [file]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *format = argv[optind];
+
+	long dict_length = 0;
+	if (dict_name && ((dict_length = read_file(dict_name, dict, sizeof(dict))) < 0))
+	{
+		return EXIT_FAILURE;
+	}
+
+	long length = read_file((argc - optind == 2) ? argv[optind + 1] : NULL, input, sizeof(input));
+	if (length < 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	uint8_t *message = input;
+	if ((length >= COMPRESS_MARKER_SIZE) && (! memcmp(input, COMPRESS_MARKER, COMPRESS_MARKER_SIZE - 1)))
+	{
+		if (input[COMPRESS_MARKER_SIZE - 1] != COMPRESS_ZLIB)
+		{
+			fprintf(stderr, "Compression '%c' is not supported, strip %d bytes and use its tool\n",
+					input[COMPRESS_MARKER_SIZE - 1], COMPRESS_MARKER_SIZE);
+			return EXIT_FAILURE;
+		}
+		length = inflate_payload(input + COMPRESS_MARKER_SIZE, length - COMPRESS_MARKER_SIZE,
+				inflated, sizeof(inflated), dict_name ? dict : NULL, dict_length);
+		if (length < 0)
+		{
+			return EXIT_FAILURE;
+		}
+		message = inflated;
+	}
+
+	if (! strcasecmp(format, "text"))
+	{
+		fwrite(message, 1, length, stdout);
+		putchar('\n');
+		return EXIT_SUCCESS;
+	}
+
+	reader_t reader = { message, message + length, ! strcasecmp(format, "cbor") };
+	if ((! decode_item(&reader, 0)) || (reader.pos != reader.end))
+	{
+		fprintf(stderr, "\nMalformed message at byte %zu\n", (size_t)(reader.pos - message));
+		return EXIT_FAILURE;
+	}
+	putchar('\n');
+
+	return EXIT_SUCCESS;
+}
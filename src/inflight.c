@@ -0,0 +1,122 @@
+/*******************************************/ /**
+ * @file inflight.c
+ * @author marsman7 (you@domain.com)
+ * @brief Table of published messages that are not yet
+ *        acknowledged, keyed by the MQTT message id.
+ *
+ * A message id is a 16 bit value, so the table is a bitmap
+ * of all possible ids with constant time access and no
+ * allocation.
+ *
+ * Without a loop thread libmosquitto writes a QoS 0 message
+ * at once and calls the publish callback before the publish
+ * returns the id. A publish is enclosed in inflight_begin()
+ * and inflight_add() or inflight_cancel(), a id that is done
+ * in between is not added.
+ *
+ * @headerfile inflight.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "inflight.h"
+
+#define INFLIGHT_IDS 65536
+
+static uint64_t pending[INFLIGHT_IDS / 64];
+static int pending_count = 0;
+static bool publishing = false;		/*!< between inflight_begin() and its end */
+static int done_mid = -1;		/*!< id that was done while publishing */
+
+/*******************************************/ /**
+ * @brief Start a publish, call it before mosquitto_publish()
+ ***********************************************/
+void inflight_begin()
+{
+	publishing = true;
+	done_mid = -1;
+}
+
+/*******************************************/ /**
+ * @brief Add a published message, it ends the publish of
+ *        inflight_begin()
+ *
+ * @param mid - Message id returned by mosquitto_publish()
+ ***********************************************/
+void inflight_add(int mid)
+{
+	uint16_t id = mid;
+	uint64_t bit = (uint64_t)1 << (id & 63);
+	bool done = publishing && (done_mid == id);
+
+	publishing = false;
+	done_mid = -1;
+	if ((! done) && (! (pending[id >> 6] & bit)))
+	{
+		pending[id >> 6] |= bit;
+		pending_count++;
+	}
+}
+
+/*******************************************/ /**
+ * @brief End the publish of inflight_begin() that failed
+ ***********************************************/
+void inflight_cancel()
+{
+	publishing = false;
+	done_mid = -1;
+}
+
+/*******************************************/ /**
+ * @brief Remove a acknowledged message
+ *
+ * @param mid - Message id of the publish callback
+ * @return bool - TRUE if the message was in the table
+ ***********************************************/
+bool inflight_remove(int mid)
+{
+	uint16_t id = mid;
+	uint64_t bit = (uint64_t)1 << (id & 63);
+	if (pending[id >> 6] & bit)
+	{
+		pending[id >> 6] &= ~bit;
+		pending_count--;
+		return true;
+	}
+	if (publishing)
+	{
+		done_mid = id;
+	}
+	return false;
+}
+
+/*******************************************/ /**
+ * @brief Check if a message is not yet acknowledged
+ *
+ * @param mid - Message id
+ * @return bool - TRUE if the message is pending
+ ***********************************************/
+bool inflight_contains(int mid)
+{
+	uint16_t id = mid;
+	return pending[id >> 6] & ((uint64_t)1 << (id & 63));
+}
+
+/*******************************************/ /**
+ * @brief Count of not acknowledged messages
+ ***********************************************/
+int inflight_count()
+{
+	return pending_count;
+}
+
+/*******************************************/ /**
+ * @brief Forget all messages
+ ***********************************************/
+void inflight_clear()
+{
+	memset(pending, 0, sizeof(pending));
+	pending_count = 0;
+}
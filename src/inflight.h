@@ -0,0 +1,22 @@
+/*******************************************/ /**
+ * @file inflight.h
+ * @author marsman7 (you@domain.com)
+ * @brief Table of published messages that are not yet
+ *        acknowledged, keyed by the MQTT message id.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#include <stdbool.h>
+
+void inflight_begin();
+void inflight_add(int);
+void inflight_cancel();
+bool inflight_remove(int);
+bool inflight_contains(int);
+int inflight_count();
+void inflight_clear();
+
+#endif
@@ -0,0 +1,508 @@
+/*******************************************/ /**
+ * @file metrics.c
+ * @author marsman7 (you@domain.com)
+ * @brief Snapshot of all metrics sampled once per tick
+ *        and shared by all templates.
+ *
+ * Each collector runs at most once per sample and only if
+ * a template to render references one of its values.
+ *
+ * The collectors run on the pool of collector.h. The caller
+ * starts them ahead of a sample with metrics_start(), a finished
+ * run is signalled on metrics_fd(). Each collector has a slot with
+ * the latest values it delivered and the start time of the run
+ * that delivered them. metrics_sample() does not wait : a slot
+ * without a run since the given time is marked stale and keeps
+ * the values of the run before. A collector is not started again
+ * until the pending run is done, so a hung collector occupies one
+ * worker at most. metrics_free() does not wait for it either, the
+ * caller keeps the module of a collector in metrics_pending() 
+ * until it is done.
+ *
+ * The window tags sample more often than the messages are
+ * published. A collector that reports the change since its last
+ * run keeps it per sampler of enum metrics_baseline_t, so the
+ * samples of the windows do not shorten the deltas of the
+ * published snapshot.
+ *
+ * @headerfile metrics.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+#include <errno.h>
+#include <sys/sysinfo.h>
+#include <sys/statvfs.h>
+
+#include "metrics.h"
+#include "collector.h"
+#include "service.h"
+#include "procfs.h"
+#include "mounts.h"
+#include "cgroup.h"
+#include "psi.h"
+
+/*******************************************/ /**
+ * @brief Latest values of a collector
+ ***********************************************/
+typedef struct metric_slot_t
+{
+	const char *name;
+	int (*update)(metrics_t *);	/*!< runs on a worker, sets the fields of the collector */
+	bool shared;			/*!< values are read from the module, not from the slot */
+	bool deltas;			/*!< a run updates the values of its sampler only */
+	collector_t job;
+	metrics_t result;		/*!< written by the worker */
+	uint64_t started;		/*!< CLOCK_MONOTONIC of the pending run */
+	uint64_t sampled[METRICS_BASELINES];	/*!< start of the last finished run per sampler, ZERO if none */
+	int error;			/*!< errno of the last finished run, ZERO if it succeeded */
+} metric_slot_t;
+
+static int collect_sysinfo(metrics_t *);
+static int collect_statvfs(metrics_t *);
+static int collect_services(metrics_t *);
+static int collect_procfs(metrics_t *);
+static int collect_cpustat(metrics_t *);
+static int collect_mounts(metrics_t *);
+static int collect_cgroup(metrics_t *);
+static int collect_psi(metrics_t *);
+
+// in the order of the bits of enum metric_collector_t
+static metric_slot_t slots[METRICS_COLLECTORS] = {
+	{ "sysinfo", collect_sysinfo, false, false },
+	{ "statvfs", collect_statvfs, false, false },
+	{ "services", collect_services, false, false },	// service.c publishes complete sets only
+	{ "procfs", collect_procfs, true, false },
+	{ "cpustat", collect_cpustat, true, true },
+	{ "mounts", collect_mounts, true, false },
+	{ "cgroup", collect_cgroup, true, false },
+	{ "psi", collect_psi, true, false }
+};
+
+static metrics_t latest = {0};		/*!< values of the last successful runs */
+static const cpustat_summary_t *latest_cpu[METRICS_BASELINES] = { NULL };
+static int timeout_ms = 0;
+
+//-----------------------------------------------
+
+static uint64_t now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int collect_sysinfo(metrics_t *metrics)
+{
+	struct sysinfo info;
+	if (sysinfo(&info))
+	{
+		return -1;
+	}
+	metrics->uptime = info.uptime;
+	metrics->loadavg_1 = info.loads[0];
+	metrics->ramfree = info.totalram ? info.freeram * 100 / info.totalram : 0;
+	return 0;
+}
+
+static int collect_statvfs(metrics_t *metrics)
+{
+	struct statvfs fsinfo;
+	if (statvfs("/", &fsinfo))
+	{
+		return -1;
+	}
+	metrics->diskfree_mb = (fsinfo.f_bsize * fsinfo.f_bfree) >> 20;
+	return 0;
+}
+
+static int collect_services(metrics_t *metrics)
+{
+	(void)metrics;
+	return service_update();
+}
+
+static int collect_procfs(metrics_t *metrics)
+{
+	(void)metrics;
+	return procfs_update();
+}
+
+static int collect_cpustat(metrics_t *metrics)
+{
+	if (cpustat_update(metrics->baseline))
+	{
+		return -1;
+	}
+	metrics->cpu = cpustat_summary(metrics->baseline);
+	return 0;
+}
+
+static int collect_mounts(metrics_t *metrics)
+{
+	(void)metrics;
+	return mounts_update();
+}
+
+static int collect_cgroup(metrics_t *metrics)
+{
+	(void)metrics;
+	return cgroup_update();
+}
+
+static int collect_psi(metrics_t *metrics)
+{
+	(void)metrics;
+	return psi_update();
+}
+
+/*******************************************/ /**
+ * @brief Job of the pool, runs the collector of a slot
+ ***********************************************/
+static int run_slot(void *arg)
+{
+	metric_slot_t *slot = arg;
+	return slot->update(&slot->result);
+}
+
+/*******************************************/ /**
+ * @brief Take the values of a finished run into the latest values
+ *
+ * @param collector - The collector, one of enum metric_collector_t
+ * @param result - Values of the run
+ ***********************************************/
+static void commit(uint32_t collector, const metrics_t *result)
+{
+	switch (collector)
+	{
+	case COLLECT_SYSINFO:
+		latest.uptime = result->uptime;
+		latest.loadavg_1 = result->loadavg_1;
+		latest.ramfree = result->ramfree;
+		break;
+	case COLLECT_STATVFS:
+		latest.diskfree_mb = result->diskfree_mb;
+		break;
+	case COLLECT_CPUSTAT:
+		latest_cpu[result->baseline] = result->cpu;
+		break;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Take back a finished run of a collector
+ *
+ * @param index - Index of the slot
+ * @return int - Result of the run, on -1 errno is set
+ ***********************************************/
+static int reap(int index)
+{
+	metric_slot_t *slot = &slots[index];
+	int result = collector_reap(&slot->job);
+	slot->error = result ? errno : 0;
+	if (! result)
+	{
+		commit(1 << index, &slot->result);
+	}
+	for (int b = 0; b < METRICS_BASELINES; b++)
+	{
+		if ((! slot->deltas) || (b == (int)slot->result.baseline))
+		{
+			slot->sampled[b] = slot->started;
+		}
+	}
+	return result;
+}
+
+/*******************************************/ /**
+ * @brief Take back the finished runs of all collectors
+ ***********************************************/
+static void reap_done()
+{
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if (collector_state(&slots[i].job) == COLLECTOR_DONE)
+		{
+			reap(i);
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Check if a collector delivered a run since a time that
+ *        can be read now
+ ***********************************************/
+static bool fresh(int index, enum metrics_baseline_t baseline, uint64_t since)
+{
+	metric_slot_t *slot = &slots[index];
+	if (slot->shared && (collector_state(&slot->job) == COLLECTOR_RUNNING))
+	{
+		return false;
+	}
+	return slot->sampled[baseline] && (slot->sampled[baseline] >= since);
+}
+
+/*******************************************/ /**
+ * @brief Start the workers of the collectors
+ *
+ * @param threads - Count of worker threads, ZERO runs the
+ *                  collectors on the calling thread
+ * @param timeout - Max. milliseconds of metrics_wait()
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int metrics_init(int threads, int timeout)
+{
+	metrics_free();
+
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		// a pending run of the pool before keeps its job
+		if (collector_state(&slots[i].job) == COLLECTOR_IDLE)
+		{
+			slots[i].job.run = run_slot;
+			slots[i].job.arg = &slots[i];
+		}
+	}
+	timeout_ms = timeout;
+
+	return collector_pool_init(threads);
+}
+
+/*******************************************/ /**
+ * @brief Get the fd that gets readable if a collector is done,
+ *        the caller calls metrics_reap() then
+ *
+ * @return int - The fd, -1 before metrics_init()
+ ***********************************************/
+int metrics_fd()
+{
+	return collector_pool_fd();
+}
+
+/*******************************************/ /**
+ * @brief Start the requested collectors without a run since a
+ *        time. A collector with a pending run is not started 
+ *        again, so the caller repeats it if a run is done.
+ *
+ * @param collectors - Set of enum metric_collector_t to run
+ * @param baseline - Sampler, the deltas of a collector are 
+ *                   from the last run of the same sampler
+ * @param since - CLOCK_MONOTONIC in nanoseconds
+ ***********************************************/
+void metrics_start(uint32_t collectors, enum metrics_baseline_t baseline, uint64_t since)
+{
+	reap_done();
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if ( (collectors & (1 << i)) && (collector_state(&slots[i].job) == COLLECTOR_IDLE) && 
+				(! fresh(i, baseline, since)) )
+		{
+			slots[i].result.baseline = baseline;
+			slots[i].started = now_ns();
+			collector_start(&slots[i].job);
+			if (collector_state(&slots[i].job) == COLLECTOR_DONE)
+			{
+				// without threads the run is done already
+				reap(i);
+			}
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Take back the finished runs, to call if metrics_fd() 
+ *        is readable
+ ***********************************************/
+void metrics_reap()
+{
+	collector_pool_ack();
+	reap_done();
+}
+
+/*******************************************/ /**
+ * @brief Check if all requested collectors delivered a run 
+ *        that started at or after a time
+ *
+ * @param collectors - Set of enum metric_collector_t
+ * @param baseline - Sampler of the runs
+ * @param since - CLOCK_MONOTONIC in nanoseconds
+ * @return bool - TRUE if metrics_sample() would find no stale one
+ ***********************************************/
+bool metrics_ready(uint32_t collectors, enum metrics_baseline_t baseline, uint64_t since)
+{
+	reap_done();
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if ((collectors & (1 << i)) && (! fresh(i, baseline, since)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Wait until the pending runs of the requested collectors
+ *        are done, at most the timeout of metrics_init(). Only
+ *        for the start and the exit, the main loop watches 
+ *        metrics_fd() instead.
+ *
+ * @param collectors - Set of enum metric_collector_t
+ ***********************************************/
+void metrics_wait(uint32_t collectors)
+{
+	uint64_t deadline_ns = now_ns() + timeout_ms * 1000000ULL;
+	struct timespec deadline = { deadline_ns / 1000000000, deadline_ns % 1000000000 };
+
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if (collectors & (1 << i))
+		{
+			collector_wait(&slots[i].job, &deadline);
+		}
+	}
+	reap_done();
+}
+
+/*******************************************/ /**
+ * @brief Take a snapshot of the requested collectors without 
+ *        waiting. A collector without a finished run since 
+ *        'since' is marked stale and keeps the values before.
+ *
+ * @param metrics - Snapshot to fill
+ * @param collectors - Set of enum metric_collector_t to read
+ * @param baseline - Sampler, the deltas of a collector are 
+ *                   from the run before of the same sampler
+ * @param since - CLOCK_MONOTONIC in nanoseconds, the max. age of 
+ *                the runs, usually the time of metrics_start()
+ * @return uint32_t - Set of failed collectors, ZERO on success.
+ *                    errno is set by the last failed collector.
+ ***********************************************/
+uint32_t metrics_sample(metrics_t *metrics, uint32_t collectors, enum metrics_baseline_t baseline, uint64_t since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	uint32_t collected = 0;
+	uint32_t failed = 0;
+	uint32_t stale = 0;
+	int error = 0;
+
+	reap_done();
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if (! (collectors & (1 << i)))
+		{
+			continue;
+		}
+		if (! fresh(i, baseline, since))
+		{
+			stale |= 1 << i;
+		}
+		else if (slots[i].error)
+		{
+			failed |= 1 << i;
+			error = slots[i].error;
+		}
+		else
+		{
+			collected |= 1 << i;
+		}
+	}
+
+	*metrics = latest;
+	metrics->time = now;
+	metrics->cpu = latest_cpu[baseline];
+	metrics->baseline = baseline;
+	metrics->collected = collected;
+	metrics->failed = failed;
+	metrics->stale = stale;
+
+	size_t length = 0;
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		size_t name_length = strlen(slots[i].name);
+		if ((stale & (1 << i)) && (length + name_length + 2 <= sizeof(metrics->stale_names)))
+		{
+			if (length)
+			{
+				metrics->stale_names[length++] = ',';
+			}
+			memcpy(metrics->stale_names + length, slots[i].name, name_length);
+			length += name_length;
+		}
+	}
+	metrics->stale_names[length] = '\0';
+
+	if (failed)
+	{
+		errno = error;
+	}
+	return failed;
+}
+
+/*******************************************/ /**
+ * @brief Check if the values of a collector can be read. A
+ *        stale collector that keeps its values in the module
+ *        writes them while its run is pending, otherwise the
+ *        values of the run before are read.
+ *
+ * @param metrics - The snapshot
+ * @param collector - One of enum metric_collector_t
+ * @return bool - TRUE if the values can be read
+ ***********************************************/
+bool metrics_readable(const metrics_t *metrics, uint32_t collector)
+{
+	if (! (metrics->stale & collector))
+	{
+		return true;
+	}
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if (collector == (1u << i))
+		{
+			return (! slots[i].shared) || (collector_state(&slots[i].job) != COLLECTOR_RUNNING);
+		}
+	}
+	return false;
+}
+
+/*******************************************/ /**
+ * @brief Get the collectors with a run that is not done yet.
+ *        Their modules are in use by a worker and must not be
+ *        freed or changed.
+ *
+ * @return uint32_t - Set of enum metric_collector_t
+ ***********************************************/
+uint32_t metrics_pending()
+{
+	uint32_t pending = 0;
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if (collector_state(&slots[i].job) == COLLECTOR_RUNNING)
+		{
+			pending |= 1 << i;
+		}
+	}
+	return pending;
+}
+
+/*******************************************/ /**
+ * @brief Stop the workers without waiting for the pending 
+ *        runs, they are taken back by metrics_reap() once 
+ *        they are done. See metrics_pending().
+ ***********************************************/
+void metrics_free()
+{
+	for (int i = 0; i < METRICS_COLLECTORS; i++)
+	{
+		if (collector_state(&slots[i].job) == COLLECTOR_DONE)
+		{
+			collector_reap(&slots[i].job);
+		}
+		memset(slots[i].sampled, 0, sizeof(slots[i].sampled));
+	}
+	collector_pool_free();
+	memset(&latest, 0, sizeof(latest));
+	memset(latest_cpu, 0, sizeof(latest_cpu));
+}
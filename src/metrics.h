@@ -0,0 +1,101 @@
+/*******************************************/ /**
+ * @file metrics.h
+ * @author marsman7 (you@domain.com)
+ * @brief Snapshot of all metrics sampled once per tick
+ *        and shared by all templates.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "cpustat.h"
+
+/*******************************************/ /**
+ * @brief Collectors, a template references a set of them
+ ***********************************************/
+enum metric_collector_t
+{
+	COLLECT_SYSINFO = 1 << 0,	/*!< sysinfo() : load, uptime, RAM */
+	COLLECT_STATVFS = 1 << 1,	/*!< statvfs("/") : free disk space */
+	COLLECT_SERVICES = 1 << 2,	/*!< service states, see service.h */
+	COLLECT_PROCFS = 1 << 3,	/*!< /proc files, see procfs.h */
+	COLLECT_CPUSTAT = 1 << 4,	/*!< per core utilisation, see cpustat.h */
+	COLLECT_MOUNTS = 1 << 5,	/*!< space of the mounts, see mounts.h */
+	COLLECT_CGROUP = 1 << 6,	/*!< resources of the services, see cgroup.h */
+	COLLECT_PSI = 1 << 7		/*!< pressure stall information, see psi.h */
+};
+
+#define METRICS_COLLECTORS 8		/*!< count of enum metric_collector_t */
+
+/*******************************************/ /**
+ * @brief Samplers with own deltas, a collector that measures
+ *        the change since its last run keeps one per sampler
+ ***********************************************/
+enum metrics_baseline_t
+{
+	METRICS_PUBLISH = 0,		/*!< the snapshot of the published messages */
+	METRICS_WINDOW = 1		/*!< the samples of the window tags */
+};
+#define METRICS_BASELINES 2		/*!< count of enum metrics_baseline_t */
+#define METRICS_NAMES_SIZE 64		/*!< max. length of a list of collector names */
+
+/*******************************************/ /**
+ * @brief Types of a tag value
+ ***********************************************/
+enum metric_type_t
+{
+	VALUE_NONE = 0,		/*!< not available, rendered empty */
+	VALUE_INT,
+	VALUE_DOUBLE,
+	VALUE_TEXT
+};
+
+/*******************************************/ /**
+ * @brief Typed value of a tag in the snapshot
+ ***********************************************/
+typedef struct metric_value_t
+{
+	enum metric_type_t type;
+	union
+	{
+		long long i;
+		double d;
+		const char *text;
+	};
+} metric_value_t;
+
+/*******************************************/ /**
+ * @brief Values of one sample
+ ***********************************************/
+typedef struct metrics_t
+{
+	struct timespec time;		/*!< CLOCK_MONOTONIC of the sample */
+	uint32_t collected;		/*!< collectors that delivered a value */
+	uint32_t failed;		/*!< collectors that failed */
+	uint32_t stale;			/*!< collectors that did not finish in time */
+	char stale_names[METRICS_NAMES_SIZE];	/*!< names of the stale collectors, comma separated */
+	enum metrics_baseline_t baseline;	/*!< sampler of the snapshot */
+	long uptime;			/*!< seconds since boot */
+	unsigned long loadavg_1;	/*!< load average 1 min. as fixed point 1 << 16 */
+	long ramfree;			/*!< free RAM in percent */
+	long diskfree_mb;		/*!< free disk space of "/" in MiB */
+	const cpustat_summary_t *cpu;	/*!< NULL until two samples are taken */
+} metrics_t;
+
+int metrics_init(int, int);
+int metrics_fd();
+void metrics_start(uint32_t, enum metrics_baseline_t, uint64_t);
+void metrics_reap();
+bool metrics_ready(uint32_t, enum metrics_baseline_t, uint64_t);
+void metrics_wait(uint32_t);
+uint32_t metrics_sample(metrics_t *, uint32_t, enum metrics_baseline_t, uint64_t);
+bool metrics_readable(const metrics_t *, uint32_t);
+uint32_t metrics_pending();
+void metrics_free();
+
+#endif
@@ -0,0 +1,719 @@
+/*******************************************/ /**
+ * @file mounts.c
+ * @author marsman7 (you@domain.com)
+ * @brief Free space of the mounted file systems, from a
+ *        mount table that is only read again on a change.
+ *
+ * /proc/self/mountinfo is kept open. The kernel reports a
+ * change of the mounts as POLLPRI on it, only then the table
+ * is built again. The table has the mounts that match the
+ * filters of file system types and path globs, plus the paths
+ * of the %mount_...(<path>)% tags.
+ *
+ * statvfs() of a hung network file system blocks until the
+ * server is back, so each statvfs() runs in its own detached
+ * thread and the update waits for all of them with a common
+ * timeout. A mount that did not answer in time is marked stale
+ * and keeps its last values. No new statvfs() is started for it
+ * until the pending one returns, so hung threads don't pile up.
+ *
+ * @headerfile mounts.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/statvfs.h>
+
+#include "mounts.h"
+
+#define MOUNTINFO "/proc/self/mountinfo"
+#define MOUNTINFO_BUFFER_SIZE 16384	/*!< first size of the read buffer, doubled if too small */
+#define PROBE_STACK_SIZE 65536
+
+/*******************************************/ /**
+ * @brief A statvfs() call, shared by the update and its
+ *        thread, the last one gives it free
+ ***********************************************/
+typedef struct probe_t
+{
+	atomic_int refs;
+	bool done;		/*!< guarded by 'lock' */
+	int error;
+	struct statvfs info;
+	char path[];
+} probe_t;
+
+/*******************************************/ /**
+ * @brief A mount of the table
+ ***********************************************/
+typedef struct mount_entry_t
+{
+	char *path;
+	bool listed;		/*!< matches the filters, part of the summary */
+	probe_t *probe;		/*!< pending statvfs(), NULL if none */
+	mount_stat_t stat;
+} mount_entry_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_done;
+static bool cond_ready = false;
+
+static int fd = -1;
+static char *buffer = NULL;
+static size_t buffer_size = 0;
+static bool table_valid = false;
+
+static char *fstypes = NULL;	/*!< comma separated, empty for all */
+static char *paths = NULL;	/*!< comma separated globs, empty for all */
+static int timeout_ms = 0;
+
+static mount_entry_t *entries = NULL;
+static int entry_count = 0;
+static char **registered = NULL;	/*!< paths of the tags */
+static int *registered_entry = NULL;	/*!< index of the entry of a registered path, -1 if not mounted */
+static int registered_count = 0;
+
+static char summary[MOUNTS_SUMMARY_SIZE] = "[]";
+static uint64_t avail_mb = 0;
+static int stale_count = 0;
+
+/*******************************************/ /**
+ * @brief Release a reference to a probe
+ ***********************************************/
+static void probe_release(probe_t *probe)
+{
+	if (atomic_fetch_sub(&probe->refs, 1) == 1)
+	{
+		free(probe);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Thread of a statvfs() call
+ ***********************************************/
+static void *probe_thread(void *arg)
+{
+	probe_t *probe = arg;
+	struct statvfs info;
+	int error = statvfs(probe->path, &info) ? errno : 0;
+
+	pthread_mutex_lock(&lock);
+	probe->info = info;
+	probe->error = error;
+	probe->done = true;
+	pthread_cond_broadcast(&probe_done);
+	pthread_mutex_unlock(&lock);
+
+	probe_release(probe);
+	return NULL;
+}
+
+/*******************************************/ /**
+ * @brief Start a statvfs() in a thread
+ *
+ * @return probe_t* - The probe, NULL on error
+ ***********************************************/
+static probe_t *probe_start(const char *path)
+{
+	size_t length = strlen(path);
+	probe_t *probe = calloc(1, sizeof(probe_t) + length + 1);
+	if (! probe)
+	{
+		return NULL;
+	}
+	memcpy(probe->path, path, length + 1);
+	atomic_init(&probe->refs, 2);
+
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, PROBE_STACK_SIZE);
+	int error = pthread_create(&thread, &attr, probe_thread, probe);
+	pthread_attr_destroy(&attr);
+	if (error)
+	{
+		free(probe);
+		errno = error;
+		return NULL;
+	}
+	return probe;
+}
+
+/*******************************************/ /**
+ * @brief Check if a text matches a comma separated list
+ *
+ * @param list - The list, empty matches all
+ * @param text - The text
+ * @param glob - Entries of the list are globs
+ * @return bool - TRUE if it matches
+ ***********************************************/
+static bool match_list(const char *list, const char *text, bool glob)
+{
+	if (! *list)
+	{
+		return true;
+	}
+
+	char pattern[256];
+	while (*list)
+	{
+		size_t length = strcspn(list, ",");
+		if (length < sizeof(pattern))
+		{
+			memcpy(pattern, list, length);
+			pattern[length] = '\0';
+			if (glob ? (fnmatch(pattern, text, 0) == 0) : (strcmp(pattern, text) == 0))
+			{
+				return true;
+			}
+		}
+		list += length;
+		list += (*list == ',');
+	}
+	return false;
+}
+
+/*******************************************/ /**
+ * @brief Copy a field of mountinfo and decode the octal
+ *        escapes like "\040" of a space
+ *
+ * @param dst - Destination, the length of the field + 1 at least
+ * @param src - The field
+ * @param length - Length of the field
+ ***********************************************/
+static void unescape(char *dst, const char *src, size_t length)
+{
+	const char *end = src + length;
+	while (src < end)
+	{
+		if ((*src == '\\') && (end - src >= 4))
+		{
+			*dst++ = ((src[1] - '0') << 6) | ((src[2] - '0') << 3) | (src[3] - '0');
+			src += 4;
+		}
+		else
+		{
+			*dst++ = *src++;
+		}
+	}
+	*dst = '\0';
+}
+
+/*******************************************/ /**
+ * @brief Read mountinfo into the buffer, the buffer grows
+ *        if the file does not fit
+ *
+ * @return ssize_t - Length of the content, -1 on error
+ ***********************************************/
+static ssize_t read_mountinfo()
+{
+	for (;;)
+	{
+		if (! buffer)
+		{
+			size_t size = buffer_size ? buffer_size * 2 : MOUNTINFO_BUFFER_SIZE;
+			if (! (buffer = malloc(size)))
+			{
+				errno = ENOMEM;
+				return -1;
+			}
+			buffer_size = size;
+		}
+
+		ssize_t length = pread(fd, buffer, buffer_size, 0);
+		if ((length < 0) || ((size_t)length < buffer_size))
+		{
+			return length;
+		}
+
+		free(buffer);
+		buffer = NULL;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Find a entry of the table by its path
+ *
+ * @return int - Index of the entry, -1 if not found
+ ***********************************************/
+static int find_entry(const mount_entry_t *table, int count, const char *path)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (! strcmp(table[i].path, path))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Add a mount to the new table, the state of a
+ *        mount in the old table is taken over
+ *
+ * @return int - ZERO at successfully, otherwise -1
+ ***********************************************/
+static int add_entry(mount_entry_t **table, int *count, const char *path, bool listed)
+{
+	int index = find_entry(*table, *count, path);
+	if (index >= 0)
+	{
+		// mounted over, the last mount is the visible one
+		(*table)[index].listed |= listed;
+		return 0;
+	}
+
+	mount_entry_t *new_table = realloc(*table, (*count + 1) * sizeof(mount_entry_t));
+	if (! new_table)
+	{
+		return -1;
+	}
+	*table = new_table;
+
+	mount_entry_t *entry = &new_table[*count];
+	memset(entry, 0, sizeof(*entry));
+	if (! (entry->path = strdup(path)))
+	{
+		return -1;
+	}
+	entry->listed = listed;
+
+	int old = find_entry(entries, entry_count, path);
+	if (old >= 0)
+	{
+		entry->probe = entries[old].probe;
+		entry->stat = entries[old].stat;
+		entries[old].probe = NULL;
+	}
+	(*count)++;
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Give free a table
+ ***********************************************/
+static void free_table(mount_entry_t *table, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		free(table[i].path);
+		if (table[i].probe)
+		{
+			probe_release(table[i].probe);
+		}
+	}
+	free(table);
+}
+
+/*******************************************/ /**
+ * @brief Build the table from mountinfo
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+static int build_table()
+{
+	ssize_t length = read_mountinfo();
+	if (length < 0)
+	{
+		return -1;
+	}
+
+	mount_entry_t *table = NULL;
+	int count = 0;
+	char *path = malloc(length + 1);
+	char *fstype = malloc(length + 1);
+	if ((! path) || (! fstype))
+	{
+		goto fail;
+	}
+
+	const char *p = buffer;
+	const char *end = buffer + length;
+	while (p < end)
+	{
+		const char *line_end = memchr(p, '\n', end - p);
+		if (! line_end)
+		{
+			line_end = end;
+		}
+
+		// <id> <parent> <major:minor> <root> <mount point> <options> [<optional>...] - <fstype> <source> ...
+		const char *field[5];
+		size_t field_length[5];
+		int fields = 0;
+		bool after_separator = false;
+		const char *q = p;
+		int column = 0;
+		while ((q < line_end) && (fields < 5))
+		{
+			while ((q < line_end) && (*q == ' '))
+			{
+				q++;
+			}
+			const char *start = q;
+			while ((q < line_end) && (*q != ' '))
+			{
+				q++;
+			}
+			if (after_separator || (column == 4))
+			{
+				field[fields] = start;
+				field_length[fields++] = q - start;
+				if (after_separator)
+				{
+					break;	// the fstype is the first field after the separator
+				}
+			}
+			if ((q - start == 1) && (*start == '-'))
+			{
+				after_separator = true;
+			}
+			column++;
+		}
+
+		if (fields == 2)
+		{
+			unescape(path, field[0], field_length[0]);
+			unescape(fstype, field[1], field_length[1]);
+			bool listed = match_list(fstypes, fstype, false) && match_list(paths, path, true);
+			bool wanted = listed;
+			for (int i = 0; (i < registered_count) && (! wanted); i++)
+			{
+				wanted = ! strcmp(registered[i], path);
+			}
+			if (wanted && add_entry(&table, &count, path, listed))
+			{
+				goto fail;
+			}
+		}
+		p = line_end + 1;
+	}
+	free(path);
+	free(fstype);
+
+	free_table(entries, entry_count);
+	entries = table;
+	entry_count = count;
+	for (int i = 0; i < registered_count; i++)
+	{
+		registered_entry[i] = find_entry(entries, entry_count, registered[i]);
+	}
+	table_valid = true;
+	return 0;
+
+fail:
+	free(path);
+	free(fstype);
+	free_table(table, count);
+	errno = ENOMEM;
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Set the filters and open mountinfo
+ *
+ * @param fstype_list - Comma separated file system types, "" for all
+ * @param path_list - Comma separated path globs, "" for all
+ * @param timeout - Max. milliseconds to wait for statvfs()
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int mounts_init(const char *fstype_list, const char *path_list, int timeout)
+{
+	mounts_free();
+
+	if (! cond_ready)
+	{
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&probe_done, &attr);
+		pthread_condattr_destroy(&attr);
+		cond_ready = true;
+	}
+
+	fstypes = strdup(fstype_list ? fstype_list : "");
+	paths = strdup(path_list ? path_list : "");
+	if ((! fstypes) || (! paths))
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	timeout_ms = timeout;
+
+	if ((fd = open(MOUNTINFO, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Register the path of a tag, it is added to the
+ *        table also if it does not match the filters
+ *
+ * @param path - The mount point, not terminated
+ * @param length - Length of the path
+ * @return int - Index for mounts_get(), -1 on error
+ ***********************************************/
+int mounts_register(const char *path, size_t length)
+{
+	for (int i = 0; i < registered_count; i++)
+	{
+		if ((strlen(registered[i]) == length) && (! strncmp(registered[i], path, length)))
+		{
+			return i;
+		}
+	}
+
+	char **new_registered = realloc(registered, (registered_count + 1) * sizeof(char *));
+	if (new_registered)
+	{
+		registered = new_registered;
+	}
+	int *new_entry = realloc(registered_entry, (registered_count + 1) * sizeof(int));
+	if (new_entry)
+	{
+		registered_entry = new_entry;
+	}
+	if ((! new_registered) || (! new_entry) || (! (registered[registered_count] = strndup(path, length))))
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	registered_entry[registered_count] = -1;
+	table_valid = false;
+	return registered_count++;
+}
+
+/*******************************************/ /**
+ * @brief Build the summary of the listed mounts
+ ***********************************************/
+static void summarize()
+{
+	size_t length = 1;
+	summary[0] = '[';
+	avail_mb = 0;
+	stale_count = 0;
+
+	for (int i = 0; i < entry_count; i++)
+	{
+		const mount_entry_t *entry = &entries[i];
+		if (! entry->listed)
+		{
+			continue;
+		}
+		stale_count += entry->stat.stale;
+		if (! entry->stat.valid)
+		{
+			continue;
+		}
+		avail_mb += entry->stat.avail_mb;
+
+		// escape the path for JSON
+		char path[256];
+		size_t path_length = 0;
+		for (const char *c = entry->path; *c && (path_length < sizeof(path) - 2); c++)
+		{
+			if ((*c == '"') || (*c == '\\'))
+			{
+				path[path_length++] = '\\';
+			}
+			path[path_length++] = ((unsigned char)*c < 0x20) ? '?' : *c;
+		}
+		path[path_length] = '\0';
+
+		int result = snprintf(summary + length, sizeof(summary) - length,
+				"%s{\"path\":\"%s\",\"avail_mb\":%llu,\"used_pct\":%.1f%s}",
+				(length > 1) ? "," : "", path, (unsigned long long)entry->stat.avail_mb,
+				entry->stat.used_pct, entry->stat.stale ? ",\"stale\":true" : "");
+		if ((result < 0) || ((size_t)result >= sizeof(summary) - length - 1))
+		{
+			break;	// keep the entries that fit
+		}
+		length += result;
+	}
+
+	summary[length++] = ']';
+	summary[length] = '\0';
+}
+
+/*******************************************/ /**
+ * @brief Build the table again if the mounts are changed and
+ *        query the space of all mounts of the table
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int mounts_update()
+{
+	if (fd < 0)
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+	if ( (poll(&pfd, 1, 0) > 0) && (pfd.revents & (POLLPRI | POLLERR)) )
+	{
+		table_valid = false;
+	}
+	if ((! table_valid) && build_table())
+	{
+		return -1;
+	}
+
+	for (int i = 0; i < entry_count; i++)
+	{
+		if (! entries[i].probe)
+		{
+			entries[i].probe = probe_start(entries[i].path);
+		}
+	}
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&lock);
+	for (;;)
+	{
+		bool pending = false;
+		for (int i = 0; (i < entry_count) && (! pending); i++)
+		{
+			pending = entries[i].probe && (! entries[i].probe->done);
+		}
+		if ((! pending) || (pthread_cond_timedwait(&probe_done, &lock, &deadline) == ETIMEDOUT))
+		{
+			break;
+		}
+	}
+
+	for (int i = 0; i < entry_count; i++)
+	{
+		mount_entry_t *entry = &entries[i];
+		if (! entry->probe)
+		{
+			continue;
+		}
+		if (! entry->probe->done)
+		{
+			entry->stat.stale = true;
+			continue;
+		}
+
+		const struct statvfs *info = &entry->probe->info;
+		entry->stat.stale = false;
+		entry->stat.valid = ! entry->probe->error;
+		if (entry->stat.valid)
+		{
+			uint64_t block = info->f_frsize ? info->f_frsize : info->f_bsize;
+			entry->stat.total_mb = (info->f_blocks * block) >> 20;
+			entry->stat.free_mb = (info->f_bfree * block) >> 20;
+			entry->stat.avail_mb = (info->f_bavail * block) >> 20;
+			// used of the space available to users, like df
+			uint64_t used = info->f_blocks - info->f_bfree;
+			uint64_t usable = used + info->f_bavail;
+			entry->stat.used_pct = usable ? used * 100.0 / usable : 0;
+		}
+		probe_release(entry->probe);
+		entry->probe = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+
+	summarize();
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the space of a registered path
+ *
+ * @param index - Index given by mounts_register()
+ * @return const mount_stat_t* - NULL if it is not mounted
+ *                               or not queried yet
+ ***********************************************/
+const mount_stat_t *mounts_get(int index)
+{
+	if ((index < 0) || (index >= registered_count) || (registered_entry[index] < 0))
+	{
+		return NULL;
+	}
+
+	const mount_stat_t *stat = &entries[registered_entry[index]].stat;
+	return stat->valid ? stat : NULL;
+}
+
+/*******************************************/ /**
+ * @brief Get the summary of the mounts that match the filters
+ *
+ * @return const char* - JSON array of objects with "path",
+ *         "avail_mb", "used_pct" and "stale" if it is stale
+ ***********************************************/
+const char *mounts_summary()
+{
+	return summary;
+}
+
+/*******************************************/ /**
+ * @brief Get the sum of the available space of the mounts
+ *        that match the filters
+ ***********************************************/
+uint64_t mounts_avail_mb()
+{
+	return avail_mb;
+}
+
+/*******************************************/ /**
+ * @brief Get the count of stale mounts that match the filters
+ ***********************************************/
+int mounts_stale()
+{
+	return stale_count;
+}
+
+/*******************************************/ /**
+ * @brief Close mountinfo and forget the table and the tags.
+ *        Pending statvfs() threads give free their probe.
+ ***********************************************/
+void mounts_free()
+{
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	fd = -1;
+	free(buffer); buffer = NULL;
+	buffer_size = 0;
+	free_table(entries, entry_count);
+	entries = NULL;
+	entry_count = 0;
+	table_valid = false;
+	for (int i = 0; i < registered_count; i++)
+	{
+		free(registered[i]);
+	}
+	free(registered); registered = NULL;
+	free(registered_entry); registered_entry = NULL;
+	registered_count = 0;
+	free(fstypes); fstypes = NULL;
+	free(paths); paths = NULL;
+	strcpy(summary, "[]");
+	avail_mb = 0;
+	stale_count = 0;
+}
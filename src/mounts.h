@@ -0,0 +1,40 @@
+/*******************************************/ /**
+ * @file mounts.h
+ * @author marsman7 (you@domain.com)
+ * @brief Free space of the mounted file systems, from a
+ *        mount table that is only read again on a change.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef MOUNTS_H
+#define MOUNTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MOUNTS_SUMMARY_SIZE 1024	/*!< max. length of the summary incl. zero */
+
+/*******************************************/ /**
+ * @brief Space of one mount
+ ***********************************************/
+typedef struct mount_stat_t
+{
+	bool valid;		/*!< a statvfs() has returned */
+	bool stale;		/*!< the last statvfs() did not return in time */
+	uint64_t total_mb;
+	uint64_t free_mb;
+	uint64_t avail_mb;	/*!< free for unprivileged users */
+	double used_pct;
+} mount_stat_t;
+
+int mounts_init(const char *, const char *, int);
+int mounts_register(const char *, size_t);
+int mounts_update();
+const mount_stat_t *mounts_get(int);
+const char *mounts_summary();
+uint64_t mounts_avail_mb();
+int mounts_stale();
+void mounts_free();
+
+#endif
@@ -19,62 +19,231 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
-#include <sys/statvfs.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/reboot.h>
 #include <linux/limits.h>
 #include <errno.h>
+#include <limits.h>
 #include <syslog.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdbool.h>
-#include <malloc.h>
 #include <getopt.h>		// only for getopt_long() not for getopt()
 #include <libconfig.h>
 #include <mosquitto.h> // for MQTT funtionallity
-
-#include <sys/sysinfo.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <poll.h>
 
 #include "mqtt-heartbeat.h"
+#include "template.h"
+#include "service.h"
+#include "metrics.h"
+#include "inflight.h"
+#include "scheduler.h"
+#include "spool.h"
+#include "procfs.h"
+#include "cpustat.h"
+#include "mounts.h"
+#include "cgroup.h"
+#include "watch.h"
+#include "psi.h"
 
 //-----------------------------------------------
 #define ERROR_EXIT(msg) do	{perror(msg); _exit(EXIT_FAILURE); } while(0)
 
 #define LOG(level, msg, args...) if (level <= log_level) { fprintf(stderr, msg, level, ##args); }
 
-#define MQTT_MAX_MESSAGE_LENGTH 1024
+#define TAG_VALUE_SIZE 64	// max. rendered width of a dynamic tag
+
+#define MAX_EVENTS 8		// events handled per epoll_wait()
+#define CONNACK_SESSION_PRESENT 0x01	// flag of the CONNACK, the broker kept the session
+#define CONNACK_NOT_AUTHORIZED_V5 0x87	// reason code of a MQTT v5 CONNACK
+#define RELOAD_RETRY_MS 1000	// retry of a reload while a collector of a module is pending
+// collectors that keep their state in a module, see metrics_pending()
+#define MODULE_COLLECTORS (COLLECT_SERVICES | COLLECT_PROCFS | COLLECT_CPUSTAT | \
+		COLLECT_MOUNTS | COLLECT_CGROUP | COLLECT_PSI)
 
 #ifndef VERSION_STR
 	#define VERSION_STR "0.0.0"
 #endif
 
 //-----------------------------------------------
-typedef void (*sighandler_t)(int);
 char *config_file_name = NULL;
 const char *shutdown_cmd = NULL;
 bool pause_flag = false; 	/*!< set it TRUE the process go to paused, send SIGCONT to continue the process */
+bool terminate_flag = false;	/*!< set it TRUE to leave the main loop and exit the process */
 int keepalive = 30;
 struct mosquitto *mosq = NULL; //! mosquitto client instance
 bool connected = false;
 int status = STAT_ON;
-char *pub_parsed = NULL;
+publish_job_t *jobs = NULL;	/*!< the publish jobs, first is STAT_JOB */
+int job_count = 0;
+int *due_jobs = NULL;		/*!< jobs due in the current tick, one entry per job */
+scheduler_t scheduler = {0};	/*!< next deadline of each job */
+metrics_t metrics = {0};	/*!< snapshot of the current tick */
+int epoll_fd = -1;		/*!< the event loop */
+int mosq_fd = -1;		/*!< socket of the broker connection watched by epoll */
+int sched_timer_fd = -1;	/*!< expires on the earliest deadline of the jobs */
+int collect_timer_fd = -1;	/*!< starts the collectors 'collector_timeout_ms' ahead of the deadline */
+uint64_t collect_since = 0;	/*!< start of the collectors of the next tick, ZERO if not started */
+int misc_timer_fd = -1;		/*!< drives mosquitto_loop_misc() for the keepalive */
+int reconnect_timer_fd = -1;	/*!< expires when a lost connection is retried */
+int signal_fd = -1;		/*!< delivers the catched signals to the main loop */
+sigset_t catched_signals;	/*!< signals blocked and read from signal_fd */
+int replay_timer_fd = -1;	/*!< paces the replay of the spool */
+spool_t spool = { .fd = -1 };	/*!< messages rendered while not connected */
+bool reconnect_pending = false;	/*!< the socket is not watched until the reconnect */
+compress_t compressor = {0};	/*!< shared by the jobs with compression */
+rate_tag_t *rate_tags = NULL;	/*!< state of the %rate(...)% tags, indexed by the token */
+int rate_tag_count = 0;
+window_tag_t *window_tags = NULL;	/*!< state of the window tags, indexed by the token */
+int window_tag_count = 0;
+uint32_t window_collectors = 0;	/*!< collectors referenced by the window tags */
+metrics_t window_metrics = {0};	/*!< snapshot of the last window sample */
+int sample_timer_fd = -1;	/*!< samples the window tags every 'sample_interval_ms' */
+uint64_t window_since = 0;	/*!< start of the collectors of the next window sample */
+envelope_t envelope = {0};	/*!< payloads of the jobs with 'envelope' of the current tick */
+batch_t batch = { .sock = -1 };	/*!< the tick in progress, counts the writes of the publishes */
+batch_stats_t batch_stats = { -1, -1, -1 };	/*!< counters of the last tick that published */
+bool batch_counted = false;	/*!< a template references the counters of the tick */
+int trigger_timer_fd = -1;	/*!< expires on the earliest triggered publish */
+int reload_timer_fd = -1;	/*!< retries a reload that waits for a hung collector */
+config_t *running_config = NULL;	/*!< the applied config file, a reload is compared to it */
+
+// The settings of the sections that are applied together. A reload
+// applies a section only if one of its settings is changed. The 
+// broker and the subscription are compared by their values and the
+// other settings are read again on each reload.
+const char * const spool_keys[] = { "spool_file", "spool_size", NULL };
+const char * const collector_keys[] = { "service_backend", "service_state_file", "service_max_age", 
+		"collector_threads", "collector_timeout_ms", "cpu_busiest", "cgroup_root", "mount_fstypes", 
+		"mount_paths", "mount_timeout_ms", "psi_triggers", NULL };
+const char * const compress_keys[] = { "compress_dictionary", "compress_level", NULL };
+const char * const job_keys[] = { "stat_interval", "stat_pub_topic", "stat_pub_message", "stat_trigger",
+		"stat_policy", "stat_deadband_abs", "stat_deadband_rel", "stat_refresh_interval",
+		"tele_interval", "tele_pub_topic", "tele_pub_message", "tele_format", "tele_compression", 
+		"tele_trigger", "tele_policy", "tele_deadband_abs", "tele_deadband_rel", "tele_refresh_interval",
+		"trigger_debounce_ms", "trigger_holdoff_ms", "psi_alert_topic", "psi_alert_message", 
+		"envelope_topic", "envelope_format", "compress_threshold", 
+		"message_expiry", "QoS", "jobs", NULL };
+int reconnect_attempts = 0;	/*!< failed connects since the last CONNACK, for the backoff */
+bool subscribed = false;	/*!< 'sub_topic' is subscribed in the session of the broker */
+int topic_alias_max = 0;	/*!< topic aliases the broker accepts, from the MQTT v5 CONNACK */
 
 //-----------------------------------------------
 void terminate_second_instance();
-char *parse_string(char *, const char *);
+int resolve_tag(const char *, size_t, template_token_t *, char *, size_t, void *);
+int resolve_rate(const char *, size_t, template_token_t *, void *);
+int resolve_window(const char *, size_t, template_token_t *, void *);
+int resolve_mount(const char *, size_t, template_token_t *, void *);
+void window_value(window_tag_t *, const metrics_t *, metric_value_t *);
+void reset_job_windows(publish_job_t *);
+void sample_windows();
+void tag_value(const template_token_t *, const metrics_t *, metric_value_t *);
+void cpu_value(int, const cpustat_summary_t *, metric_value_t *);
+void mount_value(int, const mount_stat_t *, metric_value_t *);
+void compress_value(int, const publish_job_t *, metric_value_t *);
+size_t format_value(const metric_value_t *, char *, size_t);
+size_t format_tag(const template_token_t *, char *, void *);
+size_t format_next_value(const template_token_t *, char *, void *);
+void sample_metrics(uint32_t, uint64_t);
+void collect_metrics(uint32_t);
+void compile_template(template_t *, const char *, uint32_t *);
 char *alloc_string(char *, const char *);
+char *render_constant(char *, const char *);
+publish_job_t *add_job(const char *, const char *, int, int, bool);
+int set_job_format(publish_job_t *, const char *);
+int set_job_compression(publish_job_t *, const char *, int);
+void set_job_trigger(publish_job_t *, const char *, int, int);
+void set_psi_triggers(const char *);
+void evaluate_job(publish_job_t *);
+const char *render_job(publish_job_t *, size_t *);
+const char *compress_job(publish_job_t *, const char *, size_t *);
+int job_alias(const publish_job_t *);
+const char *job_content_type(const publish_job_t *, bool, bool *);
+const mosquitto_property *job_properties(publish_job_t *, bool);
+void reset_job_properties();
+void read_job_policy(publish_job_t *, const config_setting_t *, const char *);
+int read_jobs(const config_t *);
+void swap_jobs(job_set_t *);
+void free_job_set(job_set_t *);
+void free_jobs();
+void keep_job_state(job_set_t *, bool);
 int get_config_int(const config_t *, const char *, int *, int );
 int get_config_string(const config_t *, const char *, char **, const char *, bool);
+int get_config_bool(const config_t *, const char *, bool *, bool);
+int load_config(config_t *);
+bool config_setting_equal(const config_setting_t *, const config_setting_t *);
+bool section_changed(const config_t *, const config_t *, const char * const *);
+bool valid_int(const config_setting_t *, const char *, int, int);
+bool valid_name(const config_setting_t *, const char *, int (*)(const char *));
+int validate_config(const config_t *);
+void apply_general(const config_t *);
+void apply_broker(const config_t *);
+void apply_subscription(const config_t *);
+void apply_spool(const config_t *);
+void free_spool();
+void apply_collectors(const config_t *);
+void free_collectors();
+void apply_compression(const config_t *);
+void free_compression();
+void apply_jobs(const config_t *);
+void apply_config(const config_t *);
 int read_config();
+void save_broker_settings(broker_settings_t *);
+bool broker_settings_changed(const broker_settings_t *);
+void free_broker_settings(broker_settings_t *);
+int save_deadlines(job_deadline_t **);
+void free_deadlines(job_deadline_t *, int);
+void update_subscription(const char *, int);
 void init_mosquitto();
+void set_mosquitto_callbacks();
 void connect_broker();
-void on_connect_callback(struct mosquitto *, void *, int);
+int reconnect_delay();
+void on_connect_callback(struct mosquitto *, void *, int, int, const mosquitto_property *);
 void on_subscribe_callback(struct mosquitto *, void *, int, int, const int *);
 void on_message_callback(struct mosquitto *, void *, const struct mosquitto_message *);
 void on_publish_callback(struct mosquitto *, void *, int);
+void on_disconnect_callback(struct mosquitto *, void *, int);
+int create_timer();
+void arm_timer(int, int, bool);
+uint64_t monotonic_ns();
+void arm_timer_at(int, uint64_t);
+void arm_timer_ms(int, int);
+uint64_t read_timer(int);
+void init_event_loop();
+void schedule_jobs(const job_deadline_t *, int);
+void arm_schedule();
+void prefetch_jobs();
+uint64_t smallest_interval();
+uint64_t schedule_phase(const char *);
+uint64_t first_deadline(const publish_job_t *, uint64_t, uint64_t, uint64_t);
+uint64_t realtime_ns();
+void run_due_jobs();
+void publish_jobs(int, uint32_t, uint64_t, uint64_t);
+void watch_events();
+void trigger_jobs(uint32_t);
+uint64_t next_trigger();
+void run_triggered_jobs();
+void watch_mosquitto();
+void schedule_reconnect();
+void handle_mosquitto(uint32_t);
+int publish_job(publish_job_t *);
+int publish_payload(publish_job_t *, const char *, size_t);
+bool envelope_job(publish_job_t *, const char *, size_t);
+int publish_envelope(int);
+void spool_job(publish_job_t *);
+void start_replay();
+void replay_spool();
+void drain_publish(int);
 void discard_free_config();
 void init_signal_handler();
-void signal_handler(int);
+void handle_signal(int);
+void reload_config();
 
 /*******************************************/ /**
  * @brief If this not the first instance, it is terminated
@@ -128,15 +297,14 @@ void clean_exit()
 	{
 		if (connected)
 		{
-			pub_parsed = parse_string(pub_parsed, stat_pub_message);
-			mosquitto_publish(mosq, NULL, stat_pub_topic, strlen(pub_parsed), pub_parsed, qos, false);
+			collect_metrics(jobs[STAT_JOB].collectors);
+			evaluate_job(&jobs[STAT_JOB]);
+			int mid = publish_job(&jobs[STAT_JOB]);
 
-			// Wait of empty send queue
-			int i = 100;
-			while (mosquitto_want_write(mosq) && (i > 0))
+			// Wait until the broker has acknowledged the message
+			if (mid >= 0)
 			{
-					usleep(100000); // sleep 100ms
-					i--;
+				drain_publish(mid);
 			}
 		}
 
@@ -156,6 +324,8 @@ void clean_exit()
 
 	if (shutdown_cmd)
 	{
+		// The command must not inherit the blocked signals
+		sigprocmask(SIG_UNBLOCK, &catched_signals, NULL);
 		char *command = malloc(128);
 		sync();
 		snprintf(command, 128, "shutdown %s %d", shutdown_cmd, shutdown_delay);
@@ -170,450 +340,3162 @@ void clean_exit()
 }
 
 /*******************************************/ /**
- * @brief Pars a string and exchang the tags.
+ * @brief Resolve the name of a tag on compiling a template.
  * A Tag must be surrounded with %. For example foo/%bar%/for/%every%
- * The returnet pointer must be freeing ( free(char*) ).
+ * Constant tags are folded into the template, the others are
+ * evaluated by format_tag() on each render.
  * 
- * @param dst_string - Pointer to destination string to reuse the memory 
- *                     or NULL to use new allocated memory.
- * @param src_string - Pointer to given incoming string
- * @return char* - Pointer to parsed string
+ * @param name - Name of the tag, not terminated
+ * @param name_length - Length of the name
+ * @param token - Token to set opcode, argument and max. width
+ * @param value - Buffer to store the value of a constant tag
+ * @param value_size - Size of the value buffer
+ * @param ctx - Pointer to uint32_t to add the referenced collectors
+ * @return int - One of enum template_tag_t
  ***********************************************/
-char *parse_string(char *dst_string, const char *src_string)
+int resolve_tag(const char *name, size_t name_length, template_token_t *token, char *value, size_t value_size, void *ctx)
 {
-	if (! src_string)
-	{
-		return NULL;
-	}
+	uint32_t *collectors = ctx;
 
-	char *ptemp_src = NULL;
-	if (! dst_string) {
-		dst_string = malloc(1); 	// Pointer to destination parsed string
-	}
-	*dst_string = '\0';
-	unsigned int dst_length = 0;
-
-	// Check if a tag is included in the topic and get the begin of the tag
-	ptemp_src = strchr(src_string, '%');
-	if (!ptemp_src)
+	size_t rate_length = strlen(rate_prefix);
+	if ((name_length > rate_length + 1) && (strncasecmp(rate_prefix, name, rate_length) == 0) &&
+			(name[name_length - 1] == ')'))
 	{
-		// topic does not contain tags
-		dst_length = strnlen(src_string, MQTT_MAX_MESSAGE_LENGTH - 1);
-		dst_string = realloc(dst_string, dst_length + 1);
-		strncat(dst_string, src_string, dst_length);
-		return dst_string;
+		return resolve_rate(name + rate_length, name_length - rate_length - 1, token, ctx);
 	}
-	
-	unsigned int sub_string_length = 0;
-	bool var_found = false;		// indicates a valid tag 
-	char tag_value[64] = "\0";
-	char *ptag_value = NULL;
-
-	do
+	if ((name_length > 2) && (name[name_length - 1] == ')') && memchr(name, '(', name_length))
 	{
-		sub_string_length = ptemp_src - src_string;
-		// Check and allocate memory
-		size_t requested_size = dst_length + sub_string_length + 1;
-		if (requested_size > malloc_usable_size(dst_string)) {
-			if (!(dst_string = realloc(dst_string, requested_size)))
+		for (size_t i = 0; i < sizeof(mount_tag_names) / sizeof(mount_tag_names[0]); i++)
+		{
+			size_t length = strlen(mount_tag_names[i].name);
+			if ((name_length > length + 2) && (name[length] == '(') && 
+					(strncasecmp(mount_tag_names[i].name, name, length) == 0))
 			{
-				ERROR_EXIT(err_out_of_memory);
+				token->op = mount_tag_names[i].op;
+				return resolve_mount(name + length + 1, name_length - length - 2, token, ctx);
 			}
 		}
+		return resolve_window(name, name_length, token, ctx);
+	}
 
-		// copy string up to tag '%'
-		strncat(dst_string, src_string, sub_string_length);
-		dst_length = strlen(dst_string);
-		src_string = ptemp_src + 1; // point to character after tag '%'
-
-		// Search close tag to get the attribut name length
-		ptemp_src = strchr(src_string, '%');
-		if (!ptemp_src)
+	for (size_t i = 0; i < sizeof(tag_names) / sizeof(tag_names[0]); i++)
+	{
+		if ((strlen(tag_names[i].name) == name_length) && 
+				(strncasecmp(tag_names[i].name, name, name_length) == 0))
 		{
-			// topic does not contain tag
-			return (char *)dst_string;
+			token->op = tag_names[i].op;
+			token->length = TAG_VALUE_SIZE;
+			*collectors |= tag_names[i].collectors;
+			break;
 		}
-		sub_string_length = ptemp_src - src_string;
+	}
 
-		var_found = false;
-		if (strncasecmp("hostname", src_string, sub_string_length) == 0)
-		{
-			gethostname(tag_value, sizeof(tag_value) - 1);
-			sub_string_length = strnlen(tag_value, sizeof(tag_value));
-			ptag_value = tag_value;
-			var_found = true;
-		} 
-		else if (strncasecmp("user", src_string, sub_string_length) == 0) 
-		{
-			// Is it run as a service, than is run it with user root and 
-			// 'secure_getenv("USER");' delivers NULL
-			ptag_value = secure_getenv("USER");
-			if (ptag_value == NULL) {
-				ptag_value = (char *)root_name;
-			}
-			sub_string_length = strnlen(ptag_value, 63);
-			var_found = true;
-		}
-		else if (strncasecmp("version", src_string, sub_string_length) == 0) 
-		{
-			strncpy(tag_value, VERSION_STR, strnlen(VERSION_STR, sizeof(tag_value)-1)+1);
-			sub_string_length = strnlen(tag_value, sizeof(tag_value));
-			ptag_value = tag_value;
-			var_found = true;
-		}
-		else if (strncasecmp("status", src_string, sub_string_length) == 0) 
-		{
-			if (status)
-			{
-				ptag_value = (char *)status_on_string;
-			}
-			else
-			{
-				ptag_value = (char *)status_off_string;
-			}
-			sub_string_length = strnlen(ptag_value, 63);
-			var_found = true;
-		}
-		else if (strncasecmp("loadavg_1", src_string, sub_string_length) == 0)
-		{
-			//double loadavgs[3];
-			//getloadavg(loadavgs, 3);
-			//sprintf(tag_value, "%.0f", loadavgs[0]*1000);		
-			struct sysinfo info;
-			sysinfo(&info);
-			sprintf(tag_value, "%lu", info.loads[0]);		
-			sub_string_length = strnlen(tag_value, sizeof(tag_value));
-			ptag_value = tag_value;
-			var_found = true;
-		}
-		else if (strncasecmp("uptime", src_string, sub_string_length) == 0)
-		{
-			struct sysinfo info;
-			sysinfo(&info);
-			sprintf(tag_value, "%ld", info.uptime);		
-			sub_string_length = strnlen(tag_value, sizeof(tag_value));
-			ptag_value = tag_value;
-			var_found = true;
-		}
-		else if (strncasecmp("ramfree", src_string, sub_string_length) == 0)
-		{
-			// free RAM in percent
-			struct sysinfo info;
-			sysinfo(&info);
-			sprintf(tag_value, "%ld", info.freeram * 100 / info.totalram);		
-			sub_string_length = strnlen(tag_value, sizeof(tag_value));
-			ptag_value = tag_value;
-			var_found = true;
-		}
-		else if (strncasecmp("diskfree_mb", src_string, sub_string_length) == 0)
-		{
-			struct statvfs fsinfo;
+	switch (token->op)
+	{
+	case TAG_HOSTNAME:
+		gethostname(value, value_size - 1);
+		return TEMPLATE_TAG_CONSTANT;
+	case TAG_USER:
+	{
+		// Is it run as a service, than is run it with user root and 
+		// 'secure_getenv("USER");' delivers NULL
+		const char *user = secure_getenv("USER");
+		snprintf(value, value_size, "%s", user ? user : root_name);
+		return TEMPLATE_TAG_CONSTANT;
+	}
+	case TAG_VERSION:
+		snprintf(value, value_size, "%s", VERSION_STR);
+		return TEMPLATE_TAG_CONSTANT;
+	case TAG_MOUNTS:
+		token->length = MOUNTS_SUMMARY_SIZE;
+		return TEMPLATE_TAG_DYNAMIC;
+	case TAG_PSI_ALERT:
+		token->length = PSI_ALERT_SIZE;
+		return TEMPLATE_TAG_DYNAMIC;
+	case TAG_BATCH_MESSAGES:
+	case TAG_BATCH_WRITES:
+	case TAG_BATCH_PACKETS:
+		batch_counted = true;
+		return TEMPLATE_TAG_DYNAMIC;
+	case TEMPLATE_OP_LITERAL:
+		break;
+	default:
+		return TEMPLATE_TAG_DYNAMIC;
+	}
 
-  			if ( ! statvfs("/", &fsinfo) )
-			{
-				sprintf(tag_value, "%ld", (fsinfo.f_bsize * fsinfo.f_bfree) >> 20);
-			}
-			else
-			{
-				LOG(3, "<%d>Error : Get file system info!\n");
-				sprintf(tag_value, "0");
-			}
-			sub_string_length = strnlen(tag_value, sizeof(tag_value));
-			ptag_value = tag_value;
-			var_found = true;
-		}
-		else if (strncasecmp(service_prefix, src_string, strlen(service_prefix)) == 0)
+	size_t prefix_length = strlen(service_prefix);
+	if ((name_length > prefix_length) && (strncasecmp(service_prefix, name, prefix_length) == 0))
+	{
+		int index = service_register(name + prefix_length, name_length - prefix_length);
+		if (index < 0)
 		{
-			const char *ptemp = src_string + strlen(service_prefix);
-			int service_name_len = sub_string_length - strlen(service_prefix);
-			if ( (! strlen(ptemp)) && service_name_len )
-			{
-				sprintf(tag_value, "0");
-			}
-			else
-			{
-				char system_cmd[128] = "systemctl is-active ";
-				strncat(system_cmd, ptemp, service_name_len);
-				//LOG(6, "<%d>%s\n", system_cmd);
-
-				// Will write the output from system command in the pipe
-				FILE *system_command_pipe;
-				system_command_pipe = popen(system_cmd, "r");
-				if ( ! fgets(tag_value, sizeof(tag_value), system_command_pipe) )
-				{
-					LOG(6, "<%d>Error : On read from pipe!\n");
-					tag_value[0] = '\0';
-				}
-				else
-				{
-					char *ptemp = strpbrk(tag_value, "\n\r");
-					// Cut the line break on the end of the string
-					*ptemp = '\0';
-				}
-				pclose(system_command_pipe);
-			}
-			sub_string_length = strnlen(tag_value, sizeof(tag_value));
-			ptag_value = tag_value;
-			var_found = true;
+			ERROR_EXIT(err_out_of_memory);
 		}
+		token->op = TAG_SERVICE;
+		token->arg = index;
+		token->length = TAG_VALUE_SIZE;
+		*collectors |= COLLECT_SERVICES;
+		return TEMPLATE_TAG_DYNAMIC;
+	}
 
-		if (var_found)
+	int index = procfs_register(name, name_length);
+	if (index >= 0)
+	{
+		token->op = TAG_PROCFS;
+		token->arg = index;
+		token->length = TAG_VALUE_SIZE;
+		*collectors |= COLLECT_PROCFS;
+		return TEMPLATE_TAG_DYNAMIC;
+	}
+	if (errno == ENOENT)
+	{
+		index = cgroup_register(name, name_length);
+		if (index >= 0)
 		{
-			// Check and allocate memory
-			size_t requested_size = dst_length + sub_string_length + 1;
-			if (requested_size > malloc_usable_size(dst_string)) {
-				if (!(dst_string = realloc(dst_string, requested_size)))
-				{
-					ERROR_EXIT(err_out_of_memory);
-				}
-			}
-			strncat(dst_string, ptag_value, sub_string_length);
-			dst_length = strlen(dst_string);
+			token->op = TAG_CGROUP;
+			token->arg = index;
+			token->length = TAG_VALUE_SIZE;
+			*collectors |= COLLECT_CGROUP;
+			return TEMPLATE_TAG_DYNAMIC;
 		}
-
-		src_string = ptemp_src + 1; // point to character after tag
-		ptemp_src = strchr(src_string, '%');
-	} while (ptemp_src);
-
-	// Check if there is anything left of the string
-	sub_string_length = strnlen(src_string, MQTT_MAX_MESSAGE_LENGTH);
-	if (sub_string_length)
+	}
+	if (errno == ENOENT)
 	{
-		// Check and allocate memory
-		size_t requested_size = dst_length + sub_string_length + 1;
-		if (requested_size > malloc_usable_size(dst_string)) {
-			if (!(dst_string = realloc(dst_string, requested_size)))
-			{
-				ERROR_EXIT(err_out_of_memory);
-			}
+		index = psi_register(name, name_length);
+		if (index >= 0)
+		{
+			token->op = TAG_PSI;
+			token->arg = index;
+			token->length = TAG_VALUE_SIZE;
+			*collectors |= COLLECT_PSI;
+			return TEMPLATE_TAG_DYNAMIC;
 		}
-		// Copy the rest of the string
-		strncat(dst_string, src_string, sub_string_length);
-		dst_length = strlen(dst_string);
+	}
+	if (errno == ENOMEM)
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	if (errno != ENOENT)
+	{
+		LOG(4, "<%d>Tag %%%.*s%% not available : %s\n", (int)name_length, name, strerror(errno));
+		return TEMPLATE_TAG_UNKNOWN;
 	}
 
-	return dst_string;
+	LOG(4, "<%d>Unknown tag : %%%.*s%%\n", (int)name_length, name);
+	return TEMPLATE_TAG_UNKNOWN;
 }
 
 /*******************************************/ /**
- * @brief Allocate or reallocate memory to store a string. The 
- * returnet pointer must be freeing ( free(char*) ).
+ * @brief Resolve a %rate(<tag>)% tag, its counter must be a 
+ *        dynamic tag. The state is allocated here, so the 
+ *        render needs no allocation.
  * 
- * @param dst_string - Pointer to destination string to reuse the memory 
- *                     or NULL to use new allocated memory.
- * @param src_string - Pointer to given incoming string
- * @return char* - Pointer to destination string
+ * @param name - Name of the counter tag, not terminated
+ * @param name_length - Length of the name
+ * @param token - Token to set opcode, argument and max. width
+ * @param ctx - Pointer to uint32_t to add the referenced collectors
+ * @return int - One of enum template_tag_t
  ***********************************************/
-char *alloc_string(char *dst_string, const char *src_string)
+int resolve_rate(const char *name, size_t name_length, template_token_t *token, void *ctx)
 {
-	dst_string = realloc(dst_string, strnlen(src_string, MQTT_MAX_MESSAGE_LENGTH-1)+1);
-	*dst_string = '\0';
-	strncpy(dst_string, src_string, strnlen(src_string, MQTT_MAX_MESSAGE_LENGTH-1)+1);
+	template_token_t counter = {0};
+	char value[TAG_VALUE_SIZE];
 
-	return dst_string;
+	if (resolve_tag(name, name_length, &counter, value, sizeof(value), ctx) != TEMPLATE_TAG_DYNAMIC)
+	{
+		LOG(4, "<%d>Tag %%rate(%.*s)%% needs a counter\n", (int)name_length, name);
+		return TEMPLATE_TAG_UNKNOWN;
+	}
+
+	rate_tag_t *new_tags = realloc(rate_tags, (rate_tag_count + 1) * sizeof(rate_tag_t));
+	if (! new_tags)
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	rate_tags = new_tags;
+	memset(&rate_tags[rate_tag_count], 0, sizeof(rate_tag_t));
+	rate_tags[rate_tag_count].counter = counter;
+
+	token->op = TAG_RATE;
+	token->arg = rate_tag_count++;
+	token->length = TAG_VALUE_SIZE;
+	return TEMPLATE_TAG_DYNAMIC;
 }
 
 /*******************************************/ /**
- * @brief Get the config int object
+ * @brief Resolve a tag of a single mount like 
+ *        %mount_avail_mb(<path>)%, the opcode is set 
+ *        before. The path is also queried if it does not 
+ *        match the filters 'mount_fstypes' and 'mount_paths'.
  * 
- * @param config - A valid mosquitto instance.
- * @param name - Name of option in config file.
- * @param dst_int - Pointer to store the value.
- * @param default_int - Preseted value if option not found in the file.
- * @return int - On option succes return 'CONFIG_TRUE'. If the setting was 
- *             not found or if the type of the value did not match, 
- *             return CONFIG_FALSE. 
+ * @param path - The mount point, not terminated
+ * @param path_length - Length of the path
+ * @param token - Token to set argument and max. width
+ * @param ctx - Pointer to uint32_t to add the referenced collectors
+ * @return int - One of enum template_tag_t
  ***********************************************/
-int get_config_int(const config_t *config, const char *name, int *dst_int, int default_int)
+int resolve_mount(const char *path, size_t path_length, template_token_t *token, void *ctx)
 {
-	*dst_int = default_int;
-	return config_lookup_int(config, name, dst_int);
+	int index = mounts_register(path, path_length);
+	if (index < 0)
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+
+	token->arg = index;
+	token->length = TAG_VALUE_SIZE;
+	*(uint32_t *)ctx |= COLLECT_MOUNTS;
+	return TEMPLATE_TAG_DYNAMIC;
 }
 
 /*******************************************/ /**
- * @brief Get the config string object and allocate memory
+ * @brief Resolve a window tag %min(<tag>)%, %max(<tag>)%, 
+ *        %avg(<tag>)% or %p<NN>(<tag>)%, e.g. %p95(loadavg_1)%.
+ *        Its sample must be a dynamic tag. The state is 
+ *        allocated here, so sampling needs no allocation.
  * 
- * @param config - A valid mosquitto instance.
- * @param name - Name of option in config file.
- * @param dst_string - Pointer to pointer to store the string. For allocate
- *             new memory the pointer will NULL.
- * @param src_string - Preseted value if option not found in the file.
- * @param to_pars - Flag for will parsing the string or not.
- * @return int - On option succes return 'CONFIG_TRUE'. If the setting was 
- *             not found or if the type of the value did not match, 
- *             return CONFIG_FALSE. 
+ * @param name - Name of the tag, not terminated
+ * @param name_length - Length of the name
+ * @param token - Token to set opcode, argument and max. width
+ * @param ctx - Pointer to uint32_t to add the referenced collectors
+ * @return int - One of enum template_tag_t
  ***********************************************/
-int get_config_string(const config_t *config, const char *name, char **dst_string, const char *src_string, bool to_pars)
+int resolve_window(const char *name, size_t name_length, template_token_t *token, void *ctx)
 {
-	int result = config_lookup_string(config, name, &src_string);
+	const char *paren = memchr(name, '(', name_length);
+	size_t function_length = paren - name;
+	enum window_kind_t kind;
+	double quantile = 0;
 
-	LOG(6, "<%d>config lookup : %d %s = %s\n", result, name, src_string);
+	if ((function_length == 3) && (! strncasecmp(name, "min", 3)))
+	{
+		kind = WINDOW_MIN;
+	}
+	else if ((function_length == 3) && (! strncasecmp(name, "max", 3)))
+	{
+		kind = WINDOW_MAX;
+	}
+	else if ((function_length == 3) && (! strncasecmp(name, "avg", 3)))
+	{
+		kind = WINDOW_AVG;
+	}
+	else if ( (function_length >= 2) && (function_length <= 3) && (tolower(*name) == 'p') &&
+			isdigit(name[1]) && ((function_length == 2) || isdigit(name[2])) )
+	{
+		kind = WINDOW_QUANTILE;
+		quantile = atoi(name + 1) / 100.0;
+	}
+	else
+	{
+		LOG(4, "<%d>Unknown tag : %%%.*s%%\n", (int)name_length, name);
+		return TEMPLATE_TAG_UNKNOWN;
+	}
 
-	if (to_pars)
+	template_token_t sample = {0};
+	char value[TAG_VALUE_SIZE];
+	uint32_t collectors = 0;
+	const char *sample_name = paren + 1;
+	size_t sample_length = name_length - function_length - 2;
+
+	if (resolve_tag(sample_name, sample_length, &sample, value, sizeof(value), &collectors) != TEMPLATE_TAG_DYNAMIC)
 	{
-		*dst_string = parse_string(*dst_string, src_string);
-		return result;
+		LOG(4, "<%d>Tag %%%.*s%% needs a dynamic tag\n", (int)name_length, name);
+		return TEMPLATE_TAG_UNKNOWN;
 	}
+	*(uint32_t *)ctx |= collectors;
+	window_collectors |= collectors;
 
-	// if found the option "name" in config use it otherwise use the given string
-	*dst_string = realloc(*dst_string, strnlen(src_string, MQTT_MAX_MESSAGE_LENGTH-1)+1);
-	**dst_string = '\0';
-	strncpy(*dst_string, src_string, strnlen(src_string, MQTT_MAX_MESSAGE_LENGTH-1)+1);
+	window_tag_t *new_tags = realloc(window_tags, (window_tag_count + 1) * sizeof(window_tag_t));
+	if (! new_tags)
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	window_tags = new_tags;
+	window_tag_t *tag = &window_tags[window_tag_count];
+	memset(tag, 0, sizeof(*tag));
+	tag->sample = sample;
+	tag->kind = kind;
+	tag->quantile = quantile;
 
-	return result;
+	token->op = TAG_WINDOW;
+	token->arg = window_tag_count++;
+	token->length = TAG_VALUE_SIZE;
+	return TEMPLATE_TAG_DYNAMIC;
 }
 
 /*******************************************/ /**
- * @brief Reads the configuration file or creates it if it is not available
+ * @brief Get the aggregate of a window tag. A window without 
+ *        samples gets one of the snapshot. The window is kept
+ *        until the job is published, see reset_job_windows().
  * 
- * @return int - Result, ZERO at successfully, otherwise -1
+ * @param tag - The window tag
+ * @param snapshot - The metrics snapshot
+ * @param value - Stores the typed value
  ***********************************************/
-int read_config()
+void window_value(window_tag_t *tag, const metrics_t *snapshot, metric_value_t *value)
 {
-	LOG(6, "<%d>libconfig Version : %d.%d.%d\n", LIBCONFIG_VER_MAJOR, LIBCONFIG_VER_MINOR, LIBCONFIG_VER_REVISION);
-	LOG(6, "<%d>Config file to use : %s\n", config_file_name);
-
-	// check exist the .conf file
-	// Atributes F_OK, R_OK, W_OK, XOK or "OR" linked R_OK|X_OK
-	if (access(config_file_name, F_OK))
+	if (! tag->window.count)
 	{
-		FILE *newfile;
-		if ((newfile = fopen(config_file_name, "w+")))
+		metric_value_t sample;
+		tag_value(&tag->sample, snapshot, &sample);
+		if (sample.type == VALUE_INT)
 		{
-			fprintf(newfile, preset_config_file );
-			fclose(newfile);
-			LOG(5, "<%d>Create a new config file\n");
+			window_add(&tag->window, sample.i);
 		}
-		else
+		else if (sample.type == VALUE_DOUBLE)
 		{
-			LOG(3, "<%d>Can't create a new config file\n");
-			return EXIT_FAILURE;
+			window_add(&tag->window, sample.d);
 		}
 	}
 
-	config_t cfg;
-	config_init(&cfg);
-
-	// Read the file. If there is an error, report it and return.
-	if (!config_read_file(&cfg, config_file_name))
+	if (! tag->window.count)
 	{
-		LOG(4, "<%d>ERROR : Config file read : (%d) %s @ %s:%d\n",
-				config_error_type(&cfg), config_error_text(&cfg),
-				config_error_file(&cfg), config_error_line(&cfg));
-		config_destroy(&cfg);
-		return EXIT_FAILURE;
+		value->type = VALUE_NONE;
+		return;
 	}
 
-	// Get stored settings.
-	get_config_int(&cfg, "log_level", &log_level, preset_log_level);
-	get_config_string(&cfg, "broker", &mqtt_broker, preset_mqtt_broker, false);
-	get_config_int(&cfg, "port", &port, preset_port);
-	get_config_string(&cfg, "broker_user", &broker_user, preset_broker_user, false);
-	get_config_string(&cfg, "broker_password", &broker_password, preset_broker_password, false);
-	get_config_int(&cfg, "shutdown_delay", &shutdown_delay, preset_shutdown_delay);
-	get_config_int(&cfg, "stat_interval", &stat_interval, preset_stat_interval);
-	get_config_string(&cfg, "stat_pub_topic", &stat_pub_topic, preset_stat_pub_topic, true);
-	get_config_string(&cfg, "stat_pub_message", &stat_pub_message, preset_stat_pub_message, false);
-	get_config_int(&cfg, "tele_interval", &tele_interval, preset_tele_interval);
-	get_config_string(&cfg, "tele_pub_topic", &tele_pub_topic, preset_tele_pub_topic, true);
-	get_config_string(&cfg, "tele_pub_message", &tele_pub_message, preset_tele_pub_message, false);
+	value->type = VALUE_DOUBLE;
+	switch (tag->kind)
+	{
+	case WINDOW_MIN:
+		value->d = tag->window.min;
+		break;
+	case WINDOW_MAX:
+		value->d = tag->window.max;
+		break;
+	case WINDOW_AVG:
+		value->d = tag->window.sum / tag->window.count;
+		break;
+	case WINDOW_QUANTILE:
+		value->d = window_quantile(&tag->window, tag->quantile);
+		break;
+	}
+}
 
-	get_config_string(&cfg, "pub_terminate_message", &pub_terminate_message, preset_pub_terminate_message, true);
-	get_config_string(&cfg, "last_will_topic", &last_will_topic, preset_last_will_topic, true);
-	get_config_string(&cfg, "last_will_message", &last_will_message, preset_last_will_message, false);
+/*******************************************/ /**
+ * @brief Start new windows for the window tags of a published
+ *        job
+ * 
+ * @param job - The publish job
+ ***********************************************/
+void reset_job_windows(publish_job_t *job)
+{
+	for (size_t i = 0; i < job->tmpl.token_count; i++)
+	{
+		if (job->tmpl.tokens[i].op == TAG_WINDOW)
+		{
+			window_reset(&window_tags[job->tmpl.tokens[i].arg].window);
+		}
+	}
+}
 
-	get_config_string(&cfg, "sub_topic", &sub_topic, preset_sub_topic, true);
-	get_config_int(&cfg, "QoS", &qos, preset_qos);
+/*******************************************/ /**
+ * @brief Take a sample of the collectors of the window tags
+ *        and add it to the windows. The sample reads the runs
+ *        started by the sample before and starts the next ones,
+ *        so it does not wait for them.
+ ***********************************************/
+void sample_windows()
+{
+	uint64_t now = monotonic_ns();
 
-	// mosquitto_pub_topic_check
-	// mosquitto_sub_topic_check
+	// failures are logged by the sample of the publish, the
+	// deltas of the CPU tags of the publish are kept
+	metrics_sample(&window_metrics, window_collectors, METRICS_WINDOW, window_since);
 
-	config_destroy(&cfg);
+	for (int i = 0; i < window_tag_count; i++)
+	{
+		metric_value_t sample;
+		tag_value(&window_tags[i].sample, &window_metrics, &sample);
+		if (sample.type == VALUE_INT)
+		{
+			window_add(&window_tags[i].window, sample.i);
+		}
+		else if (sample.type == VALUE_DOUBLE)
+		{
+			window_add(&window_tags[i].window, sample.d);
+		}
+	}
 
-	return EXIT_SUCCESS;
+	window_since = now;
+	metrics_start(window_collectors, METRICS_WINDOW, now);
 }
 
 /*******************************************/ /**
- * @brief Discard all settings and give free allocated memory
+ * @brief Get the value of a dynamic tag from a snapshot
+ * 
+ * @param token - The tag token
+ * @param snapshot - The metrics snapshot
+ * @param value - Stores the typed value
  ***********************************************/
-void discard_free_config()
+void tag_value(const template_token_t *token, const metrics_t *snapshot, metric_value_t *value)
 {
-	free(stat_pub_topic); stat_pub_topic = NULL;
-	free(tele_pub_topic); tele_pub_topic = NULL;
-	free(pub_parsed); pub_parsed = NULL;
-	free(sub_topic); sub_topic = NULL;
-	free(last_will_topic); last_will_topic = NULL;
-	free(last_will_message); last_will_message = NULL;
-	free(pub_terminate_message); pub_terminate_message = NULL;
-	free(mqtt_broker); mqtt_broker = NULL;
+	value->type = VALUE_INT;
+
+	switch (token->op)
+	{
+	case TAG_STATUS:
+		value->type = VALUE_TEXT;
+		value->text = status ? status_on_string : status_off_string;
+		break;
+	case TAG_LOADAVG_1:
+		value->i = snapshot->loadavg_1;
+		break;
+	case TAG_UPTIME:
+		value->i = snapshot->uptime;
+		break;
+	case TAG_RAMFREE:
+		value->i = snapshot->ramfree;
+		break;
+	case TAG_DISKFREE_MB:
+		value->i = snapshot->diskfree_mb;
+		break;
+	case TAG_SERVICE:
+		value->text = service_state(token->arg);
+		value->type = value->text ? VALUE_TEXT : VALUE_NONE;
+		break;
+	case TAG_CGROUP:
+		if (! metrics_readable(snapshot, COLLECT_CGROUP))
+		{
+			value->type = VALUE_NONE;
+		}
+		else
+		{
+			cgroup_value(token->arg, value);
+		}
+		break;
+	case TAG_PSI:
+		if (! metrics_readable(snapshot, COLLECT_PSI))
+		{
+			value->type = VALUE_NONE;
+		}
+		else
+		{
+			psi_value(token->arg, value);
+		}
+		break;
+	case TAG_PSI_ALERT:
+		value->type = VALUE_TEXT;
+		value->text = psi_alert();
+		break;
+	case TAG_BATCH_MESSAGES:
+	case TAG_BATCH_WRITES:
+	case TAG_BATCH_PACKETS:
+		value->i = (token->op == TAG_BATCH_MESSAGES) ? batch_stats.messages :
+				(token->op == TAG_BATCH_WRITES) ? batch_stats.writes : batch_stats.packets;
+		if (value->i < 0)
+		{
+			value->type = VALUE_NONE;
+		}
+		break;
+	case TAG_STALE:
+		value->type = VALUE_TEXT;
+		value->text = snapshot->stale_names;
+		break;
+	case TAG_PROCFS:
+		if ((! metrics_readable(snapshot, COLLECT_PROCFS)) || procfs_value(token->arg, &value->i))
+		{
+			value->type = VALUE_NONE;
+		}
+		break;
+	case TAG_CPU_USAGE:
+	case TAG_CPU_CORES:
+	case TAG_CPU_CORE_MIN:
+	case TAG_CPU_CORE_MAX:
+	case TAG_CPU_CORE_MEAN:
+	case TAG_CPU_CORE_P95:
+	case TAG_CPU_BUSIEST:
+		cpu_value(token->op, metrics_readable(snapshot, COLLECT_CPUSTAT) ? snapshot->cpu : NULL, value);
+		break;
+	case TAG_RATE:
+	{
+		rate_tag_t *tag = &rate_tags[token->arg];
+		metric_value_t counter;
+		tag_value(&tag->counter, snapshot, &counter);
+		uint64_t time = (uint64_t)snapshot->time.tv_sec * 1000000000 + snapshot->time.tv_nsec;
+		value->type = ( (counter.type == VALUE_INT) && 
+				(! rate_sample(&tag->rate, counter.i, time, &value->d)) ) ? VALUE_DOUBLE : VALUE_NONE;
+		break;
+	}
+	case TAG_WINDOW:
+		window_value(&window_tags[token->arg], snapshot, value);
+		break;
+	case TAG_MOUNT_TOTAL_MB:
+	case TAG_MOUNT_FREE_MB:
+	case TAG_MOUNT_AVAIL_MB:
+	case TAG_MOUNT_USED_PCT:
+		mount_value(token->op, metrics_readable(snapshot, COLLECT_MOUNTS) ? mounts_get(token->arg) : NULL, value);
+		break;
+	case TAG_COMPRESS_IN:
+	case TAG_COMPRESS_OUT:
+	case TAG_COMPRESS_RATIO:
+	case TAG_COMPRESS_US:
+		// a constant string has no job, see evaluate_job()
+		compress_value(token->op, NULL, value);
+		break;
+	case TAG_MOUNTS:
+	case TAG_MOUNTS_AVAIL_MB:
+	case TAG_MOUNTS_STALE:
+		if (! metrics_readable(snapshot, COLLECT_MOUNTS))
+		{
+			value->type = VALUE_NONE;
+		}
+		else if (token->op == TAG_MOUNTS)
+		{
+			value->type = VALUE_TEXT;
+			value->text = mounts_summary();
+		}
+		else
+		{
+			value->i = (token->op == TAG_MOUNTS_AVAIL_MB) ? (long long)mounts_avail_mb() : mounts_stale();
+		}
+		break;
+	default:
+		value->type = VALUE_NONE;
+		break;
+	}
 }
 
-/********************************************//**
- * @brief Init the mosquitto libraryconnection to MQTT broker
+/*******************************************/ /**
+ * @brief Get the value of a CPU tag from the summary
+ * 
+ * @param op - The opcode of the tag
+ * @param cpu - The summary, NULL before the second sample
+ * @param value - Stores the typed value
  ***********************************************/
-void init_mosquitto()
+void cpu_value(int op, const cpustat_summary_t *cpu, metric_value_t *value)
 {
-	int major, minor, revision;
-
-	// Print version of libmosquitto
-	mosquitto_lib_version(&major, &minor, &revision);
-	LOG(6, "<%d>Mosquitto Version : %d.%d.%d\n", major, minor, revision);
-
-	// Init Mosquitto Client, required for use libmosquitto
-	mosquitto_lib_init();
+	if (! cpu)
+	{
+		value->type = VALUE_NONE;
+		return;
+	}
 
-	// Create a new client instance.
-	mosq = mosquitto_new(NULL, true, NULL);
-	if (!mosq)
+	value->type = VALUE_DOUBLE;
+	switch (op)
+	{
+	case TAG_CPU_USAGE:
+		value->d = cpu->total;
+		break;
+	case TAG_CPU_CORES:
+		value->type = VALUE_INT;
+		value->i = cpu->cores;
+		break;
+	case TAG_CPU_CORE_MIN:
+		value->d = cpu->min;
+		break;
+	case TAG_CPU_CORE_MAX:
+		value->d = cpu->max;
+		break;
+	case TAG_CPU_CORE_MEAN:
+		value->d = cpu->mean;
+		break;
+	case TAG_CPU_CORE_P95:
+		value->d = cpu->p95;
+		break;
+	case TAG_CPU_BUSIEST:
+		value->type = VALUE_TEXT;
+		value->text = cpu->busiest;
+		break;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the value of a compression tag of a job, the 
+ *        totals of its payloads compressed so far
+ * 
+ * @param op - The opcode of the tag
+ * @param job - The publish job, NULL outside of a job
+ * @param value - Stores the typed value
+ ***********************************************/
+void compress_value(int op, const publish_job_t *job, metric_value_t *value)
+{
+	if ((! job) || (! job->bytes_in))
+	{
+		value->type = VALUE_NONE;
+		return;
+	}
+
+	value->type = VALUE_INT;
+	switch (op)
+	{
+	case TAG_COMPRESS_IN:
+		value->i = job->bytes_in;
+		break;
+	case TAG_COMPRESS_OUT:
+		value->i = job->bytes_out;
+		break;
+	case TAG_COMPRESS_RATIO:
+		value->type = VALUE_DOUBLE;
+		value->d = (double)job->bytes_out * 100 / job->bytes_in;
+		break;
+	case TAG_COMPRESS_US:
+		value->i = job->compress_ns / 1000;
+		break;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the value of a tag of a single mount
+ * 
+ * @param op - The opcode of the tag
+ * @param stat - The space of the mount, NULL if not available
+ * @param value - Stores the typed value
+ ***********************************************/
+void mount_value(int op, const mount_stat_t *stat, metric_value_t *value)
+{
+	if (! stat)
+	{
+		value->type = VALUE_NONE;
+		return;
+	}
+
+	value->type = VALUE_INT;
+	switch (op)
+	{
+	case TAG_MOUNT_TOTAL_MB:
+		value->i = stat->total_mb;
+		break;
+	case TAG_MOUNT_FREE_MB:
+		value->i = stat->free_mb;
+		break;
+	case TAG_MOUNT_AVAIL_MB:
+		value->i = stat->avail_mb;
+		break;
+	case TAG_MOUNT_USED_PCT:
+		value->type = VALUE_DOUBLE;
+		value->d = stat->used_pct;
+		break;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Write a typed value as text
+ * 
+ * @param value - The value
+ * @param dst - Destination, space for 'size' bytes
+ * @param size - Max. count of bytes to write
+ * @return size_t - Count of written bytes
+ ***********************************************/
+size_t format_value(const metric_value_t *value, char *dst, size_t size)
+{
+	switch (value->type)
+	{
+	case VALUE_INT:
+		return template_format_int(dst, value->i);
+	case VALUE_DOUBLE:
+	{
+		char number[TAG_VALUE_SIZE];
+		size_t length = snprintf(number, sizeof(number), "%.2f", value->d);
+		length = (length < size) ? length : size;
+		memcpy(dst, number, length);
+		return length;
+	}
+	case VALUE_TEXT:
+	{
+		size_t length = strnlen(value->text, size);
+		memcpy(dst, value->text, length);
+		return length;
+	}
+	default:
+		return 0;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Write the value of a dynamic tag on rendering a template
+ * 
+ * @param token - The tag token
+ * @param dst - Destination, space for 'token->length' bytes
+ * @param ctx - The metrics_t snapshot to read the values from
+ * @return size_t - Count of written bytes
+ ***********************************************/
+size_t format_tag(const template_token_t *token, char *dst, void *ctx)
+{
+	metric_value_t value;
+	tag_value(token, ctx, &value);
+	return format_value(&value, dst, token->length);
+}
+
+/*******************************************/ /**
+ * @brief Write the next of the values evaluated before, the 
+ *        tags are rendered in the order of the values
+ * 
+ * @param token - The tag token
+ * @param dst - Destination, space for 'token->length' bytes
+ * @param ctx - Pointer to the pointer of the next value
+ * @return size_t - Count of written bytes
+ ***********************************************/
+size_t format_next_value(const template_token_t *token, char *dst, void *ctx)
+{
+	const metric_value_t **next = ctx;
+	return format_value((*next)++, dst, token->length);
+}
+
+/*******************************************/ /**
+ * @brief Take the snapshot of the metrics for the current tick
+ *        without waiting for the collectors
+ * 
+ * @param collectors - Collectors referenced by the templates to render
+ * @param since - Start of the collectors, a older value is stale
+ ***********************************************/
+void sample_metrics(uint32_t collectors, uint64_t since)
+{
+	uint32_t failed = metrics_sample(&metrics, collectors, METRICS_PUBLISH, since);
+	if (failed & COLLECT_STATVFS)
+	{
+		LOG(3, "<%d>Error : Get file system info!\n");
+	}
+	if (failed & COLLECT_SYSINFO)
+	{
+		LOG(3, "<%d>Error : Get system info!\n");
+	}
+	if (failed & COLLECT_SERVICES)
+	{
+		LOG(4, "<%d>Error : Query of service states failed : %s\n", strerror(errno));
+	}
+	if (metrics.stale)
+	{
+		LOG(5, "<%d>Collector(s) not done in %d ms : %s\n", collector_timeout_ms, metrics.stale_names);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Run the collectors and wait for them, then take the 
+ *        snapshot. Only for the start and the exit, it blocks 
+ *        up to 'collector_timeout_ms' twice.
+ * 
+ * @param collectors - Collectors referenced by the templates to render
+ ***********************************************/
+void collect_metrics(uint32_t collectors)
+{
+	// a pending run started before and is not taken as the new one
+	metrics_wait(collectors);
+
+	uint64_t since = monotonic_ns();
+	metrics_start(collectors, METRICS_PUBLISH, since);
+	metrics_wait(collectors);
+	sample_metrics(collectors, since);
+}
+
+/*******************************************/ /**
+ * @brief Compile a template, on error the program is terminated
+ * 
+ * @param tmpl - Template to fill
+ * @param src_string - The template text
+ * @param collectors - Stores the collectors referenced by the template
+ ***********************************************/
+void compile_template(template_t *tmpl, const char *src_string, uint32_t *collectors)
+{
+	*collectors = 0;
+	if (template_compile(tmpl, src_string, resolve_tag, collectors))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Allocate or reallocate memory to store a string. The 
+ * returnet pointer must be freeing ( free(char*) ).
+ * 
+ * @param dst_string - Pointer to destination string to reuse the memory 
+ *                     or NULL to use new allocated memory.
+ * @param src_string - Pointer to given incoming string
+ * @return char* - Pointer to destination string
+ ***********************************************/
+char *alloc_string(char *dst_string, const char *src_string)
+{
+	size_t length = strlen(src_string) + 1;
+	if (! (dst_string = realloc(dst_string, length)))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	memcpy(dst_string, src_string, length);
+
+	return dst_string;
+}
+
+/*******************************************/ /**
+ * @brief Replace the tags of a string once with the values at 
+ *        this time. The returnet pointer must be freeing ( free(char*) ).
+ * 
+ * @param dst_string - Pointer to destination string to reuse the memory 
+ *                     or NULL to use new allocated memory.
+ * @param src_string - Pointer to given incoming string
+ * @return char* - Pointer to destination string
+ ***********************************************/
+char *render_constant(char *dst_string, const char *src_string)
+{
+	template_t tmpl;
+	uint32_t collectors;
+
+	compile_template(&tmpl, src_string, &collectors);
+	collect_metrics(collectors);
+	dst_string = alloc_string(dst_string, template_render(&tmpl, format_tag, &metrics, NULL));
+	template_free(&tmpl);
+
+	return dst_string;
+}
+
+/*******************************************/ /**
+ * @brief Add a publish job, it publishes on each tick
+ * 
+ * @param topic - Topic, the tags are already replaced
+ * @param message - Message template
+ * @param interval - Interval in seconds, ZERO is not scheduled
+ * @param job_qos - Quality of Service
+ * @param retain - Retain flag of the messages
+ * @return publish_job_t* - The new job
+ ***********************************************/
+publish_job_t *add_job(const char *topic, const char *message, int interval, int job_qos, bool retain)
+{
+	publish_job_t *new_jobs = realloc(jobs, (job_count + 1) * sizeof(publish_job_t));
+	int *new_due_jobs = realloc(due_jobs, (job_count + 1) * sizeof(int));
+	if (new_jobs)
+	{
+		jobs = new_jobs;
+	}
+	if (new_due_jobs)
+	{
+		due_jobs = new_due_jobs;
+	}
+	if ((! new_jobs) || (! new_due_jobs))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+
+	publish_job_t *job = &jobs[job_count++];
+	memset(job, 0, sizeof(*job));
+	job->topic = alloc_string(NULL, topic);
+	job->message = alloc_string(NULL, message);
+	compile_template(&job->tmpl, job->message, &job->collectors);
+	job->interval = interval;
+	job->qos = job_qos;
+	job->retain = retain;
+	job->expiry = (message_expiry < 0) ? 2 * interval : message_expiry;
+
+	for (size_t i = 0; i < job->tmpl.token_count; i++)
+	{
+		if (job->tmpl.tokens[i].op != TEMPLATE_OP_LITERAL)
+		{
+			job->value_count++;
+		}
+	}
+	if ( (! (job->values = calloc(job->value_count + 1, sizeof(metric_value_t)))) ||
+			policy_init(&job->policy, POLICY_ALWAYS, 0, 0, 0, job->value_count) )
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+
+	return job;
+}
+
+/*******************************************/ /**
+ * @brief Set the payload format of a job. A binary format 
+ *        publishes the dynamic tags of the message as map of 
+ *        the tag names to the values, the text around the tags
+ *        is not used.
+ * 
+ * @param job - The publish job
+ * @param name - Name of the format, see payload_format()
+ * @return int - ZERO at successfully, otherwise -1
+ ***********************************************/
+int set_job_format(publish_job_t *job, const char *name)
+{
+	int format = payload_format(name);
+	if (format < 0)
+	{
+		return -1;
+	}
+
+	free(job->payload);
+	job->payload = NULL;
+	job->payload_size = 0;
+	job->format = format;
+	if (format == PAYLOAD_TEXT)
+	{
+		return 0;
+	}
+
+	// Size for the worst case, so encoding needs no checks
+	size_t size = ENCODE_HEADER_SIZE;
+	for (size_t i = 0; i < job->tmpl.token_count; i++)
+	{
+		const template_token_t *token = &job->tmpl.tokens[i];
+		if (token->op != TEMPLATE_OP_LITERAL)
+		{
+			size += 2 * ENCODE_HEADER_SIZE + strlen(template_tag_name(&job->tmpl, token)) + token->length;
+		}
+	}
+	if (! (job->payload = malloc(size)))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	job->payload_size = size;
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Set the compression of a job, must be called after
+ *        set_job_format()
+ * 
+ * @param job - The publish job
+ * @param name - Name of the algorithm, see compress_algo()
+ * @param threshold - Compress payloads of at least this bytes
+ * @return int - ZERO at successfully, otherwise -1
+ ***********************************************/
+int set_job_compression(publish_job_t *job, const char *name, int threshold)
+{
+	int algo = compress_algo(name);
+	if (algo < 0)
+	{
+		return -1;
+	}
+
+	free(job->compressed);
+	job->compressed = NULL;
+	job->compressed_size = 0;
+	job->compression = algo;
+	job->compress_threshold = threshold;
+	if (algo == COMPRESS_NONE)
+	{
+		return 0;
+	}
+
+	size_t max_length = (job->format == PAYLOAD_TEXT) ? job->tmpl.buffer_size : job->payload_size;
+	job->compressed_size = compress_bound(algo, max_length);
+	if (! (job->compressed = malloc(job->compressed_size)))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Set the watch sources that publish a job at once,
+ *        unknown or not available sources are logged and ignored
+ * 
+ * @param job - The publish job
+ * @param list - Comma separated sources, see watch.h
+ * @param debounce_ms - Delay to coalesce the events
+ * @param holdoff_ms - Min. time between two triggered publishes
+ ***********************************************/
+void set_job_trigger(publish_job_t *job, const char *list, int debounce_ms, int holdoff_ms)
+{
+	job->triggers = 0;
+	job->debounce_ns = (uint64_t)debounce_ms * 1000000;
+	job->holdoff_ns = (uint64_t)holdoff_ms * 1000000;
+
+	while (*list)
+	{
+		list += strspn(list, " ");
+		size_t length = strcspn(list, ",");
+		size_t name_length = length;
+		while (name_length && (list[name_length - 1] == ' '))
+		{
+			name_length--;
+		}
+		if (name_length)
+		{
+			uint32_t source = watch_register(list, name_length);
+			if (! source)
+			{
+				LOG(4, "<%d>WARNING : Trigger '%.*s' of %s not available : %s\n", 
+						(int)name_length, list, job->topic, strerror(errno));
+			}
+			job->triggers |= source;
+		}
+		list += length;
+		list += (*list == ',');
+	}
+}
+
+/*******************************************/ /**
+ * @brief Register the PSI triggers, invalid or not available
+ *        triggers are logged and ignored
+ * 
+ * @param list - Comma separated triggers, see psi.h
+ ***********************************************/
+void set_psi_triggers(const char *list)
+{
+	while (*list)
+	{
+		list += strspn(list, " ");
+		size_t length = strcspn(list, ",");
+		size_t spec_length = length;
+		while (spec_length && (list[spec_length - 1] == ' '))
+		{
+			spec_length--;
+		}
+		if (spec_length && (psi_trigger(list, spec_length) < 0))
+		{
+			LOG(4, "<%d>WARNING : PSI trigger '%.*s' not available : %s\n", 
+					(int)spec_length, list, strerror(errno));
+		}
+		list += length;
+		list += (*list == ',');
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the values of the dynamic tags of a job from
+ *        the metrics snapshot, the compression tags from the
+ *        job itself
+ * 
+ * @param job - The publish job
+ ***********************************************/
+void evaluate_job(publish_job_t *job)
+{
+	metric_value_t *value = job->values;
+
+	for (size_t i = 0; i < job->tmpl.token_count; i++)
+	{
+		const template_token_t *token = &job->tmpl.tokens[i];
+		if ((token->op >= TAG_COMPRESS_IN) && (token->op <= TAG_COMPRESS_US))
+		{
+			compress_value(token->op, job, value++);
+		}
+		else if (token->op != TEMPLATE_OP_LITERAL)
+		{
+			tag_value(token, &metrics, value++);
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Render the message of a job with the values of the 
+ *        last evaluate_job() in the payload format and the 
+ *        compression of the job
+ * 
+ * @param job - The publish job
+ * @param length - Stores the length of the message
+ * @return const char* - The message
+ ***********************************************/
+const char *render_job(publish_job_t *job, size_t *length)
+{
+	if (job->format == PAYLOAD_TEXT)
+	{
+		const metric_value_t *next = job->values;
+		return compress_job(job, template_render(&job->tmpl, format_next_value, &next, length), length);
+	}
+
+	uint8_t *dst = job->payload;
+	const metric_value_t *value = job->values;
+
+	dst += encode_map(dst, job->format, job->value_count);
+	for (size_t i = 0; i < job->tmpl.token_count; i++)
+	{
+		const template_token_t *token = &job->tmpl.tokens[i];
+		if (token->op != TEMPLATE_OP_LITERAL)
+		{
+			const char *name = template_tag_name(&job->tmpl, token);
+			dst += encode_text(dst, job->format, name, strlen(name));
+			dst += encode_value(dst, job->format, value++, token->length);
+		}
+	}
+
+	*length = dst - job->payload;
+	return compress_job(job, (const char *)job->payload, length);
+}
+
+/*******************************************/ /**
+ * @brief Compress a rendered payload if the job has a compression 
+ *        and the payload reaches the threshold. The payload is 
+ *        kept if the compressed one is not shorter.
+ * 
+ * @param job - The publish job
+ * @param payload - The rendered payload
+ * @param length - Length of the payload, updated to the result
+ * @return const char* - The payload to publish
+ ***********************************************/
+const char *compress_job(publish_job_t *job, const char *payload, size_t *length)
+{
+	if ((job->compression == COMPRESS_NONE) || (*length < job->compress_threshold))
+	{
+		return payload;
+	}
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+	long result = compress_payload(&compressor, job->compression, payload, *length, 
+			job->compressed, job->compressed_size);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	if (result < 0)
+	{
+		LOG(4, "<%d>Compress %s failed : %s\n", job->topic, strerror(errno));
+		return payload;
+	}
+
+	uint64_t cpu_ns = (end.tv_sec - begin.tv_sec) * 1000000000LL + (end.tv_nsec - begin.tv_nsec);
+	job->bytes_in += *length;
+	job->bytes_out += ((size_t)result < *length) ? (size_t)result : *length;
+	job->compress_ns += cpu_ns;
+	LOG(6, "<%d>Compress %s : %zu -> %ld bytes in %llu us, total %llu %% in %llu us\n", 
+			job->topic, *length, result, (unsigned long long)cpu_ns / 1000,
+			(unsigned long long)(job->bytes_out * 100 / job->bytes_in), 
+			(unsigned long long)job->compress_ns / 1000);
+
+	if ((size_t)result >= *length)
+	{
+		return payload;
+	}
+	*length = result;
+	return (const char *)job->compressed;
+}
+
+/*******************************************/ /**
+ * @brief Get the MQTT v5 topic alias of a job. Each job gets
+ *        its own as long as the broker accepts them. A QoS 1/2 
+ *        message can be resent after a reconnect, there the 
+ *        alias is unknown, so only QoS 0 jobs use one.
+ * 
+ * @param job - The publish job
+ * @return int - The alias, ZERO if none
+ ***********************************************/
+int job_alias(const publish_job_t *job)
+{
+	int alias = job - jobs + 1;
+	return ((job->qos == QOS_MOST_ONCE_DELIVERY) && (alias <= topic_alias_max)) ? alias : 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the MQTT v5 content type of a job
+ * 
+ * @param job - The publish job
+ * @param compressed - TRUE for a compressed payload
+ * @param utf8 - Stores TRUE if the payload is UTF-8 text
+ * @return const char* - The content type, empty if none
+ ***********************************************/
+const char *job_content_type(const publish_job_t *job, bool compressed, bool *utf8)
+{
+	*utf8 = false;
+	if (job->content_type)
+	{
+		*utf8 = (! compressed) && (job->format == PAYLOAD_TEXT);
+		return job->content_type;
+	}
+	if (compressed)
+	{
+		return (job->compression == COMPRESS_ZSTD) ? "application/zstd" : "application/zlib";
+	}
+	switch (job->format)
+	{
+	case PAYLOAD_CBOR:
+		return "application/cbor";
+	case PAYLOAD_MSGPACK:
+		return "application/msgpack";
+	default:
+		*utf8 = true;
+		return ((*job->message == '{') || (*job->message == '[')) ? "application/json" : "text/plain";
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the MQTT v5 properties of a publish, they are 
+ *        built on the first publish after the connect
+ * 
+ * @param job - The publish job
+ * @param compressed - TRUE for a compressed payload
+ * @return const mosquitto_property* - The properties
+ ***********************************************/
+const mosquitto_property *job_properties(publish_job_t *job, bool compressed)
+{
+	mosquitto_property **properties = &job->properties[compressed];
+	if (*properties)
+	{
+		return *properties;
+	}
+
+	bool utf8;
+	const char *content_type = job_content_type(job, compressed, &utf8);
+	int alias = job_alias(job);
+	int err = 0;
+	if (*content_type)
+	{
+		err |= mosquitto_property_add_string(properties, MQTT_PROP_CONTENT_TYPE, content_type);
+	}
+	if (utf8)
+	{
+		err |= mosquitto_property_add_byte(properties, MQTT_PROP_PAYLOAD_FORMAT_INDICATOR, 1);
+	}
+	if (job->expiry > 0)
+	{
+		err |= mosquitto_property_add_int32(properties, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, job->expiry);
+	}
+	if (alias)
+	{
+		err |= mosquitto_property_add_int16(properties, MQTT_PROP_TOPIC_ALIAS, alias);
+	}
+	if (err)
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	return *properties;
+}
+
+/*******************************************/ /**
+ * @brief Forget the MQTT v5 properties and topic aliases of 
+ *        all jobs, a new connection starts without aliases
+ ***********************************************/
+void reset_job_properties()
+{
+	for (int i = 0; i < job_count; i++)
+	{
+		mosquitto_property_free_all(&jobs[i].properties[0]);
+		mosquitto_property_free_all(&jobs[i].properties[1]);
+		jobs[i].alias_sent = false;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Read the policy of a job and set it. The settings are
+ *        'policy', 'deadband_abs', 'deadband_rel' and 
+ *        'refresh_interval' after a prefix, e.g. 'tele_policy'
+ *        of the telemetry message. A unknown policy is logged 
+ *        and 'always' is used.
+ * 
+ * @param job - The publish job
+ * @param group - Group of the settings, a entry of 'jobs' or the 
+ *                root of the file
+ * @param prefix - Prefix of the names of the settings
+ ***********************************************/
+void read_job_policy(publish_job_t *job, const config_setting_t *group, const char *prefix)
+{
+	const char *policy_name = "always";
+	double deadband_abs = 0;
+	double deadband_rel = 0;
+	int refresh = preset_refresh_interval;
+	char name[32];
+
+	snprintf(name, sizeof(name), "%spolicy", prefix);
+	config_setting_lookup_string(group, name, &policy_name);
+	snprintf(name, sizeof(name), "%sdeadband_abs", prefix);
+	config_setting_lookup_float(group, name, &deadband_abs);
+	snprintf(name, sizeof(name), "%sdeadband_rel", prefix);
+	config_setting_lookup_float(group, name, &deadband_rel);
+	snprintf(name, sizeof(name), "%srefresh_interval", prefix);
+	config_setting_lookup_int(group, name, &refresh);
+
+	int mode = policy_mode(policy_name);
+	if (mode < 0)
+	{
+		LOG(4, "<%d>WARNING : Job %s has unknown policy '%s', use 'always'\n", job->topic, policy_name);
+		mode = POLICY_ALWAYS;
+	}
+	policy_free(&job->policy);
+	if (policy_init(&job->policy, mode, deadband_abs, deadband_rel, 
+			(uint64_t)refresh * 1000000000, job->value_count))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Read the list 'jobs' of the config file. Each entry
+ *        is a group with the settings 'topic', 'message', 
+ *        'interval', 'QoS' and 'retain'.
+ * 
+ * @param config - The config file
+ * @return int - Count of read jobs
+ ***********************************************/
+int read_jobs(const config_t *config)
+{
+	config_setting_t *list = config_lookup(config, "jobs");
+	if (! list)
+	{
+		return 0;
+	}
+
+	int count = config_setting_length(list);
+	for (int i = 0; i < count; i++)
+	{
+		config_setting_t *entry = config_setting_get_elem(list, i);
+		const char *topic = NULL;
+		const char *message = NULL;
+		int interval = 0;
+		int job_qos = qos;
+		int retain = false;
+		const char *format_name = "text";
+		const char *compression_name = "none";
+		int threshold = compress_threshold;
+		const char *trigger = "";
+		int debounce = trigger_debounce_ms;
+		int holdoff = trigger_holdoff_ms;
+		const char *content_type = NULL;
+		int expiry = -1;
+		int in_envelope = false;
+
+		if ( (! config_setting_lookup_string(entry, "topic", &topic)) ||
+				(! config_setting_lookup_string(entry, "message", &message)) ||
+				(! config_setting_lookup_int(entry, "interval", &interval)) )
+		{
+			LOG(4, "<%d>WARNING : Job %d needs topic, message and interval, ignored\n", i);
+			continue;
+		}
+		config_setting_lookup_int(entry, "QoS", &job_qos);
+		config_setting_lookup_bool(entry, "retain", &retain);
+		config_setting_lookup_string(entry, "format", &format_name);
+		config_setting_lookup_string(entry, "compression", &compression_name);
+		config_setting_lookup_int(entry, "compress_threshold", &threshold);
+		config_setting_lookup_string(entry, "trigger", &trigger);
+		config_setting_lookup_int(entry, "debounce_ms", &debounce);
+		config_setting_lookup_int(entry, "holdoff_ms", &holdoff);
+		config_setting_lookup_string(entry, "content_type", &content_type);
+		config_setting_lookup_int(entry, "expiry", &expiry);
+		config_setting_lookup_bool(entry, "envelope", &in_envelope);
+
+		char *job_topic = render_constant(NULL, topic);
+		publish_job_t *job = add_job(job_topic, message, interval, job_qos, retain);
+		free(job_topic);
+		read_job_policy(job, entry, "");
+		if (set_job_format(job, format_name))
+		{
+			LOG(4, "<%d>WARNING : Job %d has unknown format '%s', use 'text'\n", i, format_name);
+		}
+		if (set_job_compression(job, compression_name, threshold))
+		{
+			LOG(4, "<%d>WARNING : Job %d has unknown compression '%s', use 'none'\n", i, compression_name);
+		}
+		set_job_trigger(job, trigger, debounce, holdoff);
+		if (content_type)
+		{
+			job->content_type = alloc_string(NULL, content_type);
+		}
+		if (expiry >= 0)
+		{
+			job->expiry = expiry;
+		}
+		if (in_envelope && retain)
+		{
+			LOG(4, "<%d>WARNING : Job %d is retained, not sent in the envelope\n", i);
+		}
+		job->envelope = in_envelope && (! retain);
+		LOG(6, "<%d>Job : %s every %d s\n", job->topic, interval);
+	}
+
+	return count;
+}
+
+/*******************************************/ /**
+ * @brief Exchange the running jobs and the state of their tags
+ *        with a job set. A empty set takes the running jobs 
+ *        aside, the next apply_jobs() builds new ones then.
+ * 
+ * @param set - The job set
+ ***********************************************/
+void swap_jobs(job_set_t *set)
+{
+	job_set_t running = { jobs, due_jobs, job_count, rate_tags, rate_tag_count, 
+			window_tags, window_tag_count, window_collectors, batch_counted };
+
+	jobs = set->jobs;
+	due_jobs = set->due_jobs;
+	job_count = set->job_count;
+	rate_tags = set->rate_tags;
+	rate_tag_count = set->rate_tag_count;
+	window_tags = set->window_tags;
+	window_tag_count = set->window_tag_count;
+	window_collectors = set->window_collectors;
+	batch_counted = set->batch_counted;
+	*set = running;
+}
+
+/*******************************************/ /**
+ * @brief Give free a job set that is not running
+ * 
+ * @param set - The job set
+ ***********************************************/
+void free_job_set(job_set_t *set)
+{
+	for (int i = 0; i < set->job_count; i++)
+	{
+		publish_job_t *job = &set->jobs[i];
+		free(job->topic);
+		free(job->message);
+		free(job->values);
+		free(job->payload);
+		free(job->compressed);
+		template_free(&job->tmpl);
+		policy_free(&job->policy);
+		free(job->content_type);
+		mosquitto_property_free_all(&job->properties[0]);
+		mosquitto_property_free_all(&job->properties[1]);
+	}
+	free(set->jobs);
+	free(set->due_jobs);
+	free(set->rate_tags);
+	free(set->window_tags);
+	memset(set, 0, sizeof(*set));
+}
+
+/*******************************************/ /**
+ * @brief Give free all publish jobs and the state of their tags
+ ***********************************************/
+void free_jobs()
+{
+	job_set_t set = {0};
+	swap_jobs(&set);
+	free_job_set(&set);
+	scheduler_clear(&scheduler);
+}
+
+/*******************************************/ /**
+ * @brief Take the state of the jobs before a reload into the new
+ *        jobs, so a reload does not publish a change-only job or
+ *        restart a rate only because the file is read again. A 
+ *        job keeps its policy state if the topic, the message 
+ *        and the policy are the same.
+ * 
+ * @param previous - The jobs before the reload
+ * @param same_tags - TRUE if the modules are not initialized 
+ *        again, a tag has the same argument then and the rate 
+ *        and window tags keep their state too
+ ***********************************************/
+void keep_job_state(job_set_t *previous, bool same_tags)
+{
+	for (int i = 0; i < job_count; i++)
+	{
+		policy_t *policy = &jobs[i].policy;
+		for (int p = 0; p < previous->job_count; p++)
+		{
+			publish_job_t *old = &previous->jobs[p];
+			if ( (! strcmp(old->topic, jobs[i].topic)) && (! strcmp(old->message, jobs[i].message)) &&
+					(old->policy.mode == policy->mode) && (old->policy.count == policy->count) &&
+					(old->policy.deadband_abs == policy->deadband_abs) &&
+					(old->policy.deadband_rel == policy->deadband_rel) &&
+					(old->policy.refresh == policy->refresh) )
+			{
+				// exchanged, the fresh state is freed with the old job
+				policy_t kept = old->policy;
+				old->policy = *policy;
+				*policy = kept;
+				break;
+			}
+		}
+	}
+
+	if (! same_tags)
+	{
+		return;
+	}
+	for (int i = 0; i < rate_tag_count; i++)
+	{
+		for (int p = 0; p < previous->rate_tag_count; p++)
+		{
+			const rate_tag_t *old = &previous->rate_tags[p];
+			if ((old->counter.op == rate_tags[i].counter.op) && (old->counter.arg == rate_tags[i].counter.arg))
+			{
+				rate_tags[i].rate = old->rate;
+				break;
+			}
+		}
+	}
+	for (int i = 0; i < window_tag_count; i++)
+	{
+		for (int p = 0; p < previous->window_tag_count; p++)
+		{
+			const window_tag_t *old = &previous->window_tags[p];
+			if ( (old->sample.op == window_tags[i].sample.op) && (old->sample.arg == window_tags[i].sample.arg) &&
+					(old->kind == window_tags[i].kind) && (old->quantile == window_tags[i].quantile) )
+			{
+				window_tags[i].window = old->window;
+				break;
+			}
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the config int object
+ * 
+ * @param config - A valid mosquitto instance.
+ * @param name - Name of option in config file.
+ * @param dst_int - Pointer to store the value.
+ * @param default_int - Preseted value if option not found in the file.
+ * @return int - On option succes return 'CONFIG_TRUE'. If the setting was 
+ *             not found or if the type of the value did not match, 
+ *             return CONFIG_FALSE. 
+ ***********************************************/
+int get_config_int(const config_t *config, const char *name, int *dst_int, int default_int)
+{
+	*dst_int = default_int;
+	return config_lookup_int(config, name, dst_int);
+}
+
+/*******************************************/ /**
+ * @brief Get the config string object and allocate memory
+ * 
+ * @param config - A valid mosquitto instance.
+ * @param name - Name of option in config file.
+ * @param dst_string - Pointer to pointer to store the string. For allocate
+ *             new memory the pointer will NULL.
+ * @param src_string - Preseted value if option not found in the file.
+ * @param to_pars - Flag for will replace the tags in the string or not.
+ * @return int - On option succes return 'CONFIG_TRUE'. If the setting was 
+ *             not found or if the type of the value did not match, 
+ *             return CONFIG_FALSE. 
+ ***********************************************/
+int get_config_string(const config_t *config, const char *name, char **dst_string, const char *src_string, bool to_pars)
+{
+	int result = config_lookup_string(config, name, &src_string);
+
+	LOG(6, "<%d>config lookup : %d %s = %s\n", result, name, src_string);
+
+	if (to_pars)
+	{
+		*dst_string = render_constant(*dst_string, src_string);
+		return result;
+	}
+
+	// if found the option "name" in config use it otherwise use the given string
+	*dst_string = alloc_string(*dst_string, src_string);
+
+	return result;
+}
+
+/*******************************************/ /**
+ * @brief Get the config bool object
+ * 
+ * @param config - A valid mosquitto instance.
+ * @param name - Name of option in config file.
+ * @param dst_bool - Pointer to store the value.
+ * @param default_bool - Preseted value if option not found in the file.
+ * @return int - On option succes return 'CONFIG_TRUE'. If the setting was 
+ *             not found or if the type of the value did not match, 
+ *             return CONFIG_FALSE. 
+ ***********************************************/
+int get_config_bool(const config_t *config, const char *name, bool *dst_bool, bool default_bool)
+{
+	int value = default_bool;
+	int result = config_lookup_bool(config, name, &value);
+	*dst_bool = value;
+	return result;
+}
+
+/*******************************************/ /**
+ * @brief Parse the configuration file or create it if it is not 
+ *        available. Nothing of the running config is changed.
+ * 
+ * @param cfg - Stores the parsed file, must be destroyed by 
+ *              config_destroy() on success
+ * @return int - Result, ZERO at successfully, otherwise -1
+ ***********************************************/
+int load_config(config_t *cfg)
+{
+	LOG(6, "<%d>libconfig Version : %d.%d.%d\n", LIBCONFIG_VER_MAJOR, LIBCONFIG_VER_MINOR, LIBCONFIG_VER_REVISION);
+	LOG(6, "<%d>Config file to use : %s\n", config_file_name);
+
+	// check exist the .conf file
+	// Atributes F_OK, R_OK, W_OK, XOK or "OR" linked R_OK|X_OK
+	if (access(config_file_name, F_OK))
+	{
+		FILE *newfile;
+		if ((newfile = fopen(config_file_name, "w+")))
+		{
+			fprintf(newfile, preset_config_file );
+			fclose(newfile);
+			LOG(5, "<%d>Create a new config file\n");
+		}
+		else
+		{
+			LOG(3, "<%d>Can't create a new config file\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	config_init(cfg);
+
+	// Read the file. If there is an error, report it and return.
+	if (!config_read_file(cfg, config_file_name))
+	{
+		LOG(4, "<%d>ERROR : Config file read : (%d) %s @ %s:%d\n",
+				config_error_type(cfg), config_error_text(cfg),
+				config_error_file(cfg), config_error_line(cfg));
+		config_destroy(cfg);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*******************************************/ /**
+ * @brief Compare a setting of two config files
+ * 
+ * @param a - The setting of the one file, NULL if missing
+ * @param b - The setting of the other file, NULL if missing
+ * @return bool - TRUE if both are missing or have the same 
+ *                type and value, the members of a group in 
+ *                any order
+ ***********************************************/
+bool config_setting_equal(const config_setting_t *a, const config_setting_t *b)
+{
+	if ((! a) || (! b))
+	{
+		return a == b;
+	}
+	int type = config_setting_type(a);
+	if (type != config_setting_type(b))
+	{
+		return false;
+	}
+
+	switch (type)
+	{
+	case CONFIG_TYPE_INT:
+		return config_setting_get_int(a) == config_setting_get_int(b);
+	case CONFIG_TYPE_INT64:
+		return config_setting_get_int64(a) == config_setting_get_int64(b);
+	case CONFIG_TYPE_FLOAT:
+		return config_setting_get_float(a) == config_setting_get_float(b);
+	case CONFIG_TYPE_BOOL:
+		return config_setting_get_bool(a) == config_setting_get_bool(b);
+	case CONFIG_TYPE_STRING:
+		return ! strcmp(config_setting_get_string(a), config_setting_get_string(b));
+	}
+
+	// a group, array or list
+	int length = config_setting_length(a);
+	if (length != config_setting_length(b))
+	{
+		return false;
+	}
+	for (int i = 0; i < length; i++)
+	{
+		const config_setting_t *member = config_setting_get_elem(a, i);
+		const config_setting_t *other = (type == CONFIG_TYPE_GROUP) ?
+				config_setting_get_member(b, config_setting_name(member)) : 
+				config_setting_get_elem(b, i);
+		if (! config_setting_equal(member, other))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Check if a section of the config file is changed
+ * 
+ * @param previous - The applied file
+ * @param config - The new file
+ * @param keys - Settings of the section, terminated by NULL
+ * @return bool - TRUE if one of the settings is changed
+ ***********************************************/
+bool section_changed(const config_t *previous, const config_t *config, const char * const *keys)
+{
+	for (; *keys; keys++)
+	{
+		if (! config_setting_equal(config_lookup(previous, *keys), config_lookup(config, *keys)))
+		{
+			LOG(6, "<%d>Setting '%s' changed\n", *keys);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*******************************************/ /**
+ * @brief Check a int setting, a missing one is valid
+ * 
+ * @param setting - The setting or NULL
+ * @param name - Name of the setting for the log
+ * @param min - Smallest valid value
+ * @param max - Biggest valid value
+ * @return bool - TRUE if valid
+ ***********************************************/
+bool valid_int(const config_setting_t *setting, const char *name, int min, int max)
+{
+	if (! setting)
+	{
+		return true;
+	}
+	if (config_setting_type(setting) != CONFIG_TYPE_INT)
+	{
+		LOG(4, "<%d>ERROR : Setting '%s' is not a number\n", name);
+		return false;
+	}
+	int value = config_setting_get_int(setting);
+	if ((value < min) || (value > max))
+	{
+		LOG(4, "<%d>ERROR : Setting '%s' is %d, not %d to %d\n", name, value, min, max);
+		return false;
+	}
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Check a setting with the name of a format, 
+ *        compression or policy, a missing one is valid
+ * 
+ * @param setting - The setting or NULL
+ * @param name - Name of the setting for the log
+ * @param lookup - Gets the number of a name, -1 if unknown
+ * @return bool - TRUE if valid
+ ***********************************************/
+bool valid_name(const config_setting_t *setting, const char *name, int (*lookup)(const char *))
+{
+	if (! setting)
+	{
+		return true;
+	}
+	const char *value = config_setting_get_string(setting);
+	if ((! value) || (lookup(value) < 0))
+	{
+		LOG(4, "<%d>ERROR : Setting '%s' is unknown : %s\n", name, value ? value : "not a string");
+		return false;
+	}
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Check the settings of a config file that apply_config()
+ *        would replace by a default with a warning. A reload 
+ *        does not apply a file with such a mistake.
+ * 
+ * @param config - The parsed file
+ * @return int - ZERO if valid, otherwise -1
+ ***********************************************/
+int validate_config(const config_t *config)
+{
+	bool valid = true;
+
+	valid &= valid_int(config_lookup(config, "port"), "port", 1, 65535);
+	valid &= valid_int(config_lookup(config, "QoS"), "QoS", 0, 2);
+	valid &= valid_int(config_lookup(config, "schedule_spread"), "schedule_spread", 0, 100);
+	valid &= valid_name(config_lookup(config, "stat_policy"), "stat_policy", policy_mode);
+	valid &= valid_name(config_lookup(config, "tele_policy"), "tele_policy", policy_mode);
+	valid &= valid_name(config_lookup(config, "tele_format"), "tele_format", payload_format);
+	valid &= valid_name(config_lookup(config, "tele_compression"), "tele_compression", compress_algo);
+	valid &= valid_name(config_lookup(config, "envelope_format"), "envelope_format", payload_format);
+
+	int version = preset_mqtt_version;
+	if (config_lookup_int(config, "mqtt_version", &version) && (version != 311) && (version != 5))
+	{
+		LOG(4, "<%d>ERROR : Setting 'mqtt_version' is %d, not 311 or 5\n", version);
+		valid = false;
+	}
+
+	const char *envelope_name = NULL;
+	if (config_lookup_string(config, "envelope_format", &envelope_name) && 
+			(payload_format(envelope_name) == PAYLOAD_TEXT))
+	{
+		LOG(4, "<%d>ERROR : Setting 'envelope_format' must be binary\n");
+		valid = false;
+	}
+
+	config_setting_t *list = config_lookup(config, "jobs");
+	int count = list ? config_setting_length(list) : 0;
+	for (int i = 0; i < count; i++)
+	{
+		config_setting_t *entry = config_setting_get_elem(list, i);
+		const char *text = NULL;
+		if ( (config_setting_type(entry) != CONFIG_TYPE_GROUP) ||
+				(! config_setting_lookup_string(entry, "topic", &text)) ||
+				(! config_setting_lookup_string(entry, "message", &text)) ||
+				(! config_setting_get_member(entry, "interval")) )
+		{
+			LOG(4, "<%d>ERROR : Job %d needs topic, message and interval\n", i);
+			valid = false;
+			continue;
+		}
+		valid &= valid_int(config_setting_get_member(entry, "interval"), "interval", 0, INT_MAX);
+		valid &= valid_int(config_setting_get_member(entry, "QoS"), "QoS", 0, 2);
+		valid &= valid_name(config_setting_get_member(entry, "policy"), "policy", policy_mode);
+		valid &= valid_name(config_setting_get_member(entry, "format"), "format", payload_format);
+		valid &= valid_name(config_setting_get_member(entry, "compression"), "compression", compress_algo);
+	}
+
+	return valid ? 0 : -1;
+}
+
+/*******************************************/ /**
+ * @brief Take the plain settings, they are read again on each
+ *        reload and are used on their next use
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_general(const config_t *config)
+{
+	get_config_int(config, "log_level", &log_level, preset_log_level);
+	get_config_int(config, "reconnect_delay_min", &reconnect_delay_min, preset_reconnect_delay_min);
+	get_config_int(config, "reconnect_delay_max", &reconnect_delay_max, preset_reconnect_delay_max);
+	get_config_int(config, "message_expiry", &message_expiry, preset_message_expiry);
+	get_config_int(config, "shutdown_delay", &shutdown_delay, preset_shutdown_delay);
+	get_config_int(config, "shutdown_drain_timeout", &shutdown_drain_timeout, preset_shutdown_drain_timeout);
+	get_config_int(config, "spool_replay_rate", &spool_replay_rate, preset_spool_replay_rate);
+	get_config_int(config, "sample_interval_ms", &sample_interval_ms, preset_sample_interval_ms);
+	get_config_int(config, "schedule_spread", &schedule_spread, preset_schedule_spread);
+	if ((schedule_spread < 0) || (schedule_spread > 100))
+	{
+		LOG(4, "<%d>WARNING : schedule_spread %d is not 0 to 100 %%, use 100\n", schedule_spread);
+		schedule_spread = 100;
+	}
+	get_config_bool(config, "schedule_align", &schedule_align, preset_schedule_align);
+	get_config_bool(config, "batch_cork", &batch_cork, preset_batch_cork);
+}
+
+/*******************************************/ /**
+ * @brief Take the settings of the broker connection, a reload
+ *        compares them by broker_settings_changed()
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_broker(const config_t *config)
+{
+	get_config_string(config, "broker", &mqtt_broker, preset_mqtt_broker, false);
+	get_config_int(config, "port", &port, preset_port);
+	get_config_string(config, "broker_user", &broker_user, preset_broker_user, false);
+	get_config_string(config, "broker_password", &broker_password, preset_broker_password, false);
+	get_config_string(config, "client_id", &client_id, preset_client_id, true);
+	get_config_bool(config, "persistent_session", &persistent_session, preset_persistent_session);
+	get_config_int(config, "mqtt_version", &mqtt_version, preset_mqtt_version);
+	if ((mqtt_version != 311) && (mqtt_version != 5))
+	{
+		LOG(4, "<%d>WARNING : Unknown mqtt_version %d, use 311\n", mqtt_version);
+		mqtt_version = 311;
+	}
+	if ((mqtt_version == 5) && persistent_session)
+	{
+		// libmosquitto has no asynchronous connect with a session expiry interval
+		LOG(4, "<%d>WARNING : persistent_session ends on disconnect with mqtt_version 5\n");
+	}
+	get_config_string(config, "pub_terminate_message", &pub_terminate_message, preset_pub_terminate_message, true);
+	get_config_string(config, "last_will_topic", &last_will_topic, preset_last_will_topic, true);
+	get_config_string(config, "last_will_message", &last_will_message, preset_last_will_message, false);
+}
+
+/*******************************************/ /**
+ * @brief Take the subscription, a reload changes it by 
+ *        update_subscription()
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_subscription(const config_t *config)
+{
+	get_config_string(config, "sub_topic", &sub_topic, preset_sub_topic, true);
+	get_config_int(config, "QoS", &qos, preset_qos);
+}
+
+/*******************************************/ /**
+ * @brief Open the spool file, see 'spool_keys'
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_spool(const config_t *config)
+{
+	get_config_string(config, "spool_file", &spool_file, preset_spool_file, false);
+	get_config_int(config, "spool_size", &spool_size, preset_spool_size);
+	if (strlen(spool_file) > 0)
+	{
+		if (spool_open(&spool, spool_file, (size_t)spool_size * 1024))
+		{
+			LOG(4, "<%d>WARNING : Spool file '%s' not available : %s\n", spool_file, strerror(errno));
+		}
+		else
+		{
+			LOG(6, "<%d>Spool file '%s' with %llu message(s)\n", spool_file, 
+					(unsigned long long)spool_count(&spool));
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Close the spool file
+ ***********************************************/
+void free_spool()
+{
+	spool_close(&spool);
+	free(spool_file); spool_file = NULL;
+}
+
+/*******************************************/ /**
+ * @brief Start the collectors and init their modules, see 
+ *        'collector_keys'
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_collectors(const config_t *config)
+{
+	get_config_string(config, "service_backend", &service_backend, preset_service_backend, false);
+	get_config_string(config, "service_state_file", &service_state_file, preset_service_state_file, false);
+	get_config_int(config, "service_max_age", &service_max_age, preset_service_max_age);
+	if (service_init(service_backend, service_state_file, service_max_age))
+	{
+		LOG(4, "<%d>WARNING : Service backend '%s' not available : %s\n", service_backend, strerror(errno));
+		service_init(preset_service_backend, NULL, service_max_age);
+	}
+
+	get_config_int(config, "collector_threads", &collector_threads, preset_collector_threads);
+	get_config_int(config, "collector_timeout_ms", &collector_timeout_ms, preset_collector_timeout_ms);
+	if (metrics_init(collector_threads, collector_timeout_ms))
+	{
+		LOG(4, "<%d>WARNING : Collector threads not available : %s\n", strerror(errno));
+	}
+
+	get_config_int(config, "cpu_busiest", &cpu_busiest, preset_cpu_busiest);
+	cpustat_init(cpu_busiest);
+
+	get_config_string(config, "cgroup_root", &cgroup_root, preset_cgroup_root, false);
+	if (cgroup_init(cgroup_root))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+
+	get_config_string(config, "mount_fstypes", &mount_fstypes, preset_mount_fstypes, false);
+	get_config_string(config, "mount_paths", &mount_paths, preset_mount_paths, false);
+	get_config_int(config, "mount_timeout_ms", &mount_timeout_ms, preset_mount_timeout_ms);
+	if (mounts_init(mount_fstypes, mount_paths, mount_timeout_ms))
+	{
+		LOG(4, "<%d>WARNING : Mount table not available : %s\n", strerror(errno));
+	}
+
+	get_config_string(config, "psi_triggers", &psi_triggers, preset_psi_triggers, false);
+	set_psi_triggers(psi_triggers);
+}
+
+/*******************************************/ /**
+ * @brief Stop the collectors and free their modules. The 
+ *        watch must be freed before, it uses the units fd of
+ *        the service module.
+ ***********************************************/
+void free_collectors()
+{
+	// the modules of pending collectors are in use by a worker and 
+	// are left as they are, that happens only on exit, a reload waits
+	uint32_t pending = metrics_pending();
+	metrics_free();
+	free(psi_triggers); psi_triggers = NULL;
+	if (! (pending & COLLECT_PSI))
+	{
+		psi_free();
+	}
+	free(service_backend); service_backend = NULL;
+	free(service_state_file); service_state_file = NULL;
+	if (! (pending & COLLECT_SERVICES))
+	{
+		service_free();
+	}
+	if (! (pending & COLLECT_PROCFS))
+	{
+		procfs_free();
+	}
+	if (! (pending & COLLECT_CPUSTAT))
+	{
+		cpustat_free();
+	}
+	free(cgroup_root); cgroup_root = NULL;
+	if (! (pending & COLLECT_CGROUP))
+	{
+		cgroup_free();
+	}
+	free(mount_fstypes); mount_fstypes = NULL;
+	free(mount_paths); mount_paths = NULL;
+	if (! (pending & COLLECT_MOUNTS))
+	{
+		mounts_free();
+	}
+}
+
+/*******************************************/ /**
+ * @brief Init the compressor, see 'compress_keys'
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_compression(const config_t *config)
+{
+	get_config_string(config, "compress_dictionary", &compress_dictionary, preset_compress_dictionary, false);
+	get_config_int(config, "compress_level", &compress_level, preset_compress_level);
+	if (compress_init(&compressor, compress_dictionary, compress_level))
+	{
+		if (! compressor.zlib_ready)
+		{
+			ERROR_EXIT(err_out_of_memory);
+		}
+		LOG(4, "<%d>WARNING : Compress dictionary '%s' not available : %s\n", compress_dictionary, strerror(errno));
+	}
+}
+
+/*******************************************/ /**
+ * @brief Free the compressor
+ ***********************************************/
+void free_compression()
+{
+	free(compress_dictionary); compress_dictionary = NULL;
+	compress_free(&compressor);
+}
+
+/*******************************************/ /**
+ * @brief Build the jobs into the empty running job set, see 
+ *        'job_keys'. The collectors and the compressor must be
+ *        applied before, the templates register their tags in 
+ *        the modules.
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_jobs(const config_t *config)
+{
+	get_config_int(config, "stat_interval", &stat_interval, preset_stat_interval);
+	get_config_string(config, "stat_pub_topic", &stat_pub_topic, preset_stat_pub_topic, true);
+	get_config_string(config, "stat_pub_message", &stat_pub_message, preset_stat_pub_message, false);
+	get_config_int(config, "tele_interval", &tele_interval, preset_tele_interval);
+	get_config_string(config, "tele_pub_topic", &tele_pub_topic, preset_tele_pub_topic, true);
+	get_config_string(config, "tele_pub_message", &tele_pub_message, preset_tele_pub_message, false);
+	get_config_string(config, "tele_format", &tele_format, preset_tele_format, false);
+	get_config_string(config, "tele_compression", &tele_compression, preset_tele_compression, false);
+	get_config_string(config, "stat_trigger", &stat_trigger, preset_stat_trigger, false);
+	get_config_string(config, "tele_trigger", &tele_trigger, preset_tele_trigger, false);
+	get_config_int(config, "trigger_debounce_ms", &trigger_debounce_ms, preset_trigger_debounce_ms);
+	get_config_int(config, "trigger_holdoff_ms", &trigger_holdoff_ms, preset_trigger_holdoff_ms);
+	get_config_string(config, "psi_alert_topic", &psi_alert_topic, preset_psi_alert_topic, true);
+	get_config_string(config, "psi_alert_message", &psi_alert_message, preset_psi_alert_message, false);
+	get_config_string(config, "envelope_topic", &envelope_topic, preset_envelope_topic, true);
+	get_config_string(config, "envelope_format", &envelope_format, preset_envelope_format, false);
+	int format = payload_format(envelope_format);
+	if (format <= PAYLOAD_TEXT)
+	{
+		LOG(4, "<%d>WARNING : Unknown envelope_format '%s', use 'cbor'\n", envelope_format);
+		format = PAYLOAD_CBOR;
+	}
+	envelope_open(&envelope, format);
+	get_config_int(config, "compress_threshold", &compress_threshold, preset_compress_threshold);
+
+	// The status and telemetry messages are the first jobs, 
+	// followed by the list of jobs
+	publish_job_t *stat_job = add_job(stat_pub_topic, stat_pub_message, stat_interval, qos, false);
+	set_job_trigger(stat_job, stat_trigger, trigger_debounce_ms, trigger_holdoff_ms);
+	read_job_policy(stat_job, config_root_setting(config), "stat_");
+	publish_job_t *tele_job = add_job(tele_pub_topic, tele_pub_message, tele_interval, qos, false);
+	set_job_trigger(tele_job, tele_trigger, trigger_debounce_ms, trigger_holdoff_ms);
+	read_job_policy(tele_job, config_root_setting(config), "tele_");
+	if (set_job_format(tele_job, tele_format))
+	{
+		LOG(4, "<%d>WARNING : Unknown tele_format '%s', use 'text'\n", tele_format);
+	}
+	if (set_job_compression(tele_job, tele_compression, compress_threshold))
+	{
+		LOG(4, "<%d>WARNING : Unknown tele_compression '%s', use 'none'\n", tele_compression);
+	}
+	// The alert is published by the PSI triggers only
+	int fds[PSI_MAX_TRIGGERS];
+	if (psi_trigger_fds(fds))
+	{
+		publish_job_t *psi_job = add_job(psi_alert_topic, psi_alert_message, 0, qos, false);
+		set_job_trigger(psi_job, "psi", trigger_debounce_ms, trigger_holdoff_ms);
+	}
+	read_jobs(config);
+}
+
+/*******************************************/ /**
+ * @brief Take the settings of a parsed configuration file, the
+ *        settings before must be discarded by discard_free_config()
+ * 
+ * @param config - The parsed file
+ ***********************************************/
+void apply_config(const config_t *config)
+{
+	apply_general(config);
+	apply_broker(config);
+	apply_subscription(config);
+	apply_spool(config);
+	apply_collectors(config);
+	apply_compression(config);
+	apply_jobs(config);
+
+	// mosquitto_pub_topic_check
+	// mosquitto_sub_topic_check
+}
+
+/*******************************************/ /**
+ * @brief Reads the configuration file or creates it if it is not 
+ *        available. The parsed file is kept for the next reload, 
+ *        a file that can't be read applies the defaults.
+ * 
+ * @return int - Result, ZERO at successfully, otherwise -1
+ ***********************************************/
+int read_config()
+{
+	config_t *cfg = malloc(sizeof(config_t));
+	if (! cfg)
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	int result = load_config(cfg);
+	if (result)
+	{
+		// the defaults are taken, a reload is compared to them
+		config_init(cfg);
+	}
+
+	apply_config(cfg);
+	running_config = cfg;
+
+	return result;
+}
+
+/*******************************************/ /**
+ * @brief Discard all settings and give free allocated memory
+ ***********************************************/
+void discard_free_config()
+{
+	watch_free();		// before service_free(), the units fd belongs to it
+	free_jobs();
+	free(stat_pub_topic); stat_pub_topic = NULL;
+	free(tele_pub_topic); tele_pub_topic = NULL;
+	free(stat_pub_message); stat_pub_message = NULL;
+	free(tele_pub_message); tele_pub_message = NULL;
+	free(tele_format); tele_format = NULL;
+	free(tele_compression); tele_compression = NULL;
+	free(stat_trigger); stat_trigger = NULL;
+	free(tele_trigger); tele_trigger = NULL;
+	free(psi_alert_topic); psi_alert_topic = NULL;
+	free(psi_alert_message); psi_alert_message = NULL;
+	free(envelope_topic); envelope_topic = NULL;
+	free(envelope_format); envelope_format = NULL;
+	envelope_free(&envelope);
+	batch_free();
+	free_compression();
+	free_collectors();
+	free_spool();
+	free(sub_topic); sub_topic = NULL;
+	free(last_will_topic); last_will_topic = NULL;
+	free(last_will_message); last_will_message = NULL;
+	free(pub_terminate_message); pub_terminate_message = NULL;
+	free(mqtt_broker); mqtt_broker = NULL;
+	free(client_id); client_id = NULL;
+	if (running_config)
+	{
+		config_destroy(running_config);
+		free(running_config);
+		running_config = NULL;
+	}
+}
+
+/********************************************//**
+ * @brief Init the mosquitto libraryconnection to MQTT broker
+ ***********************************************/
+void init_mosquitto()
+{
+	int major, minor, revision;
+
+	// Print version of libmosquitto
+	mosquitto_lib_version(&major, &minor, &revision);
+	LOG(6, "<%d>Mosquitto Version : %d.%d.%d\n", major, minor, revision);
+
+	// Init Mosquitto Client, required for use libmosquitto
+	mosquitto_lib_init();
+
+	// Create a new client instance. The id is the same on each start,
+	// so the broker can keep the session of it.
+	mosq = mosquitto_new(client_id, ! persistent_session, NULL);
+	if (!mosq)
 	{
 		LOG(3, "<%d>ERROR: Can't create mosquitto client!\n");
 		mosquitto_lib_cleanup();
 		exit(EXIT_FAILURE);
 	}
+	LOG(6, "<%d>Client id : %s%s\n", client_id, persistent_session ? " (persistent session)" : "");
+	set_mosquitto_callbacks();
+
+	// The backoff of the hosts of a fleet differs by the jitter
+	srandom(monotonic_ns() ^ getpid());
+}
+
+/********************************************//**
+ * @brief Set the callbacks of the mosquitto client, also 
+ *        after mosquitto_reinitialise()
+ ***********************************************/
+void set_mosquitto_callbacks()
+{
+	mosquitto_connect_v5_callback_set(mosq, on_connect_callback);
+	mosquitto_message_callback_set(mosq, on_message_callback);
+	mosquitto_subscribe_callback_set(mosq, on_subscribe_callback);
+	mosquitto_publish_callback_set(mosq, on_publish_callback);
+	mosquitto_disconnect_callback_set(mosq, on_disconnect_callback);
+
+	// mosquitto_unsubscribe_callback_set(mosq, void (*on_unsubscribe)(struct mosquitto *, void *, int));
+}
+
+/********************************************//**
+ * @brief Start to connect the MQTT broker. The connect is 
+ *        completed by the event loop, a broker that is not 
+ *        reachable is retried with backoff.
+ ***********************************************/
+void connect_broker()
+{
+	int err = 0;
+	// Set the last will must be called before calling mosquitto_connect.
+	if ( (err = mosquitto_will_set(mosq, last_will_topic, 
+			strlen(last_will_message), last_will_message, 
+			QOS_MOST_ONCE_DELIVERY, false) ))
+	{
+		LOG(3, "<%d>ERROR: Last will cant't set : %d %s!\n", err, mosquitto_connack_string(err));
+	}
+
+	if (broker_user && broker_password)
+	{
+		if ((strnlen(broker_user, 128) > 0) && (strnlen(broker_password, 128) > 0))
+		{
+			// This is must be called before calling mosquitto_connect.
+			mosquitto_username_pw_set(mosq, broker_user, broker_password);
+		}
+		else
+		{
+			// the credentials are removed by a reload
+			mosquitto_username_pw_set(mosq, NULL, NULL);
+		}
+	}
+
+	mosquitto_int_option(mosq, MOSQ_OPT_PROTOCOL_VERSION, 
+			(mqtt_version == 5) ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V311);
+	// Nagle would hold the flush of a corked tick until the last one is acknowledged
+	mosquitto_int_option(mosq, MOSQ_OPT_TCP_NODELAY, batch_cork);
+
+	// The connection is driven by the event loop of main()
+	err = mosquitto_connect_async(mosq, mqtt_broker, port, keepalive);
+	reconnect_pending = false;
+	arm_timer(reconnect_timer_fd, 0, false);
+	if (err)
+	{
+		LOG(4, "<%d>Unable to connect MQTT-broker %s:%d : %s\n", mqtt_broker, port, 
+				mosquitto_strerror(err));
+		schedule_reconnect();
+		return;
+	}
+	watch_mosquitto();
+}
+
+/*******************************************/ /**
+ * @brief Get the delay to the next connect attempt. It doubles
+ *        with each failed attempt from 'reconnect_delay_min' up
+ *        to 'reconnect_delay_max'. A random jitter of up to the 
+ *        half spreads the reconnects of many hosts after a 
+ *        restart of the broker.
+ * 
+ * @return int - Milliseconds
+ ***********************************************/
+int reconnect_delay()
+{
+	long long delay = (reconnect_delay_min > 0) ? reconnect_delay_min * 1000LL : 1000;
+	long long limit = (reconnect_delay_max > 0) ? reconnect_delay_max * 1000LL : delay;
+	for (int i = 0; (i < reconnect_attempts) && (delay < limit); i++)
+	{
+		delay *= 2;
+	}
+	if (delay > limit)
+	{
+		delay = limit;
+	}
+	return delay - random() % (delay / 2 + 1);
+}
+
+/*******************************************/ /**
+ * @brief Create a timer on the monotonic clock
+ * 
+ * @return int - fd of the timer
+ ***********************************************/
+int create_timer()
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		ERROR_EXIT("timerfd_create");
+	}
+
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event))
+	{
+		ERROR_EXIT("epoll_ctl");
+	}
+	return fd;
+}
+
+/*******************************************/ /**
+ * @brief Arm a timer on a absolute deadline. A periodic timer 
+ *        expires at multiples of the interval after the first
+ *        deadline, so the time to handle it does not add up.
+ * 
+ * @param fd - The timer
+ * @param interval - Seconds to the deadline, ZERO disarms the timer
+ * @param periodic - Rearm with the same interval after expiration
+ ***********************************************/
+void arm_timer(int fd, int interval, bool periodic)
+{
+	struct itimerspec spec = {0};
+
+	if (interval > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &spec.it_value);
+		spec.it_value.tv_sec += interval;
+		if (periodic)
+		{
+			spec.it_interval.tv_sec = interval;
+		}
+	}
+
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL))
+	{
+		ERROR_EXIT("timerfd_settime");
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the time of the monotonic clock
+ * 
+ * @return uint64_t - Nanoseconds
+ ***********************************************/
+uint64_t monotonic_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*******************************************/ /**
+ * @brief Arm a one-shot timer on a absolute deadline
+ * 
+ * @param fd - The timer
+ * @param deadline - CLOCK_MONOTONIC in nanoseconds, ZERO disarms the timer
+ ***********************************************/
+void arm_timer_at(int fd, uint64_t deadline)
+{
+	struct itimerspec spec = {0};
+
+	spec.it_value.tv_sec = deadline / 1000000000;
+	spec.it_value.tv_nsec = deadline % 1000000000;
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL))
+	{
+		ERROR_EXIT("timerfd_settime");
+	}
+}
+
+/*******************************************/ /**
+ * @brief Arm a periodic timer with a interval in milliseconds
+ * 
+ * @param fd - The timer
+ * @param interval - Milliseconds, ZERO disarms the timer
+ ***********************************************/
+void arm_timer_ms(int fd, int interval)
+{
+	struct itimerspec spec = {0};
+
+	if (interval > 0)
+	{
+		spec.it_interval.tv_sec = interval / 1000;
+		spec.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+		spec.it_value = spec.it_interval;
+	}
+
+	if (timerfd_settime(fd, 0, &spec, NULL))
+	{
+		ERROR_EXIT("timerfd_settime");
+	}
+}
+
+/*******************************************/ /**
+ * @brief Acknowledge the expirations of a timer
+ * 
+ * @param fd - The timer
+ * @return uint64_t - Count of expirations since the last call
+ ***********************************************/
+uint64_t read_timer(int fd)
+{
+	uint64_t expirations = 0;
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+	{
+		return 0;
+	}
+	return expirations;
+}
+
+/*******************************************/ /**
+ * @brief Create the event loop and its timers
+ ***********************************************/
+void init_event_loop()
+{
+	if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		ERROR_EXIT("epoll_create1");
+	}
+
+	sched_timer_fd = create_timer();
+	collect_timer_fd = create_timer();
+	misc_timer_fd = create_timer();
+	reconnect_timer_fd = create_timer();
+	replay_timer_fd = create_timer();
+	sample_timer_fd = create_timer();
+	trigger_timer_fd = create_timer();
+	reload_timer_fd = create_timer();
+
+	// the collectors signal a finished run, a triggered publish waits for it
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = metrics_fd() };
+	if ((event.data.fd >= 0) && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event))
+	{
+		ERROR_EXIT("epoll_ctl");
+	}
+
+	// The keepalive PINGREQ is due after 'keepalive' seconds without 
+	// outgoing traffic and is sent on the next run after that. The 
+	// broker waits 1.5 times 'keepalive', a quarter keeps it in time.
+	arm_timer_ms(misc_timer_fd, keepalive * 1000 / 4);
+}
+
+/*******************************************/ /**
+ * @brief Schedule all jobs on the phase of the host, at most 
+ *        one interval from now, and arm the timer on the 
+ *        earliest deadline
+ * 
+ * @param deadlines - Deadlines of the jobs before a reload, a job
+ *                    with the same topic and interval keeps its
+ *                    deadline. NULL schedules all from now.
+ * @param deadline_count - Count of the deadlines
+ ***********************************************/
+void schedule_jobs(const job_deadline_t *deadlines, int deadline_count)
+{
+	uint64_t now = monotonic_ns();
+	uint64_t real_now = realtime_ns();
+	uint64_t phase = schedule_phase(client_id);
+	uint64_t deadline = 0;
+	bool taken[deadline_count + 1];
+
+	memset(taken, 0, sizeof(taken));
+	scheduler_clear(&scheduler);
+	for (int i = 0; i < job_count; i++)
+	{
+		if (jobs[i].interval > 0)
+		{
+			deadline = first_deadline(&jobs[i], phase, now, real_now);
+			for (int d = 0; d < deadline_count; d++)
+			{
+				if ( (! taken[d]) && (deadlines[d].interval == jobs[i].interval) && 
+						(! strcmp(deadlines[d].topic, jobs[i].topic)) )
+				{
+					taken[d] = true;
+					deadline = deadlines[d].deadline;
+					break;
+				}
+			}
+			if (scheduler_push(&scheduler, i, deadline))
+			{
+				ERROR_EXIT(err_out_of_memory);
+			}
+		}
+	}
+	collect_since = 0;
+	arm_schedule();
 
-	mosquitto_connect_callback_set(mosq, on_connect_callback);
-	mosquitto_message_callback_set(mosq, on_message_callback);
-	mosquitto_subscribe_callback_set(mosq, on_subscribe_callback);
-	mosquitto_publish_callback_set(mosq, on_publish_callback);
+	arm_timer_ms(sample_timer_fd, window_tag_count ? sample_interval_ms : 0);
+}
 
-	// mosquitto_disconnect_callback_set(mosq, void (*on_disconnect)(struct mosquitto *, void *, int));
-	// mosquitto_unsubscribe_callback_set(mosq, void (*on_unsubscribe)(struct mosquitto *, void *, int));
+/*******************************************/ /**
+ * @brief Arm the timer on the earliest deadline and the timer
+ *        of its collectors 'collector_timeout_ms' ahead, both
+ *        are disarmed without a scheduled job
+ ***********************************************/
+void arm_schedule()
+{
+	uint64_t deadline = 0;
+	uint64_t lead = collector_timeout_ms * 1000000ULL;
+
+	scheduler_peek(&scheduler, &deadline);
+	arm_timer_at(sched_timer_fd, deadline);
+	arm_timer_at(collect_timer_fd, (deadline > lead) ? deadline - lead : deadline);
+}
+
+/*******************************************/ /**
+ * @brief Start the collectors of the jobs that are due within
+ *        'collector_timeout_ms', the tick reads their values 
+ *        without waiting. A collector still running at the
+ *        tick is stale. It is called again if a collector is
+ *        done and starts the ones that were busy before.
+ ***********************************************/
+void prefetch_jobs()
+{
+	uint64_t now = monotonic_ns();
+	uint64_t horizon = now + collector_timeout_ms * 1000000ULL;
+	uint32_t collectors = 0;
+
+	for (size_t i = 0; i < scheduler.count; i++)
+	{
+		if (scheduler.entries[i].deadline <= horizon)
+		{
+			collectors |= jobs[scheduler.entries[i].job].collectors;
+		}
+	}
+
+	if (! collect_since)
+	{
+		collect_since = now;
+	}
+	metrics_start(collectors, METRICS_PUBLISH, collect_since);
+	arm_timer_at(collect_timer_fd, 0);
+}
+
+/*******************************************/ /**
+ * @brief Get the smallest interval of the scheduled jobs
+ * 
+ * @return uint64_t - The interval in nanoseconds, ZERO if no 
+ *                    job is scheduled
+ ***********************************************/
+uint64_t smallest_interval()
+{
+	uint64_t smallest = 0;
+	for (int i = 0; i < job_count; i++)
+	{
+		uint64_t interval = jobs[i].interval * 1000000000ULL;
+		if ((jobs[i].interval > 0) && ((! smallest) || (interval < smallest)))
+		{
+			smallest = interval;
+		}
+	}
+	return smallest;
+}
+
+/*******************************************/ /**
+ * @brief Get the phase of the jobs of a host. It is spread 
+ *        over 'schedule_spread' percent of the smallest 
+ *        interval, so jobs with a multiple of it stay in the
+ *        same tick. The phase spans only smallest_interval() :
+ *        the jobs with a longer interval of a fleet still 
+ *        cluster in the first part of their interval, e.g.
+ *        a 1 hour job of hosts with a 60 s job lands in the 
+ *        first minute of the hour.
+ * 
+ * @param id - The client id of the host
+ * @return uint64_t - The phase in nanoseconds
+ ***********************************************/
+uint64_t schedule_phase(const char *id)
+{
+	return scheduler_phase(id, smallest_interval() * schedule_spread / 100);
+}
+
+/*******************************************/ /**
+ * @brief Get the first deadline of a job on the phase of the 
+ *        host. The cycles of the interval start now, or with 
+ *        'schedule_align' on multiples of the interval since 
+ *        the epoch of the wall clock.
+ * 
+ * @param job - The publish job, with a interval
+ * @param phase - Phase of the host from schedule_phase()
+ * @param now - CLOCK_MONOTONIC in nanoseconds
+ * @param real_now - CLOCK_REALTIME at the same time
+ * @return uint64_t - The deadline, at most one interval from now
+ ***********************************************/
+uint64_t first_deadline(const publish_job_t *job, uint64_t phase, uint64_t now, uint64_t real_now)
+{
+	return scheduler_slot(now, schedule_align ? real_now : 0, job->interval * 1000000000ULL, phase);
+}
+
+/*******************************************/ /**
+ * @brief Get the time of the wall clock
+ * 
+ * @return uint64_t - CLOCK_REALTIME in nanoseconds
+ ***********************************************/
+uint64_t realtime_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*******************************************/ /**
+ * @brief Publish all jobs that are due with one metrics 
+ *        snapshot and schedule their next deadline. The next 
+ *        deadline is a multiple of the interval after the 
+ *        previous one, so the time to publish does not add up.
+ ***********************************************/
+void run_due_jobs()
+{
+	uint64_t now = monotonic_ns();
+	uint64_t deadline;
+	uint32_t collectors = 0;
+	int due_count = 0;
+
+	if (! collect_since)
+	{
+		// the timer of the collectors did not expire before the tick
+		prefetch_jobs();
+	}
+
+	while ((scheduler_peek(&scheduler, &deadline) >= 0) && (deadline <= now))
+	{
+		int job = scheduler_pop(&scheduler, NULL);
+		uint64_t interval = jobs[job].interval * 1000000000ULL;
+
+		// a missed deadline is published only once
+		do
+		{
+			deadline += interval;
+		} while (deadline <= now);
+		scheduler_push(&scheduler, job, deadline);	// can't fail, the entry was just popped
+
+		due_jobs[due_count++] = job;
+		collectors |= jobs[job].collectors;
+	}
+
+	arm_schedule();
+
+	publish_jobs(due_count, collectors, now, collect_since);
+	collect_since = 0;
+}
+
+/*******************************************/ /**
+ * @brief Publish the jobs in 'due_jobs' with one metrics 
+ *        snapshot, or spool them if not connected
+ * 
+ * @param due_count - Count of jobs in 'due_jobs'
+ * @param collectors - Collectors referenced by the jobs
+ * @param now - CLOCK_MONOTONIC in nanoseconds
+ * @param since - Start of the collectors of the jobs
+ ***********************************************/
+void publish_jobs(int due_count, uint32_t collectors, uint64_t now, uint64_t since)
+{
+	if ((! due_count) || ((! connected) && (! spool.header)))
+	{
+		return;
+	}
+
+	// One snapshot for all messages of this tick
+	sample_metrics(collectors, since);
+
+	// The publishes of the tick are counted and leave in one flush
+	bool batching = connected;
+	int envelope_qos = QOS_MOST_ONCE_DELIVERY;
+	if (batching)
+	{
+		batch_begin(&batch, mosquitto_socket(mosq), batch_cork, batch_counted);
+		envelope_open(&envelope, envelope.format);
+	}
+
+	for (int i = 0; i < due_count; i++)
+	{
+		publish_job_t *job = &jobs[due_jobs[i]];
+
+		evaluate_job(job);
+		if (! policy_check(&job->policy, job->values, now))
+		{
+			LOG(6, "<%d>Skip %s, values not changed\n", job->topic);
+			continue;
+		}
+
+		bool sent = true;
+		if (batching)
+		{
+			size_t length;
+			const char *payload = render_job(job, &length);
+			if (envelope_job(job, payload, length))
+			{
+				LOG(6, "<%d>Batching %s ... \n", job->topic);
+				envelope_qos = (job->qos > envelope_qos) ? job->qos : envelope_qos;
+			}
+			else
+			{
+				LOG(6, "<%d>Sending %s ... \n", job->topic);
+				sent = (publish_payload(job, payload, length) >= 0);
+				batch.messages += sent;
+			}
+		}
+		else
+		{
+			spool_job(job);
+		}
+		policy_commit(&job->policy, job->values, now);
+		if (sent)
+		{
+			// a skipped or failed publish keeps the samples for the next one
+			reset_job_windows(job);
+		}
+	}
+
+	if (batching)
+	{
+		if (envelope.count)
+		{
+			LOG(6, "<%d>Sending %s with %zu messages ... \n", envelope_topic, envelope.count);
+			batch.messages += (publish_envelope(envelope_qos) >= 0);
+		}
+		batch_end(&batch, &batch_stats);
+		LOG(6, "<%d>Tick : %lld messages, %lld writes, %lld packets\n", 
+				batch_stats.messages, batch_stats.writes, batch_stats.packets);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Add the fds of the watch sources to the event loop.
+ *        They are removed by closing them in watch_free().
+ ***********************************************/
+void watch_events()
+{
+	int fds[WATCH_MAX_FDS];
+	bool priority[WATCH_MAX_FDS];
+	int count = watch_fds(fds, priority);
+	for (int i = 0; i < count; i++)
+	{
+		struct epoll_event event = { .events = priority[i] ? EPOLLPRI : EPOLLIN, .data.fd = fds[i] };
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) && (errno != EEXIST))
+		{
+			ERROR_EXIT("epoll_ctl");
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Schedule a publish of the jobs triggered by the
+ *        sources that fired. The publish waits the debounce 
+ *        time, the events until then are coalesced into it. 
+ *        It waits at least the holdoff time after the last
+ *        triggered publish of the job.
+ * 
+ * @param fired - Set of watch sources, see watch.h
+ ***********************************************/
+void trigger_jobs(uint32_t fired)
+{
+	if (pause_flag)
+	{
+		return;
+	}
+
+	uint64_t now = monotonic_ns();
+	for (int i = 0; i < job_count; i++)
+	{
+		publish_job_t *job = &jobs[i];
+		if ((job->triggers & fired) && (! job->trigger_at))
+		{
+			job->trigger_at = now + job->debounce_ns;
+			if (job->triggered_at && (job->trigger_at < job->triggered_at + job->holdoff_ns))
+			{
+				job->trigger_at = job->triggered_at + job->holdoff_ns;
+			}
+			LOG(6, "<%d>Triggered %s in %llu ms\n", job->topic, 
+					(unsigned long long)(job->trigger_at - now) / 1000000);
+		}
+	}
+	arm_timer_at(trigger_timer_fd, next_trigger());
+}
+
+/*******************************************/ /**
+ * @brief Get the time of the next step of the triggered jobs,
+ *        a publish that is due or the end of the wait for the
+ *        collectors of a publish
+ * 
+ * @return uint64_t - CLOCK_MONOTONIC in nanoseconds, ZERO if no
+ *                    job is triggered
+ ***********************************************/
+uint64_t next_trigger()
+{
+	uint64_t next = 0;
+	for (int i = 0; i < job_count; i++)
+	{
+		uint64_t at = jobs[i].collect_since ? 
+				jobs[i].collect_since + collector_timeout_ms * 1000000ULL : jobs[i].trigger_at;
+		if (at && ((! next) || (at < next)))
+		{
+			next = at;
+		}
+	}
+	return next;
+}
+
+/*******************************************/ /**
+ * @brief Start the collectors of the triggered jobs that are 
+ *        due and publish the jobs with finished collectors. A 
+ *        job waits for its collectors up to 'collector_timeout_ms',
+ *        it is checked again if a collector is done.
+ ***********************************************/
+void run_triggered_jobs()
+{
+	uint64_t now = monotonic_ns();
+	uint64_t lead = collector_timeout_ms * 1000000ULL;
+	uint64_t since = now;
+	uint32_t collectors = 0;
+	uint32_t fired = 0;
+	int due_count = 0;
+
+	for (int i = 0; i < job_count; i++)
+	{
+		publish_job_t *job = &jobs[i];
+		if (job->trigger_at && (job->trigger_at <= now))
+		{
+			job->trigger_at = 0;
+			job->triggered_at = now;
+			job->collect_since = now;
+		}
+		if (job->collect_since)
+		{
+			metrics_start(job->collectors, METRICS_PUBLISH, job->collect_since);
+		}
+	}
+
+	for (int i = 0; i < job_count; i++)
+	{
+		publish_job_t *job = &jobs[i];
+		if ( job->collect_since && 
+				( metrics_ready(job->collectors, METRICS_PUBLISH, job->collect_since) || 
+				(job->collect_since + lead <= now) ) )
+		{
+			since = (job->collect_since < since) ? job->collect_since : since;
+			job->collect_since = 0;
+			due_jobs[due_count++] = i;
+			collectors |= job->collectors;
+			fired |= job->triggers;
+		}
+	}
+	arm_timer_at(trigger_timer_fd, next_trigger());
+
+	publish_jobs(due_count, collectors, now, since);
+	if (fired & WATCH_PSI)
+	{
+		// %psi_alert% lists the triggers that fired since the last alert
+		psi_alert_clear();
+	}
+}
+
+/*******************************************/ /**
+ * @brief Update the epoll registration of the broker socket. 
+ *        Must be called after each call into libmosquitto that 
+ *        can change the socket or queue outgoing data.
+ ***********************************************/
+void watch_mosquitto()
+{
+	int fd = reconnect_pending ? -1 : mosquitto_socket(mosq);
+
+	if (fd != mosq_fd)
+	{
+		if (mosq_fd >= 0)
+		{
+			// fails if the socket is already closed, that is fine
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, mosq_fd, NULL);
+		}
+		mosq_fd = -1;
+
+		if (fd >= 0)
+		{
+			struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event))
+			{
+				ERROR_EXIT("epoll_ctl");
+			}
+			mosq_fd = fd;
+		}
+	}
+
+	if (mosq_fd >= 0)
+	{
+		struct epoll_event event = { .events = EPOLLIN, .data.fd = mosq_fd };
+		if (mosquitto_want_write(mosq))
+		{
+			event.events |= EPOLLOUT;
+		}
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, mosq_fd, &event) && (errno == ENOENT))
+		{
+			// a new socket of a reconnect got the number of the closed one
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mosq_fd, &event);
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Process the events of the broker socket
+ * 
+ * @param events - Events reported by epoll
+ ***********************************************/
+void handle_mosquitto(uint32_t events)
+{
+	int err = MOSQ_ERR_SUCCESS;
+
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+	{
+		err = mosquitto_loop_read(mosq, 1);
+	}
+	if ((! err) && (events & EPOLLOUT))
+	{
+		err = mosquitto_loop_write(mosq, 1);
+	}
+
+	if (err)
+	{
+		LOG(4, "<%d>Connection to MQTT-broker lost : %s\n", mosquitto_strerror(err));
+		schedule_reconnect();
+	}
+}
+
+/*******************************************/ /**
+ * @brief Stop watching the broker socket and retry the 
+ *        connection after a delay
+ ***********************************************/
+void schedule_reconnect()
+{
+	connected = false;
+	if (! reconnect_pending)
+	{
+		reconnect_pending = true;
+		watch_mosquitto();
+		int delay = reconnect_delay();
+		reconnect_attempts++;
+		LOG(5, "<%d>Reconnect in %d ms\n", delay);
+		arm_timer_at(reconnect_timer_fd, monotonic_ns() + delay * 1000000ULL);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Render the message of a job with the values of the 
+ *        last evaluate_job() and publish it
+ * 
+ * @param job - The publish job
+ * @return int - Message id or -1 if the publish failed
+ ***********************************************/
+int publish_job(publish_job_t *job)
+{
+	size_t length;
+	const char *payload = render_job(job, &length);
+	return publish_payload(job, payload, length);
+}
+
+/*******************************************/ /**
+ * @brief Publish the rendered message of a job
+ * 
+ * @param job - The publish job
+ * @param payload - The message of render_job()
+ * @param length - Length of the message
+ * @return int - Message id or -1 if the publish failed
+ ***********************************************/
+int publish_payload(publish_job_t *job, const char *payload, size_t length)
+{
+	int mid;
+	const char *topic = job->topic;
+	const mosquitto_property *properties = NULL;
+	if (mqtt_version == 5)
+	{
+		properties = job_properties(job, payload == (const char *)job->compressed);
+		if (job->alias_sent && job_alias(job))
+		{
+			// the broker maps the alias to the topic
+			topic = NULL;
+		}
+	}
+	//LOG(6, "<%d>Sending heartbeat ... %s : %s\n", job->topic, payload);
+	inflight_begin();
+	batch_write_begin(&batch);
+	int err = mosquitto_publish_v5(mosq, &mid, topic, length, payload, job->qos, job->retain, properties);
+	batch_write_end(&batch);
+	if (err)
+	{
+		inflight_cancel();
+		LOG(4, "<%d>Publish failed : %s\n", mosquitto_strerror(err));
+		return -1;
+	}
+	job->alias_sent = (mqtt_version == 5) && job_alias(job);
+
+	inflight_add(mid);
+	return mid;
+}
+
+/*******************************************/ /**
+ * @brief Add the rendered message of a job to the envelope 
+ *        of the tick, if the job has 'envelope'. A text is 
+ *        added as string, a message in the format of the 
+ *        envelope as it is. Compressed messages and other 
+ *        formats are published on their own.
+ * 
+ * @param job - The publish job
+ * @param payload - The message of render_job()
+ * @param length - Length of the message
+ * @return bool - TRUE if the message is in the envelope
+ ***********************************************/
+bool envelope_job(publish_job_t *job, const char *payload, size_t length)
+{
+	bool nested = (job->format == envelope.format);
+	if ( (! job->envelope) || (payload == (const char *)job->compressed) || 
+			((! nested) && (job->format != PAYLOAD_TEXT)) )
+	{
+		return false;
+	}
+	if (envelope_add(&envelope, job->topic, payload, length, nested))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Publish the envelope of the tick to 'envelope_topic'
+ * 
+ * @param envelope_qos - The highest QoS of the jobs in it
+ * @return int - Message id or -1 if the publish failed
+ ***********************************************/
+int publish_envelope(int envelope_qos)
+{
+	size_t length;
+	int mid;
+	const void *payload = envelope_close(&envelope, &length);
+	inflight_begin();
+	batch_write_begin(&batch);
+	int err = mosquitto_publish(mosq, &mid, envelope_topic, length, payload, envelope_qos, false);
+	batch_write_end(&batch);
+	if (err)
+	{
+		inflight_cancel();
+		LOG(4, "<%d>Publish failed : %s\n", mosquitto_strerror(err));
+		return -1;
+	}
+
+	inflight_add(mid);
+	return mid;
+}
+
+/*******************************************/ /**
+ * @brief Render the message of a job with the values of the 
+ *        last evaluate_job() and store it in the spool to publish it after reconnect
+ * 
+ * @param job - The publish job
+ ***********************************************/
+void spool_job(publish_job_t *job)
+{
+	size_t length;
+	struct timespec now;
+	const char *payload = render_job(job, &length);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	int dropped = spool_append(&spool, job->topic, payload, length, job->qos, job->retain,
+			(int64_t)now.tv_sec * 1000000000 + now.tv_nsec, (job->expiry > 0) ? job->expiry : 0);
+	if (dropped < 0)
+	{
+		LOG(4, "<%d>Spool message failed : %s\n", strerror(errno));
+	}
+	else if (dropped > 0)
+	{
+		LOG(5, "<%d>Spool is full, %d oldest message(s) dropped\n", dropped);
+	}
 }
 
-/********************************************//**
- * @brief Connect the MQTT broker
+/*******************************************/ /**
+ * @brief Start to publish the spooled messages, paced
+ *        by 'spool_replay_rate' messages per second
  ***********************************************/
-void connect_broker()
+void start_replay()
 {
-	int err = 0;
-	// Set the last will must be called before calling mosquitto_connect.
-	if ( (err = mosquitto_will_set(mosq, last_will_topic, 
-			strlen(last_will_message), last_will_message, 
-			QOS_MOST_ONCE_DELIVERY, false) ))
+	if ((! spool_count(&spool)) || (spool_replay_rate <= 0))
 	{
-		LOG(3, "<%d>ERROR: Last will cant't set : %d %s!\n", err, mosquitto_connack_string(err));
+		return;
 	}
 
-	if (broker_user && broker_password)
+	LOG(5, "<%d>Replay %llu spooled message(s)\n", (unsigned long long)spool_count(&spool));
+	struct itimerspec spec = {0};
+	spec.it_interval.tv_sec = 1 / spool_replay_rate;
+	spec.it_interval.tv_nsec = (1000000000L / spool_replay_rate) % 1000000000L;
+	spec.it_value = spec.it_interval;
+	if (timerfd_settime(replay_timer_fd, 0, &spec, NULL))
 	{
-		if ((strnlen(broker_user, 128) > 0) && (strnlen(broker_password, 128) > 0))
+		ERROR_EXIT("timerfd_settime");
+	}
+}
+
+/*******************************************/ /**
+ * @brief Publish the oldest spooled message, called by the 
+ *        replay timer. The timer is stopped if the spool is 
+ *        empty or the connection is lost. A spooled message is 
+ *        published without retain flag, so it can't replace 
+ *        a newer retained message. With MQTT v5 the expiry of 
+ *        a message counts from its render, the age is taken 
+ *        from the expiry interval and expired messages are 
+ *        dropped.
+ ***********************************************/
+void replay_spool()
+{
+	spool_message_t message;
+	uint64_t real_now = realtime_ns();
+	uint32_t expiry = 0;
+
+	for (;;)
+	{
+		if ((! connected) || spool_first(&spool, &message))
 		{
-			// This is must be called before calling mosquitto_connect.
-			mosquitto_username_pw_set(mosq, broker_user, broker_password);
+			arm_timer_at(replay_timer_fd, 0);
+			return;
 		}
+		if ((mqtt_version != 5) || (! message.expiry))
+		{
+			break;
+		}
+		// a clock set back makes the message younger, never older than its expiry
+		uint64_t age = (real_now > (uint64_t)message.time) ? (real_now - message.time) / 1000000000ULL : 0;
+		if (age < message.expiry)
+		{
+			expiry = message.expiry - age;
+			break;
+		}
+		LOG(6, "<%d>Spooled message of %s expired\n", message.topic);
+		spool_remove_first(&spool);
 	}
 
-	if ( (err = mosquitto_connect(mosq, mqtt_broker, port, keepalive)) )
+	mosquitto_property *properties = NULL;
+	if (expiry && mosquitto_property_add_int32(&properties, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, expiry))
 	{
-		LOG(3, "<%d>ERROR: Unable to connect MQTT-broker %s:%d\n", mqtt_broker, port);
-		exit(EXIT_FAILURE);
+		ERROR_EXIT(err_out_of_memory);
 	}
 
-	if ( (err = mosquitto_loop_start(mosq)) )
+	int mid;
+	inflight_begin();
+	int err = mosquitto_publish_v5(mosq, &mid, message.topic, message.payload_length, 
+			message.payload, message.qos, false, properties);
+	mosquitto_property_free_all(&properties);
+	if (err)
 	{
-		LOG(3, "<%d>ERROR: Unable to start work loop\n");
-		exit(EXIT_FAILURE);
+		inflight_cancel();
+		LOG(4, "<%d>Replay failed : %s\n", mosquitto_strerror(err));
+		return;
+	}
+	inflight_add(mid);
+	spool_remove_first(&spool);
+
+	if (! spool_count(&spool))
+	{
+		LOG(5, "<%d>Replay of spool finished\n");
+		arm_timer_at(replay_timer_fd, 0);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Serve the broker connection until a message is 
+ *        acknowledged, the connection is lost or the 
+ *        'shutdown_drain_timeout' is elapsed. Only the broker
+ *        socket is served, timers and signals are left pending.
+ * 
+ * @param mid - Message id to wait for
+ ***********************************************/
+void drain_publish(int mid)
+{
+	struct timespec begin, now;
+	long elapsed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	while (connected && inflight_contains(mid) && (elapsed < shutdown_drain_timeout))
+	{
+		struct pollfd pfd = { .fd = mosquitto_socket(mosq), .events = POLLIN };
+		if (pfd.fd < 0)
+		{
+			break;
+		}
+		if (mosquitto_want_write(mosq))
+		{
+			pfd.events |= POLLOUT;
+		}
+
+		if (poll(&pfd, 1, shutdown_drain_timeout - elapsed) > 0)
+		{
+			handle_mosquitto(((pfd.revents & POLLIN) ? EPOLLIN : 0) |
+					((pfd.revents & POLLOUT) ? EPOLLOUT : 0) |
+					((pfd.revents & (POLLERR | POLLHUP)) ? EPOLLERR : 0));
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000;
 	}
+
+	LOG(5, "<%d>Drained in %ld ms, %s, %d message(s) pending\n", elapsed, 
+			inflight_contains(mid) ? "not acknowledged" : "acknowledged", inflight_count());
 }
 
 /*******************************************/ /**
@@ -624,21 +3506,44 @@ void connect_broker()
  *            an argument on any callbacks.
  * @param result - Connect return code, the values are defined by the MQTT protocol
  *            http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/errata01/os/mqtt-v3.1.1-errata01-os-complete.html#_Table_3.1_-
+ * @param flags - Connect acknowledge flags, CONNACK_SESSION_PRESENT if the 
+ *            broker kept the session of a 'persistent_session'
+ * @param properties - MQTT v5 properties of the CONNACK, NULL with MQTT 3.1.1
  ***********************************************/
-void on_connect_callback(struct mosquitto *mosq, void *userdata, int result)
+void on_connect_callback(struct mosquitto *mosq, void *userdata, int result, int flags, const mosquitto_property *properties)
 {
 	if (!result)
 	{
 		connected = true;
+		reconnect_attempts = 0;
+		if (! (flags & CONNACK_SESSION_PRESENT))
+		{
+			// a new session, the ids of the connection before are not acknowledged 
+			// anymore. A kept session resends them and the acknowledges come.
+			inflight_clear();
+		}
+
+		// The aliases of the jobs start again on each connection
+		uint16_t alias_max = 0;
+		mosquitto_property_read_int16(properties, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &alias_max, false);
+		topic_alias_max = alias_max;
+		reset_job_properties();
+		LOG(6, "<%d>Topic aliases : %d\n", topic_alias_max);
 
 		LOG(5, "<%d>Connecting to MQTT-broker '%s:%d' success\n", mqtt_broker, port);
-		if (strlen(sub_topic) > 0)
+		start_replay();
+		if ((flags & CONNACK_SESSION_PRESENT) && subscribed)
+		{
+			// the broker kept the subscription and resends the missed messages
+			LOG(6, "<%d>Session present, keep subscription : %s\n", sub_topic);
+		}
+		else if (strlen(sub_topic) > 0)
 		{
 			// Subscribe to broker information topics on successful connect.
 			if (mosquitto_sub_topic_check(sub_topic) == MOSQ_ERR_SUCCESS) 
 			{
 				LOG(5, "<%d>Subscribe : %s\n", sub_topic);
-				mosquitto_subscribe(mosq, NULL, sub_topic, qos);
+				subscribed = ! mosquitto_subscribe(mosq, NULL, sub_topic, qos);
 			}
 			else
 			{
@@ -652,7 +3557,7 @@ void on_connect_callback(struct mosquitto *mosq, void *userdata, int result)
 
 		LOG(3, "<%d>ERROR : Connect to MQTT-broker failed : %d %s!\n",
 				result, mosquitto_connack_string(result));
-		if (result == MOSQ_ERR_CONN_REFUSED) // not authorised
+		if ((result == MOSQ_ERR_CONN_REFUSED) || (result == CONNACK_NOT_AUTHORIZED_V5)) // not authorised
 		{
 			exit(EXIT_FAILURE);
 		}
@@ -703,17 +3608,17 @@ void on_message_callback(struct mosquitto *mosq, void *userdata, const struct mo
 					if ( ! strcasecmp("off", message->payload)) 
 					{
 						shutdown_cmd = shutdown_poweroff;
-						kill(0, SIGTERM);
+						terminate_flag = true;
 					}
 					else if ( ! strcasecmp("toggle", message->payload)) 
 					{
 						shutdown_cmd = shutdown_poweroff;
-						kill(0, SIGTERM);
+						terminate_flag = true;
 					}
 					else if ( ! strcasecmp("reboot", message->payload)) 
 					{
 						shutdown_cmd = shutdown_reboot;
-						kill(0, SIGTERM);
+						terminate_flag = true;
 					}
 				}
 				else
@@ -742,99 +3647,381 @@ void on_message_callback(struct mosquitto *mosq, void *userdata, const struct mo
  ***********************************************/
 void on_publish_callback(struct mosquitto *mosq, void *userdata, int mid)
 {
+	inflight_remove(mid);
+	// a QoS 0 publish calls back within mosquitto_publish(), the log is no socket write
+	bool writing = batch_write_end(&batch);
 	LOG(6, "<%d>Successfully published : (mid: %d)\n", mid);
+	if (writing)
+	{
+		batch_write_begin(&batch);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Trigert by the broker has received the DISCONNECT command
+ *        or the connection is lost.
+ * 
+ * @param mosq - Pointer to a valid mosquitto instance.
+ * @param userdata - Defined in mosquitto_new, a pointer to an object that will be 
+ *            an argument on any callbacks. 
+ * @param reason - ZERO on a requested disconnect, otherwise the connection is lost.
+ ***********************************************/
+void on_disconnect_callback(struct mosquitto *mosq, void *userdata, int reason)
+{
+	connected = false;
+	if (reason)
+	{
+		LOG(4, "<%d>Disconnected from MQTT-broker : %s\n", mosquitto_strerror(reason));
+		schedule_reconnect();
+	}
+}
+
+/*******************************************/ /**
+ * @brief Copy the settings of the broker connection
+ * 
+ * @param settings - Stores the copies, free them by 
+ *                   free_broker_settings()
+ ***********************************************/
+void save_broker_settings(broker_settings_t *settings)
+{
+	settings->broker = alloc_string(NULL, mqtt_broker);
+	settings->port = port;
+	settings->user = alloc_string(NULL, broker_user);
+	settings->password = alloc_string(NULL, broker_password);
+	settings->will_topic = alloc_string(NULL, last_will_topic);
+	settings->will_message = alloc_string(NULL, last_will_message);
+	settings->client_id = alloc_string(NULL, client_id);
+	settings->persistent_session = persistent_session;
+	settings->mqtt_version = mqtt_version;
+}
+
+/*******************************************/ /**
+ * @brief Compare the settings of the broker connection with
+ *        the current ones
+ * 
+ * @param settings - Settings by save_broker_settings()
+ * @return bool - TRUE if one of them is changed
+ ***********************************************/
+bool broker_settings_changed(const broker_settings_t *settings)
+{
+	return strcmp(settings->broker, mqtt_broker) || (settings->port != port) || 
+			strcmp(settings->user, broker_user) || strcmp(settings->password, broker_password) || 
+			strcmp(settings->will_topic, last_will_topic) || 
+			strcmp(settings->will_message, last_will_message) || 
+			strcmp(settings->client_id, client_id) || 
+			(settings->persistent_session != persistent_session) || 
+			(settings->mqtt_version != mqtt_version);
+}
+
+/*******************************************/ /**
+ * @brief Give free the copies of save_broker_settings()
+ ***********************************************/
+void free_broker_settings(broker_settings_t *settings)
+{
+	free(settings->broker);
+	free(settings->user);
+	free(settings->password);
+	free(settings->will_topic);
+	free(settings->will_message);
+	free(settings->client_id);
+	memset(settings, 0, sizeof(*settings));
+}
+
+/*******************************************/ /**
+ * @brief Copy the next deadline of each scheduled job
+ * 
+ * @param deadlines - Stores the array, free it by free_deadlines()
+ * @return int - Count of the deadlines
+ ***********************************************/
+int save_deadlines(job_deadline_t **deadlines)
+{
+	*deadlines = NULL;
+	if (! scheduler.count)
+	{
+		return 0;
+	}
+	if (! (*deadlines = malloc(scheduler.count * sizeof(job_deadline_t))))
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	for (size_t i = 0; i < scheduler.count; i++)
+	{
+		const publish_job_t *job = &jobs[scheduler.entries[i].job];
+		(*deadlines)[i].topic = alloc_string(NULL, job->topic);
+		(*deadlines)[i].interval = job->interval;
+		(*deadlines)[i].deadline = scheduler.entries[i].deadline;
+	}
+	return scheduler.count;
+}
+
+/*******************************************/ /**
+ * @brief Give free the copies of save_deadlines()
+ ***********************************************/
+void free_deadlines(job_deadline_t *deadlines, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		free(deadlines[i].topic);
+	}
+	free(deadlines);
 }
 
 /*******************************************/ /**
- * @brief Processing of the received signals
+ * @brief Replace the subscription of the running connection.
+ *        If not connected, on_connect_callback() subscribes
+ *        the new topic.
  * 
- * void 
- *signal_handler(int sig)
+ * @param previous_topic - The subscribed topic, empty if none
+ * @param previous_qos - QoS of the subscription
+ ***********************************************/
+void update_subscription(const char *previous_topic, int previous_qos)
+{
+	if ((! strcmp(previous_topic, sub_topic)) && (previous_qos == qos))
+	{
+		return;
+	}
+	LOG(5, "<%d>Subscription changed : '%s' -> '%s'\n", previous_topic, sub_topic);
+	subscribed = false;
+	if (! connected)
+	{
+		return;
+	}
+
+	if (strlen(previous_topic) > 0)
+	{
+		mosquitto_unsubscribe(mosq, NULL, previous_topic);
+	}
+	if (strlen(sub_topic) > 0)
+	{
+		if (mosquitto_sub_topic_check(sub_topic) == MOSQ_ERR_SUCCESS)
+		{
+			subscribed = ! mosquitto_subscribe(mosq, NULL, sub_topic, qos);
+		}
+		else
+		{
+			LOG(4, "<%d>Invalid subscribe topic : %s\n", sub_topic);
+		}
+	}
+}
+
+/*******************************************/ /**
+ * @brief Read the config file again and apply the changes.
+ *        The new file is parsed and validated before anything 
+ *        is changed, a broken or invalid file keeps the running
+ *        config. Only the sections with a changed setting are 
+ *        applied, see 'collector_keys' and the other lists. New
+ *        jobs are built aside and keep the state of the same 
+ *        jobs before, they replace the running jobs at once. The
+ *        broker connection is kept unless the broker, the 
+ *        credentials, the last will or the session are changed.
+ *        The jobs keep their deadlines. While a hung collector 
+ *        runs in its module the reload is retried later by 
+ *        'reload_timer_fd'.
+ ***********************************************/
+void reload_config()
+{
+	LOG(5, "<%d>Reload config\n");
+
+	// a worker still runs in the module of a hung collector
+	uint32_t pending = metrics_pending() & MODULE_COLLECTORS;
+	if (pending)
+	{
+		LOG(4, "<%d>WARNING : Collectors 0x%02x are pending, retry the reload in %d ms\n", 
+				pending, RELOAD_RETRY_MS);
+		arm_timer_at(reload_timer_fd, monotonic_ns() + RELOAD_RETRY_MS * 1000000ULL);
+		return;
+	}
+	arm_timer_at(reload_timer_fd, 0);
+
+	config_t *cfg = malloc(sizeof(config_t));
+	if (! cfg)
+	{
+		ERROR_EXIT(err_out_of_memory);
+	}
+	if (load_config(cfg))
+	{
+		LOG(4, "<%d>WARNING : Keep the running config\n");
+		free(cfg);
+		return;
+	}
+	if (validate_config(cfg))
+	{
+		LOG(4, "<%d>WARNING : Keep the running config\n");
+		config_destroy(cfg);
+		free(cfg);
+		return;
+	}
+
+	bool spool_changed = section_changed(running_config, cfg, spool_keys);
+	bool collectors_changed = section_changed(running_config, cfg, collector_keys);
+	bool compression_changed = section_changed(running_config, cfg, compress_keys);
+	// the templates of the jobs register their tags in the modules
+	bool jobs_changed = collectors_changed || compression_changed || 
+			section_changed(running_config, cfg, job_keys);
+
+	broker_settings_t previous;
+	save_broker_settings(&previous);
+	char *previous_sub_topic = alloc_string(NULL, sub_topic);
+	int previous_qos = qos;
+	job_deadline_t *deadlines;
+	int deadline_count = save_deadlines(&deadlines);
+
+	apply_general(cfg);
+	apply_broker(cfg);
+	apply_subscription(cfg);
+	if (spool_changed)
+	{
+		LOG(5, "<%d>Spool settings changed, reopen the spool\n");
+		free_spool();
+		apply_spool(cfg);
+	}
+	if (jobs_changed)
+	{
+		job_set_t running = {0};
+		swap_jobs(&running);
+		watch_free();		// before service_free(), the units fd belongs to it
+		if (collectors_changed)
+		{
+			LOG(5, "<%d>Collector settings changed, restart the collectors\n");
+			free_collectors();
+			apply_collectors(cfg);
+		}
+		if (compression_changed)
+		{
+			free_compression();
+			apply_compression(cfg);
+		}
+		apply_jobs(cfg);
+		keep_job_state(&running, ! collectors_changed);
+		free_job_set(&running);
+		LOG(5, "<%d>Jobs changed, %d job(s)\n", job_count);
+
+		// the entries of the scheduler are of the jobs before
+		scheduler_clear(&scheduler);
+		watch_events();
+		// the triggered publishes of the old jobs are dropped
+		arm_timer_at(trigger_timer_fd, 0);
+	}
+
+	config_destroy(running_config);
+	free(running_config);
+	running_config = cfg;
+
+	if (broker_settings_changed(&previous))
+	{
+		LOG(5, "<%d>Broker settings changed, reconnect\n");
+		int err = 0;
+		err |= mosquitto_will_clear(mosq);
+		err |= mosquitto_unsubscribe(mosq, NULL, previous_sub_topic);
+		err |= mosquitto_disconnect(mosq);
+		if ( err )
+		{
+			LOG(4, "<%d>Error on discard broker connection\n");
+		}
+		if ( strcmp(previous.client_id, client_id) || 
+				(previous.persistent_session != persistent_session) )
+		{
+			// a new session, the callbacks are reset too
+			mosquitto_reinitialise(mosq, client_id, ! persistent_session, NULL);
+			set_mosquitto_callbacks();
+			subscribed = false;
+		}
+		reconnect_attempts = 0;
+		connect_broker();
+	}
+	else
+	{
+		update_subscription(previous_sub_topic, previous_qos);
+	}
+
+	if (! pause_flag)
+	{
+		schedule_jobs(deadlines, deadline_count);
+	}
+
+	free_deadlines(deadlines, deadline_count);
+	free(previous_sub_topic);
+	free_broker_settings(&previous);
+}
+
+/*******************************************/ /**
+ * @brief Processing of the received signals, called by the
+ *        main loop and not in the context of a signal handler
  * 
  * @param iSignal : catched signal number
  ***********************************************/
-void signal_handler(int iSignal)
+void handle_signal(int iSignal)
 {
 	switch (iSignal)
 	{
 	case SIGTERM:
 		// triggert by systemctl stop process
 		LOG(5, "<%d>Terminate signal triggered\n");
-		exit(EXIT_SUCCESS);
+		terminate_flag = true;
 		break;
 	case SIGINT:
 		// triggert by pressing Ctrl-C in terminal
-		//fflush(stdin);
 		LOG(5, "<%d>Ctrl-C signal triggered\n");
-		exit(EXIT_SUCCESS);
+		terminate_flag = true;
 		break;
 	case SIGHUP:
 		// trigger defined in *.service file ExecReload=
-		LOG(5, "<%d>Reload config\n");
-
-		int err = 0;
-		err |= mosquitto_will_clear(mosq);
-		err |= mosquitto_unsubscribe(mosq,	NULL, sub_topic);
-		err |= mosquitto_disconnect(mosq);
-		err |= mosquitto_loop_stop(mosq, false);
-		if ( err )
-		{
-			LOG(4, "<%d>Error on discard broker connection\n");
-		}
-
-		// Free allocated memory
-		discard_free_config();
-
-		read_config();
-		connect_broker();
+		reload_config();
 		break;
 	case SIGTSTP:
-		// triggert by pressing Ctrl-C in terminal
+		// triggert by pressing Ctrl-Z in terminal, the broker 
+		// connection is kept but nothing is published
 		LOG(5, "<%d>Ctrl-Z signal triggered -> process pause\n");
 		pause_flag = true;
+		arm_timer_at(sched_timer_fd, 0);
+		arm_timer_at(collect_timer_fd, 0);
+		collect_since = 0;
+		arm_timer_ms(sample_timer_fd, 0);
+		arm_timer_at(trigger_timer_fd, 0);
+		for (int i = 0; i < job_count; i++)
+		{
+			jobs[i].trigger_at = 0;
+			jobs[i].collect_since = 0;
+		}
 		break;
 	case SIGCONT:
 		// trigger by run 'kill -SIGCONT <PID>'
-		LOG(5, "<%d>Continue paused process\n");
-		pause_flag = false;
+		if (pause_flag)
+		{
+			LOG(5, "<%d>Continue paused process\n");
+			pause_flag = false;
+			schedule_jobs(NULL, 0);
+		}
 		break;
 	}
 }
 
 /*******************************************/ /**
- * @brief Initialize signals to be catched
+ * @brief Initialize signals to be catched. The signals are 
+ *        blocked and delivered by a signalfd to the main loop.
  * 
  ***********************************************/
 void init_signal_handler()
 {
-	struct sigaction new_action;
-
-	new_action.sa_handler = signal_handler;
-	sigfillset(&new_action.sa_mask);
-	new_action.sa_flags = 0;
-
-	// Register signal handler
-	if (sigaction(SIGTERM, &new_action, NULL))
-	{
-		ERROR_EXIT(err_register_sigaction);
-	}
-
-	if (sigaction(SIGHUP, &new_action, NULL) != 0)
-	{
-		ERROR_EXIT(err_register_sigaction);
-	}
+	sigemptyset(&catched_signals);
+	sigaddset(&catched_signals, SIGTERM);
+	sigaddset(&catched_signals, SIGHUP);
+	sigaddset(&catched_signals, SIGINT);
+	sigaddset(&catched_signals, SIGTSTP);
+	sigaddset(&catched_signals, SIGCONT);
 
-	if (sigaction(SIGINT, &new_action, NULL) != 0)
+	if (sigprocmask(SIG_BLOCK, &catched_signals, NULL))
 	{
 		ERROR_EXIT(err_register_sigaction);
 	}
 
-	if (sigaction(SIGTSTP, &new_action, NULL) != 0)
+	if ((signal_fd = signalfd(-1, &catched_signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
 	{
 		ERROR_EXIT(err_register_sigaction);
 	}
 
-	if (sigaction(SIGCONT, &new_action, NULL) != 0)
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = signal_fd };
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event))
 	{
 		ERROR_EXIT(err_register_sigaction);
 	}
@@ -948,47 +4135,126 @@ int main(int argc, char *argv[])
 	LOG(6, "<%d>Config file processed\n");
 
 	// Initialize connetction to MQTT broker
+	init_event_loop();
+	watch_events();
+	init_signal_handler();
 	init_mosquitto();
 	connect_broker();
+	schedule_jobs(NULL, 0);
 
-	// Initialize signals to be catched
-	init_signal_handler();
-
-	int stat_couter = stat_interval;
-	int tele_couter = tele_interval;
-
-	// Main Loop
-	while (1)
+	// Main Loop, drives the broker connection and waits for the 
+	// next timer without periodic wakeups
+	struct epoll_event events[MAX_EVENTS];
+	while (! terminate_flag)
 	{
-		if (shutdown_cmd)
+		int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+		if (count < 0)
 		{
-			continue;
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			ERROR_EXIT("epoll_wait");
 		}
-		
-		if (pause_flag)
-			pause();
 
-		if (connected && (! stat_couter--) && (stat_interval > 0)) {
-			pub_parsed = parse_string(pub_parsed, stat_pub_message);
-			LOG(6, "<%d>Sending status ... \n");
-			//LOG(6, "<%d>Sending heartbeat ... %s : %s\n", pub_topic, pub_parsed);
-			mosquitto_publish(mosq, NULL, stat_pub_topic, strlen(pub_parsed), pub_parsed, qos, false);
-			stat_couter = stat_interval;
-		}
+		for (int i = 0; i < count; i++)
+		{
+			int fd = events[i].data.fd;
 
-		if (connected && (! tele_couter--) && (tele_interval > 0)) {
-			pub_parsed = parse_string(pub_parsed, tele_pub_message);
-			LOG(6, "<%d>Sending telemetry ... \n");
-			//LOG(6, "<%d>Sending heartbeat ... %s : %s\n", pub_topic, pub_parsed);
-			mosquitto_publish(mosq, NULL, tele_pub_topic, strlen(pub_parsed), pub_parsed, qos, false);
-			tele_couter = tele_interval;
+			if (fd == mosq_fd)
+			{
+				handle_mosquitto(events[i].events);
+			}
+			else if (fd == sched_timer_fd)
+			{
+				if (read_timer(fd))
+				{
+					run_due_jobs();
+				}
+			}
+			else if (fd == collect_timer_fd)
+			{
+				if (read_timer(fd))
+				{
+					prefetch_jobs();
+				}
+			}
+			else if (fd == metrics_fd())
+			{
+				metrics_reap();
+				if (collect_since)
+				{
+					prefetch_jobs();
+				}
+				run_triggered_jobs();
+			}
+			else if (fd == signal_fd)
+			{
+				struct signalfd_siginfo info;
+				while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+				{
+					handle_signal(info.ssi_signo);
+				}
+			}
+			else if (fd == misc_timer_fd)
+			{
+				read_timer(fd);
+				mosquitto_loop_misc(mosq);
+			}
+			else if (fd == sample_timer_fd)
+			{
+				if (read_timer(fd))
+				{
+					sample_windows();
+				}
+			}
+			else if (fd == replay_timer_fd)
+			{
+				if (read_timer(fd))
+				{
+					replay_spool();
+				}
+			}
+			else if (fd == trigger_timer_fd)
+			{
+				if (read_timer(fd))
+				{
+					run_triggered_jobs();
+				}
+			}
+			else if (fd == reload_timer_fd)
+			{
+				if (read_timer(fd))
+				{
+					reload_config();
+				}
+			}
+			else if (fd == reconnect_timer_fd)
+			{
+				read_timer(fd);
+				LOG(5, "<%d>Reconnecting to MQTT-broker ...\n");
+				reconnect_pending = false;
+				int err = mosquitto_reconnect_async(mosq);
+				if (err)
+				{
+					LOG(4, "<%d>Unable to connect MQTT-broker : %s\n", mosquitto_strerror(err));
+					schedule_reconnect();
+				}
+			}
+			else
+			{
+				uint32_t fired = watch_read(fd);
+				if (fired)
+				{
+					trigger_jobs(fired);
+				}
+			}
 		}
 
-		sleep(1);
+		watch_mosquitto();
 	}
 
-	// This code is never executed but when it is, the process 
-	// is cleanly terminated with the function specified in atexit().
+	// The process is cleanly terminated with the function specified in atexit().
 	LOG(5, "<%d>Finished ...\n");
-	return EXIT_SUCCESS;
+	exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -1,4 +1,15 @@
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "metrics.h"
+#include "template.h"
+#include "policy.h"
+#include "encode.h"
+#include "compress.h"
+#include "rate.h"
+#include "window.h"
+#include "batch.h"
 
 /*******************************************/ /**
  * @brief Quality of Service levels list
@@ -16,6 +27,223 @@ enum stat_t
     STAT_ON = 1
 };
 
+/*******************************************/ /**
+ * @brief A message published periodically
+ ***********************************************/
+typedef struct publish_job_t
+{
+    char *topic;
+    char *message;
+    template_t tmpl;        // compiled message
+    uint32_t collectors;    // collectors referenced by the message
+    int interval;           // seconds, ZERO is never scheduled
+    int qos;
+    bool retain;
+    metric_value_t *values; // values of the dynamic tags of the last render
+    size_t value_count;
+    policy_t policy;        // decides if the values are worth publishing
+    enum payload_format_t format;
+    uint8_t *payload;       // buffer of a binary payload
+    size_t payload_size;
+    enum compress_algo_t compression;
+    size_t compress_threshold;  // payloads shorter than this are not compressed
+    uint8_t *compressed;        // buffer of a compressed payload
+    size_t compressed_size;
+    uint64_t bytes_in;          // totals of the compressed payloads
+    uint64_t bytes_out;
+    uint64_t compress_ns;       // CPU time of the compression
+    uint32_t triggers;          // watch sources that publish it at once, see watch.h
+    uint64_t debounce_ns;       // delay after a event to coalesce the following ones
+    uint64_t holdoff_ns;        // min. time between two triggered publishes
+    uint64_t trigger_at;        // CLOCK_MONOTONIC of a pending triggered publish, ZERO if none
+    uint64_t triggered_at;      // of the last triggered publish
+    uint64_t collect_since;     // start of the collectors of a triggered publish, ZERO if none
+    char *content_type;         // MQTT v5 content type, NULL derives it from the format
+    int expiry;                 // MQTT v5 message expiry in seconds, ZERO never
+    bool alias_sent;            // the broker knows the topic alias of the job
+    struct mqtt5__property *properties[2];  // MQTT v5 properties of a plain and a compressed payload
+    bool envelope;              // published in the envelope of the tick
+} publish_job_t;
+
+#define STAT_JOB 0  // the job of stat_pub_message, also published on terminate
+
+/*******************************************/ /**
+ * @brief Settings of the broker connection, only a change 
+ *        of them needs a reconnect on reload
+ ***********************************************/
+typedef struct broker_settings_t
+{
+    char *broker;
+    int port;
+    char *user;
+    char *password;
+    char *will_topic;
+    char *will_message;
+    char *client_id;
+    bool persistent_session;
+    int mqtt_version;
+} broker_settings_t;
+
+/*******************************************/ /**
+ * @brief Next deadline of a job, kept over a reload for the 
+ *        job with the same topic and interval
+ ***********************************************/
+typedef struct job_deadline_t
+{
+    char *topic;
+    int interval;
+    uint64_t deadline;      // CLOCK_MONOTONIC in nanoseconds
+} job_deadline_t;
+
+/*******************************************/ /**
+ * @brief Opcodes of the tags in a compiled template
+ ***********************************************/
+enum tag_op_t
+{
+    TAG_HOSTNAME = 1,
+    TAG_USER,
+    TAG_VERSION,
+    TAG_STATUS,
+    TAG_LOADAVG_1,
+    TAG_UPTIME,
+    TAG_RAMFREE,
+    TAG_DISKFREE_MB,
+    TAG_SERVICE,
+    TAG_PROCFS,
+    TAG_CPU_USAGE,
+    TAG_CPU_CORES,
+    TAG_CPU_CORE_MIN,
+    TAG_CPU_CORE_MAX,
+    TAG_CPU_CORE_MEAN,
+    TAG_CPU_CORE_P95,
+    TAG_CPU_BUSIEST,
+    TAG_RATE,
+    TAG_WINDOW,
+    TAG_MOUNT_TOTAL_MB,
+    TAG_MOUNT_FREE_MB,
+    TAG_MOUNT_AVAIL_MB,
+    TAG_MOUNT_USED_PCT,
+    TAG_MOUNTS,
+    TAG_MOUNTS_AVAIL_MB,
+    TAG_MOUNTS_STALE,
+    TAG_STALE,
+    TAG_CGROUP,
+    TAG_PSI,
+    TAG_PSI_ALERT,
+    TAG_BATCH_MESSAGES,
+    TAG_BATCH_WRITES,
+    TAG_BATCH_PACKETS,
+    TAG_COMPRESS_IN,
+    TAG_COMPRESS_OUT,
+    TAG_COMPRESS_RATIO,
+    TAG_COMPRESS_US
+};
+
+/*******************************************/ /**
+ * @brief A %rate(<tag>)% tag, the argument of the token 
+ *        is the index of it
+ ***********************************************/
+typedef struct rate_tag_t
+{
+    template_token_t counter;   // the tag of the counter
+    rate_t rate;
+} rate_tag_t;
+
+/*******************************************/ /**
+ * @brief Aggregates of a %min(<tag>)%, %max(<tag>)%, 
+ *        %avg(<tag>)% or %p<NN>(<tag>)% tag
+ ***********************************************/
+enum window_kind_t
+{
+    WINDOW_MIN,
+    WINDOW_MAX,
+    WINDOW_AVG,
+    WINDOW_QUANTILE
+};
+
+/*******************************************/ /**
+ * @brief A window tag, the argument of the token is the
+ *        index of it
+ ***********************************************/
+typedef struct window_tag_t
+{
+    template_token_t sample;    // the tag of the sampled value
+    enum window_kind_t kind;
+    double quantile;            // of WINDOW_QUANTILE, 0.0 to 1.0
+    window_t window;            // samples since the last render
+} window_tag_t;
+
+/*******************************************/ /**
+ * @brief The jobs and the state of their tags, a reload 
+ *        builds a new set before the running one is freed
+ ***********************************************/
+typedef struct job_set_t
+{
+    publish_job_t *jobs;
+    int *due_jobs;
+    int job_count;
+    rate_tag_t *rate_tags;
+    int rate_tag_count;
+    window_tag_t *window_tags;
+    int window_tag_count;
+    uint32_t window_collectors;
+    bool batch_counted;         // a template references the counters of the tick
+} job_set_t;
+
+/*******************************************/ /**
+ * @brief Names of the tags without argument
+ ***********************************************/
+const struct
+{
+    const char *name;
+    enum tag_op_t op;
+    uint32_t collectors;    // collectors to sample for the tag
+} tag_names[] = {
+    { "hostname", TAG_HOSTNAME, 0 },
+    { "user", TAG_USER, 0 },
+    { "version", TAG_VERSION, 0 },
+    { "status", TAG_STATUS, 0 },
+    { "stale", TAG_STALE, 0 },
+    { "psi_alert", TAG_PSI_ALERT, 0 },
+    { "batch_messages", TAG_BATCH_MESSAGES, 0 },
+    { "batch_writes", TAG_BATCH_WRITES, 0 },
+    { "batch_packets", TAG_BATCH_PACKETS, 0 },
+    { "compress_in", TAG_COMPRESS_IN, 0 },     // of the job of the message, see evaluate_job()
+    { "compress_out", TAG_COMPRESS_OUT, 0 },
+    { "compress_ratio", TAG_COMPRESS_RATIO, 0 },
+    { "compress_us", TAG_COMPRESS_US, 0 },
+    { "loadavg_1", TAG_LOADAVG_1, COLLECT_SYSINFO },
+    { "uptime", TAG_UPTIME, COLLECT_SYSINFO },
+    { "ramfree", TAG_RAMFREE, COLLECT_SYSINFO },
+    { "diskfree_mb", TAG_DISKFREE_MB, COLLECT_STATVFS },
+    { "diskfree", TAG_DISKFREE_MB, COLLECT_STATVFS },
+    { "cpu_usage", TAG_CPU_USAGE, COLLECT_CPUSTAT },
+    { "cpu_cores", TAG_CPU_CORES, COLLECT_CPUSTAT },
+    { "cpu_core_min", TAG_CPU_CORE_MIN, COLLECT_CPUSTAT },
+    { "cpu_core_max", TAG_CPU_CORE_MAX, COLLECT_CPUSTAT },
+    { "cpu_core_mean", TAG_CPU_CORE_MEAN, COLLECT_CPUSTAT },
+    { "cpu_core_p95", TAG_CPU_CORE_P95, COLLECT_CPUSTAT },
+    { "cpu_busiest", TAG_CPU_BUSIEST, COLLECT_CPUSTAT },
+    { "mounts", TAG_MOUNTS, COLLECT_MOUNTS },
+    { "mounts_avail_mb", TAG_MOUNTS_AVAIL_MB, COLLECT_MOUNTS },
+    { "mounts_stale", TAG_MOUNTS_STALE, COLLECT_MOUNTS }
+};
+
+/*******************************************/ /**
+ * @brief Names of the tags of a single mount, 
+ *        e.g. %mount_avail_mb(/home)%
+ ***********************************************/
+const struct
+{
+    const char *name;
+    enum tag_op_t op;
+} mount_tag_names[] = {
+    { "mount_total_mb", TAG_MOUNT_TOTAL_MB },
+    { "mount_free_mb", TAG_MOUNT_FREE_MB },
+    { "mount_avail_mb", TAG_MOUNT_AVAIL_MB },
+    { "mount_used_pct", TAG_MOUNT_USED_PCT }
+};
+
 const char *lock_socket_name = "/tmp/mqtt-heartbeat";
 
 const char *system_config_dir = "/etc/";
@@ -27,6 +255,7 @@ const char *status_on_string = "ON";
 const char *shutdown_poweroff = "--poweroff";
 const char *shutdown_reboot = "--reboot";
 const char *service_prefix = "service_";
+const char *rate_prefix = "rate(";
 const char *root_name = "root";
 
 /*******************************************/ /**
@@ -40,6 +269,8 @@ int qos = 0;
 int preset_qos = QOS_MOST_ONCE_DELIVERY;
 int shutdown_delay = 0;
 int preset_shutdown_delay = 0;
+int shutdown_drain_timeout = 0;
+int preset_shutdown_drain_timeout = 3000;
 
 char *mqtt_broker = NULL;
 const char *preset_mqtt_broker = "localhost";
@@ -47,6 +278,22 @@ char *broker_user = NULL;
 const char *preset_broker_user = "\0";
 char *broker_password = NULL;
 const char *preset_broker_password = "\0";
+char *client_id = NULL;
+const char *preset_client_id = "mqtt-heartbeat-\%hostname\%";
+bool persistent_session = false;
+bool preset_persistent_session = false; // the broker keeps subscriptions and QoS 1/2 messages
+int reconnect_delay_min = 0;
+int preset_reconnect_delay_min = 1;     // seconds, doubled on each failed attempt
+int reconnect_delay_max = 0;
+int preset_reconnect_delay_max = 120;
+int schedule_spread = 0;
+int preset_schedule_spread = 100;       // percent of the smallest interval, ZERO all hosts publish in lockstep
+bool schedule_align = false;
+bool preset_schedule_align = false;     // the cycles of the intervals start on the wall clock
+int mqtt_version = 0;
+int preset_mqtt_version = 311;          // 311 or 5
+int message_expiry = 0;
+int preset_message_expiry = -1;         // seconds, -1 two intervals of the job, ZERO never
 
 
 int stat_interval = 0;
@@ -65,6 +312,77 @@ char *tele_pub_topic = NULL;
 const char *preset_tele_pub_topic = "tele/\%hostname\%/STATE";
 char *tele_pub_message = NULL;
 const char *preset_tele_pub_message = "{\"POWER1\":\"\%status\%\"}";
+char *tele_format = NULL;
+const char *preset_tele_format = "text";
+char *tele_compression = NULL;
+const char *preset_tele_compression = "none";
+
+char *compress_dictionary = NULL;
+const char *preset_compress_dictionary = "\0";
+int compress_level = 0;
+int preset_compress_level = -1;        // default of the algorithm
+int compress_threshold = 0;
+int preset_compress_threshold = 256;   // bytes
+
+int preset_refresh_interval = 300;     // of a job with policy 'on_change' or 'deadband'
+
+char *stat_trigger = NULL;
+const char *preset_stat_trigger = "\0";
+char *tele_trigger = NULL;
+const char *preset_tele_trigger = "\0";
+int trigger_debounce_ms = 0;
+int preset_trigger_debounce_ms = 50;
+int trigger_holdoff_ms = 0;
+int preset_trigger_holdoff_ms = 5000;  // a flapping link publishes once per holdoff
+char *psi_triggers = NULL;
+const char *preset_psi_triggers = "\0";
+char *psi_alert_topic = NULL;
+const char *preset_psi_alert_topic = "tele/\%hostname\%/PSI";
+char *psi_alert_message = NULL;
+const char *preset_psi_alert_message = "{\"ALERT\":\"\%psi_alert\%\", \"CPU\": \%psi_cpu_some_avg10\%, "
+        "\"MEMORY\": \%psi_memory_some_avg10\%, \"IO\": \%psi_io_some_avg10\%}";
+
+bool batch_cork = false;
+bool preset_batch_cork = false;        // hold the segments of a tick back until all are written
+char *envelope_topic = NULL;
+const char *preset_envelope_topic = "tele/\%hostname\%/BATCH";
+char *envelope_format = NULL;
+const char *preset_envelope_format = "cbor";
+
+int collector_threads = 0;
+int preset_collector_threads = 2;
+int collector_timeout_ms = 0;
+int preset_collector_timeout_ms = 1000; // a slower collector is marked stale
+
+int sample_interval_ms = 0;
+int preset_sample_interval_ms = 0;     // ZERO, the windows get one sample per publish
+
+int cpu_busiest = 0;
+int preset_cpu_busiest = 3;
+
+char *cgroup_root = NULL;
+const char *preset_cgroup_root = "/sys/fs/cgroup/system.slice";
+
+char *mount_fstypes = NULL;
+const char *preset_mount_fstypes = "ext2,ext3,ext4,xfs,btrfs,f2fs,vfat,exfat,ntfs3,zfs,nfs,nfs4,cifs";
+char *mount_paths = NULL;
+const char *preset_mount_paths = "*";
+int mount_timeout_ms = 0;
+int preset_mount_timeout_ms = 500;     // max. wait for a hung network file system
+
+char *spool_file = NULL;
+const char *preset_spool_file = "\0";
+int spool_size = 0;
+int preset_spool_size = 1024;
+int spool_replay_rate = 0;
+int preset_spool_replay_rate = 10;
+
+char *service_backend = NULL;
+const char *preset_service_backend = "systemctl";
+char *service_state_file = NULL;
+const char *preset_service_state_file = "\0";
+int service_max_age = 0;
+int preset_service_max_age = 60;
 
 char *sub_topic = NULL;
 const char *preset_sub_topic = "\0";    // "cmnd/\%hostname\%/POWER1";
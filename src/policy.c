@@ -0,0 +1,236 @@
+/*******************************************/ /**
+ * @file policy.c
+ * @author marsman7 (you@domain.com)
+ * @brief Decides from the tag values of a job if a 
+ *        message is worth publishing.
+ *
+ * The decision is made from the typed values of the snapshot
+ * and not from the rendered text. 'on_change' compares a hash
+ * of all values. 'deadband' publishes if a number differs from
+ * the last published one by more than the absolute or the
+ * relative deadband, whichever is larger, or if a text value is
+ * changed. The refresh interval forces a publish to show the
+ * host is alive.
+ *
+ * @headerfile policy.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <errno.h>
+
+#include "policy.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static const char *mode_names[] = { "always", "on_change", "deadband" };
+
+/*******************************************/ /**
+ * @brief FNV-1a hash of a memory block
+ ***********************************************/
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+	const uint8_t *p = data;
+	while (length--)
+	{
+		hash ^= *p++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/*******************************************/ /**
+ * @brief Hash the values
+ *
+ * @param values - The values
+ * @param count - Count of values
+ * @param text_only - Hash only the text values
+ * @return uint64_t - The hash
+ ***********************************************/
+static uint64_t hash_values(const metric_value_t *values, size_t count, bool text_only)
+{
+	uint64_t hash = FNV_OFFSET;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const metric_value_t *value = &values[i];
+		hash = hash_bytes(hash, &value->type, sizeof(value->type));
+		switch (value->type)
+		{
+		case VALUE_INT:
+			if (! text_only)
+			{
+				hash = hash_bytes(hash, &value->i, sizeof(value->i));
+			}
+			break;
+		case VALUE_DOUBLE:
+			if (! text_only)
+			{
+				hash = hash_bytes(hash, &value->d, sizeof(value->d));
+			}
+			break;
+		case VALUE_TEXT:
+			// including the terminating zero separates adjacent texts
+			hash = hash_bytes(hash, value->text, strlen(value->text) + 1);
+			break;
+		default:
+			break;
+		}
+	}
+	return hash;
+}
+
+/*******************************************/ /**
+ * @brief Get the number of a value
+ ***********************************************/
+static double value_number(const metric_value_t *value)
+{
+	switch (value->type)
+	{
+	case VALUE_INT:
+		return value->i;
+	case VALUE_DOUBLE:
+		return value->d;
+	default:
+		return 0;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Get the policy by its name
+ *
+ * @param name - "always", "on_change" or "deadband"
+ * @return int - The enum policy_mode_t or -1 if unknown
+ ***********************************************/
+int policy_mode(const char *name)
+{
+	for (size_t i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++)
+	{
+		if (! strcasecmp(mode_names[i], name))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Initialize the policy of a job
+ *
+ * @param policy - Policy to fill
+ * @param mode - The policy
+ * @param deadband_abs - Absolute deadband
+ * @param deadband_rel - Relative deadband, e.g. 0.05 for 5 %
+ * @param refresh - Max. nanoseconds without publish, ZERO never
+ * @param count - Count of values of the job
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int policy_init(policy_t *policy, enum policy_mode_t mode, double deadband_abs, 
+		double deadband_rel, uint64_t refresh, size_t count)
+{
+	memset(policy, 0, sizeof(*policy));
+	policy->mode = mode;
+	policy->deadband_abs = fabs(deadband_abs);
+	policy->deadband_rel = fabs(deadband_rel);
+	policy->refresh = refresh;
+	policy->count = count;
+
+	if ((mode == POLICY_DEADBAND) && count)
+	{
+		if (! (policy->last = calloc(count, sizeof(double))))
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Check if the values are worth publishing
+ *
+ * @param policy - The policy of the job
+ * @param values - Current values, 'count' of policy_init()
+ * @param now - CLOCK_MONOTONIC in nanoseconds
+ * @return bool - TRUE to publish
+ ***********************************************/
+bool policy_check(const policy_t *policy, const metric_value_t *values, uint64_t now)
+{
+	if ((policy->mode == POLICY_ALWAYS) || (! policy->published))
+	{
+		return true;
+	}
+	if (policy->refresh && (now - policy->last_publish >= policy->refresh))
+	{
+		return true;
+	}
+
+	if (policy->mode == POLICY_ON_CHANGE)
+	{
+		return hash_values(values, policy->count, false) != policy->last_hash;
+	}
+
+	if (hash_values(values, policy->count, true) != policy->last_text_hash)
+	{
+		return true;
+	}
+	for (size_t i = 0; i < policy->count; i++)
+	{
+		if ((values[i].type != VALUE_INT) && (values[i].type != VALUE_DOUBLE))
+		{
+			continue;
+		}
+		double last = policy->last[i];
+		double band = policy->deadband_rel * fabs(last);
+		if (band < policy->deadband_abs)
+		{
+			band = policy->deadband_abs;
+		}
+		if (fabs(value_number(&values[i]) - last) > band)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/*******************************************/ /**
+ * @brief Remember the published values
+ *
+ * @param policy - The policy of the job
+ * @param values - Published values
+ * @param now - CLOCK_MONOTONIC in nanoseconds
+ ***********************************************/
+void policy_commit(policy_t *policy, const metric_value_t *values, uint64_t now)
+{
+	policy->published = true;
+	policy->last_publish = now;
+
+	switch (policy->mode)
+	{
+	case POLICY_ON_CHANGE:
+		policy->last_hash = hash_values(values, policy->count, false);
+		break;
+	case POLICY_DEADBAND:
+		policy->last_text_hash = hash_values(values, policy->count, true);
+		for (size_t i = 0; i < policy->count; i++)
+		{
+			policy->last[i] = value_number(&values[i]);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Give free the memory of the policy
+ ***********************************************/
+void policy_free(policy_t *policy)
+{
+	free(policy->last);
+	memset(policy, 0, sizeof(*policy));
+}
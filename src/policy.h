@@ -0,0 +1,51 @@
+/*******************************************/ /**
+ * @file policy.h
+ * @author marsman7 (you@domain.com)
+ * @brief Decides from the tag values of a job if a 
+ *        message is worth publishing.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "metrics.h"
+
+/*******************************************/ /**
+ * @brief Publish policies
+ ***********************************************/
+enum policy_mode_t
+{
+	POLICY_ALWAYS = 0,	/*!< publish on each tick */
+	POLICY_ON_CHANGE,	/*!< publish if a value is changed */
+	POLICY_DEADBAND		/*!< publish if a number leaves the deadband or a text is changed */
+};
+
+/*******************************************/ /**
+ * @brief Settings and state of the policy of one job
+ ***********************************************/
+typedef struct policy_t
+{
+	enum policy_mode_t mode;
+	double deadband_abs;	/*!< absolute deadband of the numbers */
+	double deadband_rel;	/*!< deadband relative to the last published number */
+	uint64_t refresh;	/*!< publish at least after this nanoseconds, ZERO never */
+	double *last;		/*!< numbers of the last published values */
+	size_t count;
+	uint64_t last_hash;	/*!< hash of all last published values */
+	uint64_t last_text_hash;	/*!< hash of the last published texts */
+	uint64_t last_publish;	/*!< CLOCK_MONOTONIC in nanoseconds */
+	bool published;
+} policy_t;
+
+int policy_mode(const char *);
+int policy_init(policy_t *, enum policy_mode_t, double, double, uint64_t, size_t);
+bool policy_check(const policy_t *, const metric_value_t *, uint64_t);
+void policy_commit(policy_t *, const metric_value_t *, uint64_t);
+void policy_free(policy_t *);
+
+#endif
@@ -0,0 +1,560 @@
+/*******************************************/ /**
+ * @file procfs.c
+ * @author marsman7 (you@domain.com)
+ * @brief Values of /proc files referenced by tags, read 
+ *        through fds that are kept open.
+ *
+ * A tag names a source file, a row and a column, for example
+ * %net_rx_bytes_eth0% is the column 'rx_bytes' of the row 'eth0'
+ * in /proc/net/dev. A source is opened on the first tag that
+ * references it. Each update reads it with pread() from offset
+ * ZERO into a buffer that is reused, and scans it once without
+ * allocation. The rows of a source are found by a hash of the 
+ * key, so the cost of an update depends on the size of the files
+ * and not on the count of tags.
+ *
+ * Tags :
+ *   mem_<field>_mb, mem_<field>_kb   - /proc/meminfo, e.g. mem_available_mb
+ *   net_<column>_<interface>        - /proc/net/dev, e.g. net_tx_packets_eth0
+ *   disk_<column>_<device>          - /proc/diskstats, e.g. disk_read_bytes_sda
+ *   vm_<field>                      - /proc/vmstat, e.g. vm_pgmajfault
+ *
+ * The keys are case insensitive.
+ *
+ * @headerfile procfs.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procfs.h"
+
+#define PROC_KEY_SIZE 32	/*!< max. length of a row key incl. zero */
+#define PROC_MAX_COLUMNS 16	/*!< columns after the key that are parsed */
+#define PROC_BUFFER_SIZE 8192	/*!< first size of a read buffer, doubled if too small */
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+enum proc_source_id_t
+{
+	PROC_MEMINFO = 0,
+	PROC_NET_DEV,
+	PROC_DISKSTATS,
+	PROC_VMSTAT,
+	PROC_SOURCES
+};
+
+/*******************************************/ /**
+ * @brief Named column of a source
+ ***********************************************/
+typedef struct proc_column_t
+{
+	const char *name;
+	uint8_t column;		/*!< index after the key */
+	uint16_t multiplier;	/*!< to convert into the unit of the tag */
+} proc_column_t;
+
+/*******************************************/ /**
+ * @brief A tag family, the tag name is 
+ *        <prefix>[<column>_]<key><suffix>
+ ***********************************************/
+typedef struct proc_family_t
+{
+	const char *prefix;
+	const char *suffix;	/*!< NULL for none */
+	enum proc_source_id_t source;
+	const proc_column_t *columns;	/*!< NULL if the value is in column ZERO */
+	uint16_t divisor;	/*!< to convert into the unit of the tag */
+} proc_family_t;
+
+/*******************************************/ /**
+ * @brief A row of a source referenced by a tag
+ ***********************************************/
+typedef struct proc_row_t
+{
+	char key[PROC_KEY_SIZE];	/*!< lower case */
+	uint32_t hash;
+	uint8_t columns;	/*!< count of columns to parse */
+	bool found;		/*!< found by the last update */
+	uint64_t values[PROC_MAX_COLUMNS];
+} proc_row_t;
+
+/*******************************************/ /**
+ * @brief A file in /proc and its referenced rows
+ ***********************************************/
+typedef struct proc_source_t
+{
+	const char *path;
+	uint8_t key_token;	/*!< index of the key in the tokens of a line */
+	int fd;
+	char *buffer;
+	size_t size;
+	proc_row_t *rows;
+	size_t row_count;
+	int32_t *index;		/*!< open addressing hash table of row indexes, -1 is empty */
+	size_t index_size;	/*!< a power of 2 */
+} proc_source_t;
+
+/*******************************************/ /**
+ * @brief A value referenced by a tag
+ ***********************************************/
+typedef struct proc_metric_t
+{
+	uint8_t source;
+	uint8_t column;
+	uint16_t multiplier;
+	uint16_t divisor;
+	uint32_t row;
+} proc_metric_t;
+
+static const proc_column_t net_columns[] = {
+	{ "rx_bytes", 0, 1 }, { "rx_packets", 1, 1 }, { "rx_errs", 2, 1 }, { "rx_drop", 3, 1 },
+	{ "tx_bytes", 8, 1 }, { "tx_packets", 9, 1 }, { "tx_errs", 10, 1 }, { "tx_drop", 11, 1 },
+	{ NULL, 0, 0 }
+};
+
+static const proc_column_t disk_columns[] = {
+	{ "reads", 0, 1 }, { "read_bytes", 2, 512 }, { "read_ms", 3, 1 },
+	{ "writes", 4, 1 }, { "write_bytes", 6, 512 }, { "write_ms", 7, 1 },
+	{ "inflight", 8, 1 }, { "io_ms", 9, 1 },
+	{ NULL, 0, 0 }
+};
+
+static const proc_family_t families[] = {
+	{ "mem_", "_mb", PROC_MEMINFO, NULL, 1024 },
+	{ "mem_", "_kb", PROC_MEMINFO, NULL, 1 },
+	{ "net_", NULL, PROC_NET_DEV, net_columns, 1 },
+	{ "disk_", NULL, PROC_DISKSTATS, disk_columns, 1 },
+	{ "vm_", NULL, PROC_VMSTAT, NULL, 1 }
+};
+
+// Short names of the meminfo fields with the prefix 'Mem'
+static const char *mem_aliases[][2] = {
+	{ "total", "memtotal" }, { "free", "memfree" }, { "available", "memavailable" }
+};
+
+static proc_source_t sources[PROC_SOURCES] = {
+	{ .path = "/proc/meminfo", .key_token = 0, .fd = -1 },
+	{ .path = "/proc/net/dev", .key_token = 0, .fd = -1 },
+	{ .path = "/proc/diskstats", .key_token = 2, .fd = -1 },
+	{ .path = "/proc/vmstat", .key_token = 0, .fd = -1 }
+};
+
+static proc_metric_t *metrics = NULL;
+static int metric_count = 0;
+
+/*******************************************/ /**
+ * @brief FNV-1a hash of a key, lower case
+ ***********************************************/
+static uint32_t hash_key(const char *key, size_t length)
+{
+	uint32_t hash = FNV_OFFSET;
+	while (length--)
+	{
+		hash ^= (uint8_t)tolower((unsigned char)*key++);
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/*******************************************/ /**
+ * @brief Find a row by its key
+ *
+ * @return int - Index of the row, -1 if not found
+ ***********************************************/
+static int find_row(const proc_source_t *source, const char *key, size_t length, uint32_t hash)
+{
+	if ((! source->index_size) || (length >= PROC_KEY_SIZE))
+	{
+		return -1;
+	}
+
+	for (size_t slot = hash & (source->index_size - 1); source->index[slot] >= 0;
+			slot = (slot + 1) & (source->index_size - 1))
+	{
+		const proc_row_t *row = &source->rows[source->index[slot]];
+		if ((row->hash == hash) && (! strncasecmp(row->key, key, length)) && (! row->key[length]))
+		{
+			return source->index[slot];
+		}
+	}
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Rebuild the hash table of the rows, sized to 
+ *        be at most half full
+ *
+ * @return int - ZERO at successfully, otherwise -1
+ ***********************************************/
+static int build_index(proc_source_t *source)
+{
+	size_t size = 8;
+	while (size < source->row_count * 2)
+	{
+		size <<= 1;
+	}
+
+	int32_t *index = malloc(size * sizeof(int32_t));
+	if (! index)
+	{
+		return -1;
+	}
+	memset(index, 0xff, size * sizeof(int32_t));
+
+	for (size_t i = 0; i < source->row_count; i++)
+	{
+		size_t slot = source->rows[i].hash & (size - 1);
+		while (index[slot] >= 0)
+		{
+			slot = (slot + 1) & (size - 1);
+		}
+		index[slot] = i;
+	}
+
+	free(source->index);
+	source->index = index;
+	source->index_size = size;
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the row of a key, add it if it is new
+ *
+ * @return int - Index of the row, -1 on error and errno is set
+ ***********************************************/
+static int add_row(proc_source_t *source, const char *key, size_t length, uint8_t column)
+{
+	if ((length == 0) || (length >= PROC_KEY_SIZE))
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	uint32_t hash = hash_key(key, length);
+	int index = find_row(source, key, length, hash);
+	if (index < 0)
+	{
+		if (source->fd < 0)
+		{
+			if ((source->fd = open(source->path, O_RDONLY | O_CLOEXEC)) < 0)
+			{
+				return -1;
+			}
+		}
+
+		proc_row_t *rows = realloc(source->rows, (source->row_count + 1) * sizeof(proc_row_t));
+		if (! rows)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		source->rows = rows;
+
+		proc_row_t *row = &rows[source->row_count];
+		memset(row, 0, sizeof(*row));
+		for (size_t i = 0; i < length; i++)
+		{
+			row->key[i] = tolower((unsigned char)key[i]);
+		}
+		row->hash = hash;
+		index = source->row_count++;
+
+		if (build_index(source))
+		{
+			source->row_count--;
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	if (source->rows[index].columns <= column)
+	{
+		source->rows[index].columns = column + 1;
+	}
+	return index;
+}
+
+/*******************************************/ /**
+ * @brief Register a tag
+ *
+ * @param name - Name of the tag, not terminated
+ * @param length - Length of the name
+ * @return int - Index for procfs_value(), -1 on error and errno 
+ *               is ENOENT if the name is not a procfs tag
+ ***********************************************/
+int procfs_register(const char *name, size_t length)
+{
+	for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++)
+	{
+		const proc_family_t *family = &families[f];
+		size_t prefix_length = strlen(family->prefix);
+		size_t suffix_length = family->suffix ? strlen(family->suffix) : 0;
+
+		if ( (length <= prefix_length + suffix_length) || 
+				strncasecmp(name, family->prefix, prefix_length) ||
+				(suffix_length && strncasecmp(name + length - suffix_length, family->suffix, suffix_length)) )
+		{
+			continue;
+		}
+
+		const char *key = name + prefix_length;
+		size_t key_length = length - prefix_length - suffix_length;
+		proc_metric_t metric = { .source = family->source, .multiplier = 1, .divisor = family->divisor };
+
+		if (family->columns)
+		{
+			const proc_column_t *column = family->columns;
+			for (; column->name; column++)
+			{
+				size_t column_length = strlen(column->name);
+				if ((key_length > column_length + 1) && (! strncasecmp(key, column->name, column_length)) &&
+						(key[column_length] == '_'))
+				{
+					break;
+				}
+			}
+			if (! column->name)
+			{
+				continue;
+			}
+			key += strlen(column->name) + 1;
+			key_length -= strlen(column->name) + 1;
+			metric.column = column->column;
+			metric.multiplier = column->multiplier;
+		}
+		else if (family->source == PROC_MEMINFO)
+		{
+			for (size_t i = 0; i < sizeof(mem_aliases) / sizeof(mem_aliases[0]); i++)
+			{
+				if ((strlen(mem_aliases[i][0]) == key_length) && (! strncasecmp(key, mem_aliases[i][0], key_length)))
+				{
+					key = mem_aliases[i][1];
+					key_length = strlen(key);
+					break;
+				}
+			}
+		}
+
+		int row = add_row(&sources[metric.source], key, key_length, metric.column);
+		if (row < 0)
+		{
+			return -1;
+		}
+		metric.row = row;
+
+		// the templates of a reload register their tags again
+		for (int i = 0; i < metric_count; i++)
+		{
+			if ( (metrics[i].source == metric.source) && (metrics[i].row == metric.row) &&
+					(metrics[i].column == metric.column) && (metrics[i].multiplier == metric.multiplier) )
+			{
+				return i;
+			}
+		}
+
+		proc_metric_t *new_metrics = realloc(metrics, (metric_count + 1) * sizeof(proc_metric_t));
+		if (! new_metrics)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		metrics = new_metrics;
+		metrics[metric_count] = metric;
+		return metric_count++;
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Read a source into its buffer, the buffer grows 
+ *        if the file does not fit
+ *
+ * @return ssize_t - Length of the content, -1 on error
+ ***********************************************/
+static ssize_t read_source(proc_source_t *source)
+{
+	for (;;)
+	{
+		if (! source->buffer)
+		{
+			size_t size = source->size ? source->size * 2 : PROC_BUFFER_SIZE;
+			if (! (source->buffer = malloc(size)))
+			{
+				errno = ENOMEM;
+				return -1;
+			}
+			source->size = size;
+		}
+
+		ssize_t length = pread(source->fd, source->buffer, source->size, 0);
+		if ((length < 0) || ((size_t)length < source->size))
+		{
+			return length;
+		}
+
+		// maybe truncated, retry with a larger buffer
+		free(source->buffer);
+		source->buffer = NULL;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Scan the content of a source and store the columns 
+ *        of the referenced rows
+ ***********************************************/
+static void scan_source(proc_source_t *source, size_t length)
+{
+	const char *p = source->buffer;
+	const char *end = p + length;
+
+	for (size_t i = 0; i < source->row_count; i++)
+	{
+		source->rows[i].found = false;
+	}
+
+	while (p < end)
+	{
+		const char *line_end = memchr(p, '\n', end - p);
+		if (! line_end)
+		{
+			line_end = end;
+		}
+
+		// the key is a token separated by white spaces or ':'
+		const char *key = NULL;
+		size_t key_length = 0;
+		for (int token = 0; token <= source->key_token; token++)
+		{
+			while ((p < line_end) && ((*p == ' ') || (*p == '\t') || (*p == ':')))
+			{
+				p++;
+			}
+			key = p;
+			while ((p < line_end) && (*p != ' ') && (*p != '\t') && (*p != ':'))
+			{
+				p++;
+			}
+			key_length = p - key;
+		}
+
+		int index = find_row(source, key, key_length, hash_key(key, key_length));
+		if (index >= 0)
+		{
+			proc_row_t *row = &source->rows[index];
+			for (int column = 0; column < row->columns; column++)
+			{
+				while ((p < line_end) && ((*p < '0') || (*p > '9')))
+				{
+					p++;
+				}
+				uint64_t value = 0;
+				while ((p < line_end) && (*p >= '0') && (*p <= '9'))
+				{
+					value = value * 10 + (*p++ - '0');
+				}
+				row->values[column] = value;
+			}
+			row->found = true;
+		}
+
+		p = line_end + 1;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Read all sources with referenced rows
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int procfs_update()
+{
+	int result = 0;
+
+	for (int i = 0; i < PROC_SOURCES; i++)
+	{
+		proc_source_t *source = &sources[i];
+		if (! source->row_count)
+		{
+			continue;
+		}
+
+		ssize_t length = read_source(source);
+		if (length < 0)
+		{
+			for (size_t r = 0; r < source->row_count; r++)
+			{
+				source->rows[r].found = false;
+			}
+			result = -1;
+			continue;
+		}
+		scan_source(source, length);
+	}
+
+	return result;
+}
+
+/*******************************************/ /**
+ * @brief Get a value of the last update
+ *
+ * @param index - Index given by procfs_register()
+ * @param value - Stores the value
+ * @return int - ZERO at successfully, -1 if the row was not found
+ ***********************************************/
+int procfs_value(int index, long long *value)
+{
+	if ((index < 0) || (index >= metric_count))
+	{
+		return -1;
+	}
+
+	const proc_metric_t *metric = &metrics[index];
+	const proc_row_t *row = &sources[metric->source].rows[metric->row];
+	if (! row->found)
+	{
+		return -1;
+	}
+
+	*value = row->values[metric->column] * metric->multiplier / metric->divisor;
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Close the sources and forget all tags
+ ***********************************************/
+void procfs_free()
+{
+	for (int i = 0; i < PROC_SOURCES; i++)
+	{
+		proc_source_t *source = &sources[i];
+		if (source->fd >= 0)
+		{
+			close(source->fd);
+		}
+		free(source->buffer);
+		free(source->rows);
+		free(source->index);
+		source->fd = -1;
+		source->buffer = NULL;
+		source->size = 0;
+		source->rows = NULL;
+		source->row_count = 0;
+		source->index = NULL;
+		source->index_size = 0;
+	}
+	free(metrics);
+	metrics = NULL;
+	metric_count = 0;
+}
@@ -0,0 +1,19 @@
+/*******************************************/ /**
+ * @file procfs.h
+ * @author marsman7 (you@domain.com)
+ * @brief Values of /proc files referenced by tags, read 
+ *        through fds that are kept open.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include <stddef.h>
+
+int procfs_register(const char *, size_t);
+int procfs_update();
+int procfs_value(int, long long *);
+void procfs_free();
+
+#endif
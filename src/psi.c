@@ -0,0 +1,469 @@
+/*******************************************/ /**
+ * @file psi.c
+ * @author marsman7 (you@domain.com)
+ * @brief Pressure stall information of /proc/pressure and
+ *        kernel PSI triggers that report a stall at once.
+ *
+ * The files are opened on the first update and read with
+ * pread() from offset ZERO. Each file has the lines
+ * "some avg10=<pct> avg60=<pct> avg300=<pct> total=<usec>" and
+ * "full ...", "some" is the share of time at least one task
+ * stalls on the resource, "full" all tasks at once.
+ *
+ * Tags :
+ *   psi_<resource>_<some|full>_<avg10|avg60|avg300> - percent
+ *   psi_<resource>_<some|full>_total - stall time in microseconds,
+ *                                      counter
+ * <resource> is "cpu", "memory", "io" or "irq".
+ *
+ * A trigger is a pressure file opened for writing with a
+ * threshold written to it, e.g. "some 150000 1000000" : 150 ms
+ * stall within 1 s. The kernel reports the crossing by POLLPRI
+ * on the fd, at most once per window as long as it lasts. The
+ * caller watches the fds and calls psi_trigger_read(), the
+ * triggers that fired are listed by psi_alert() until
+ * psi_alert_clear() is called.
+ *
+ * @headerfile psi.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "psi.h"
+
+#define PSI_PREFIX "psi_"
+#define PSI_DIR "/proc/pressure/"
+#define PSI_BUFFER_SIZE 256		/*!< enough for the two lines of a file */
+#define PSI_MIN_WINDOW_MS 500		/*!< limits of the kernel */
+#define PSI_MAX_WINDOW_MS 10000
+
+enum psi_resource_t
+{
+	PSI_CPU = 0,
+	PSI_MEMORY,
+	PSI_IO,
+	PSI_IRQ,
+	PSI_RESOURCES
+};
+
+enum psi_line_t
+{
+	PSI_SOME = 0,
+	PSI_FULL,
+	PSI_LINES
+};
+
+enum psi_field_t
+{
+	PSI_AVG10 = 0,
+	PSI_AVG60,
+	PSI_AVG300,
+	PSI_TOTAL,
+	PSI_FIELDS
+};
+
+static const char *resource_names[PSI_RESOURCES] = { "cpu", "memory", "io", "irq" };
+static const char *line_names[PSI_LINES] = { "some", "full" };
+static const char *field_names[PSI_FIELDS] = { "avg10", "avg60", "avg300", "total" };
+
+/*******************************************/ /**
+ * @brief A pressure file referenced by tags
+ ***********************************************/
+typedef struct psi_file_t
+{
+	int fd;
+	bool used;			/*!< referenced by a tag */
+	bool valid[PSI_LINES];		/*!< line read by the last update */
+	double avg[PSI_LINES][PSI_TOTAL];
+	unsigned long long total[PSI_LINES];
+} psi_file_t;
+
+/*******************************************/ /**
+ * @brief A value referenced by a tag
+ ***********************************************/
+typedef struct psi_metric_t
+{
+	enum psi_resource_t resource;
+	enum psi_line_t line;
+	enum psi_field_t field;
+} psi_metric_t;
+
+/*******************************************/ /**
+ * @brief A registered trigger
+ ***********************************************/
+typedef struct psi_trigger_t
+{
+	int fd;
+	enum psi_resource_t resource;
+	enum psi_line_t line;
+	unsigned stall_ms;
+	unsigned window_ms;
+	bool fired;			/*!< since psi_alert_clear() */
+} psi_trigger_t;
+
+static psi_file_t files[PSI_RESOURCES] = {
+	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+};
+static psi_metric_t *metrics = NULL;
+static int metric_count = 0;
+static psi_trigger_t triggers[PSI_MAX_TRIGGERS];
+static int trigger_count = 0;
+static char alert[PSI_ALERT_SIZE];
+
+/*******************************************/ /**
+ * @brief Find a name of a table at the start of a string,
+ *        followed by a separator
+ *
+ * @param names - The table
+ * @param count - Count of names in the table
+ * @param name - The string, not terminated
+ * @param length - Length of the string, the length of the
+ *                 name incl. the separator is subtracted
+ * @param separator - Character after the name, '\0' if the
+ *                    name ends the string
+ * @return int - Index in the table, -1 if not found
+ ***********************************************/
+static int find_name(const char **names, int count, const char **name, size_t *length, char separator)
+{
+	for (int i = 0; i < count; i++)
+	{
+		size_t name_length = strlen(names[i]);
+		if ( (*length >= name_length) && (! strncasecmp(*name, names[i], name_length)) &&
+				(separator ? ((*length > name_length) && ((*name)[name_length] == separator)) :
+					(*length == name_length)) )
+		{
+			name_length += (separator != '\0');
+			*name += name_length;
+			*length -= name_length;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Register a tag, e.g. "psi_memory_some_avg10"
+ *
+ * @param name - The tag name, not terminated
+ * @param length - Length of the name
+ * @return int - Index for psi_value(), -1 and errno is
+ *               ENOENT if it is not a PSI tag
+ ***********************************************/
+int psi_register(const char *name, size_t length)
+{
+	size_t prefix_length = strlen(PSI_PREFIX);
+	if ((length <= prefix_length) || strncasecmp(name, PSI_PREFIX, prefix_length))
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	name += prefix_length;
+	length -= prefix_length;
+
+	int resource = find_name(resource_names, PSI_RESOURCES, &name, &length, '_');
+	int line = (resource < 0) ? -1 : find_name(line_names, PSI_LINES, &name, &length, '_');
+	int field = (line < 0) ? -1 : find_name(field_names, PSI_FIELDS, &name, &length, '\0');
+	if (field < 0)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	// the templates of a reload register their tags again
+	for (int i = 0; i < metric_count; i++)
+	{
+		if ((metrics[i].resource == resource) && (metrics[i].line == line) && (metrics[i].field == field))
+		{
+			return i;
+		}
+	}
+
+	psi_metric_t *new_metrics = realloc(metrics, (metric_count + 1) * sizeof(psi_metric_t));
+	if (! new_metrics)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	metrics = new_metrics;
+	metrics[metric_count].resource = resource;
+	metrics[metric_count].line = line;
+	metrics[metric_count].field = field;
+	files[resource].used = true;
+	return metric_count++;
+}
+
+/*******************************************/ /**
+ * @brief Parse the content of a pressure file
+ ***********************************************/
+static void parse_file(psi_file_t *file, const char *buffer)
+{
+	for (int line = 0; line < PSI_LINES; line++)
+	{
+		const char *p = strstr(buffer, line_names[line]);
+		file->valid[line] = p && (sscanf(p + strlen(line_names[line]),
+				" avg10=%lf avg60=%lf avg300=%lf total=%llu", &file->avg[line][PSI_AVG10],
+				&file->avg[line][PSI_AVG60], &file->avg[line][PSI_AVG300], &file->total[line]) == 4);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Read the referenced pressure files. A file that does
+ *        not exist has no values, that is not a error.
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int psi_update()
+{
+	char buffer[PSI_BUFFER_SIZE];
+	char path[64];
+
+	for (int i = 0; i < PSI_RESOURCES; i++)
+	{
+		psi_file_t *file = &files[i];
+		file->valid[PSI_SOME] = false;
+		file->valid[PSI_FULL] = false;
+		if (! file->used)
+		{
+			continue;
+		}
+		if (file->fd < 0)
+		{
+			snprintf(path, sizeof(path), PSI_DIR "%s", resource_names[i]);
+			if ((file->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+			{
+				// no PSI in the kernel, disabled by psi=0 or no irq accounting
+				if ((errno != ENOENT) && (errno != EOPNOTSUPP))
+				{
+					return -1;
+				}
+				continue;
+			}
+		}
+
+		ssize_t length = pread(file->fd, buffer, sizeof(buffer) - 1, 0);
+		if (length < 0)
+		{
+			return -1;
+		}
+		buffer[length] = '\0';
+		parse_file(file, buffer);
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the value of a registered tag
+ *
+ * @param index - Index returned by psi_register()
+ * @param value - Stores the typed value
+ * @return int - ZERO at successfully, -1 if the line was not read
+ ***********************************************/
+int psi_value(int index, metric_value_t *value)
+{
+	if ((index < 0) || (index >= metric_count) ||
+			(! files[metrics[index].resource].valid[metrics[index].line]))
+	{
+		value->type = VALUE_NONE;
+		return -1;
+	}
+
+	const psi_metric_t *metric = &metrics[index];
+	const psi_file_t *file = &files[metric->resource];
+	if (metric->field == PSI_TOTAL)
+	{
+		value->type = VALUE_INT;
+		value->i = file->total[metric->line];
+	}
+	else
+	{
+		value->type = VALUE_DOUBLE;
+		value->d = file->avg[metric->line][metric->field];
+	}
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Register a trigger
+ *
+ * @param spec - "<resource> <some|full> <stall_ms> <window_ms>",
+ *               not terminated, e.g. "memory some 150 1000"
+ * @param length - Length of the spec
+ * @return int - Index of the trigger, otherwise -1 and errno is
+ *               set, EINVAL for a invalid spec
+ ***********************************************/
+int psi_trigger(const char *spec, size_t length)
+{
+	char text[64];
+	char resource_name[16];
+	char line_name[8];
+	unsigned stall_ms;
+	unsigned window_ms;
+	int end = 0;
+
+	if (trigger_count >= PSI_MAX_TRIGGERS)
+	{
+		errno = ENOSPC;
+		return -1;
+	}
+	if (length >= sizeof(text))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(text, spec, length);
+	text[length] = '\0';
+	if ( (sscanf(text, "%15s %7s %u %u %n", resource_name, line_name, &stall_ms, &window_ms, &end) != 4) ||
+			(end != (int)length) || (! stall_ms) || (stall_ms > window_ms) ||
+			(window_ms < PSI_MIN_WINDOW_MS) || (window_ms > PSI_MAX_WINDOW_MS) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	const char *name = resource_name;
+	size_t name_length = strlen(resource_name);
+	int resource = find_name(resource_names, PSI_RESOURCES, &name, &name_length, '\0');
+	name = line_name;
+	name_length = strlen(line_name);
+	int line = find_name(line_names, PSI_LINES, &name, &name_length, '\0');
+	if ((resource < 0) || (line < 0))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), PSI_DIR "%s", resource_names[resource]);
+	int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	// the kernel takes the threshold in microseconds, incl. the terminating zero
+	int text_length = snprintf(text, sizeof(text), "%s %u %u", line_names[line],
+			stall_ms * 1000, window_ms * 1000);
+	if (write(fd, text, text_length + 1) < 0)
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	psi_trigger_t *trigger = &triggers[trigger_count];
+	trigger->fd = fd;
+	trigger->resource = resource;
+	trigger->line = line;
+	trigger->stall_ms = stall_ms;
+	trigger->window_ms = window_ms;
+	trigger->fired = false;
+	return trigger_count++;
+}
+
+/*******************************************/ /**
+ * @brief Get the fds of the triggers to watch for POLLPRI
+ *
+ * @param fds - Stores the fds, space for PSI_MAX_TRIGGERS
+ * @return int - Count of stored fds
+ ***********************************************/
+int psi_trigger_fds(int *fds)
+{
+	for (int i = 0; i < trigger_count; i++)
+	{
+		fds[i] = triggers[i].fd;
+	}
+	return trigger_count;
+}
+
+/*******************************************/ /**
+ * @brief Take a event of a trigger fd. The event is consumed
+ *        by the poll, there is nothing to read.
+ *
+ * @param fd - A fd of psi_trigger_fds()
+ * @return bool - TRUE if it is the fd of a trigger
+ ***********************************************/
+bool psi_trigger_read(int fd)
+{
+	for (int i = 0; i < trigger_count; i++)
+	{
+		if (triggers[i].fd == fd)
+		{
+			triggers[i].fired = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*******************************************/ /**
+ * @brief Get the triggers that fired since the last
+ *        psi_alert_clear()
+ *
+ * @return const char* - Comma separated triggers like they are
+ *                       registered, e.g. "memory some 150 1000",
+ *                       empty if none fired
+ ***********************************************/
+const char *psi_alert()
+{
+	size_t length = 0;
+	alert[0] = '\0';
+	for (int i = 0; (i < trigger_count) && (length < sizeof(alert)); i++)
+	{
+		const psi_trigger_t *trigger = &triggers[i];
+		if (trigger->fired)
+		{
+			int written = snprintf(alert + length, sizeof(alert) - length, "%s%s %s %u %u",
+					length ? "," : "", resource_names[trigger->resource], line_names[trigger->line],
+					trigger->stall_ms, trigger->window_ms);
+			if ((written < 0) || (length + written >= sizeof(alert)))
+			{
+				// keep complete entries only
+				alert[length] = '\0';
+				break;
+			}
+			length += written;
+		}
+	}
+	return alert;
+}
+
+/*******************************************/ /**
+ * @brief Forget the fired triggers
+ ***********************************************/
+void psi_alert_clear()
+{
+	for (int i = 0; i < trigger_count; i++)
+	{
+		triggers[i].fired = false;
+	}
+}
+
+/*******************************************/ /**
+ * @brief Close all files and triggers and forget the tags
+ ***********************************************/
+void psi_free()
+{
+	for (int i = 0; i < PSI_RESOURCES; i++)
+	{
+		if (files[i].fd >= 0)
+		{
+			close(files[i].fd);
+		}
+		memset(&files[i], 0, sizeof(files[i]));
+		files[i].fd = -1;
+	}
+	free(metrics); metrics = NULL;
+	metric_count = 0;
+	for (int i = 0; i < trigger_count; i++)
+	{
+		close(triggers[i].fd);
+	}
+	trigger_count = 0;
+}
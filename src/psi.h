@@ -0,0 +1,30 @@
+/*******************************************/ /**
+ * @file psi.h
+ * @author marsman7 (you@domain.com)
+ * @brief Pressure stall information of /proc/pressure and
+ *        kernel PSI triggers that report a stall at once.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef PSI_H
+#define PSI_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "metrics.h"
+
+#define PSI_MAX_TRIGGERS 8		/*!< max. count of triggers */
+#define PSI_ALERT_SIZE 256		/*!< max. length of the alert text incl. zero */
+
+int psi_register(const char *, size_t);
+int psi_update();
+int psi_value(int, metric_value_t *);
+int psi_trigger(const char *, size_t);
+int psi_trigger_fds(int *);
+bool psi_trigger_read(int);
+const char *psi_alert();
+void psi_alert_clear();
+void psi_free();
+
+#endif
@@ -0,0 +1,78 @@
+/*******************************************/ /**
+ * @file rate.c
+ * @author marsman7 (you@domain.com)
+ * @brief Rate per second of a counter from two samples,
+ *        with detection of counter wrap and reset.
+ *
+ * A counter that decreases has either wrapped or was reset. 
+ * A 32 bit counter that was in its upper half and is now in 
+ * its lower half is taken as wrapped, any other decrease as a
+ * reset, e.g. a reboot or a recreated interface. A reset gives
+ * no rate, the next sample continues from the new value.
+ *
+ * @headerfile rate.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdbool.h>
+
+#include "rate.h"
+
+#define WRAP_32 (1ULL << 32)
+#define HALF_32 (1ULL << 31)
+
+/*******************************************/ /**
+ * @brief Add a sample of a counter
+ *
+ * @param counter - The state of the counter
+ * @param value - The counter value
+ * @param time - CLOCK_MONOTONIC of the sample in nanoseconds
+ * @param rate - Stores the rate per second since the last sample
+ * @return int - ZERO if a rate is stored, -1 on the first sample 
+ *               and after a reset
+ ***********************************************/
+int rate_sample(rate_t *counter, uint64_t value, uint64_t time, double *rate)
+{
+	if (counter->state == RATE_EMPTY)
+	{
+		counter->last_value = value;
+		counter->last_time = time;
+		counter->state = RATE_PRIMED;
+		return -1;
+	}
+
+	if (time <= counter->last_time)
+	{
+		// the same sample again, e.g. rendered by two jobs
+		if (counter->state == RATE_VALID)
+		{
+			*rate = counter->rate;
+			return 0;
+		}
+		return -1;
+	}
+
+	uint64_t delta;
+	if (value >= counter->last_value)
+	{
+		delta = value - counter->last_value;
+	}
+	else if ((counter->last_value < WRAP_32) && (counter->last_value >= HALF_32) && (value < HALF_32))
+	{
+		delta = value + WRAP_32 - counter->last_value;
+	}
+	else
+	{
+		counter->last_value = value;
+		counter->last_time = time;
+		counter->state = RATE_PRIMED;
+		return -1;
+	}
+
+	counter->rate = delta * 1e9 / (time - counter->last_time);
+	counter->last_value = value;
+	counter->last_time = time;
+	counter->state = RATE_VALID;
+	*rate = counter->rate;
+	return 0;
+}
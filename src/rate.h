@@ -0,0 +1,37 @@
+/*******************************************/ /**
+ * @file rate.h
+ * @author marsman7 (you@domain.com)
+ * @brief Rate per second of a counter from two samples,
+ *        with detection of counter wrap and reset.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef RATE_H
+#define RATE_H
+
+#include <stdint.h>
+
+/*******************************************/ /**
+ * @brief State of one counter, starts zeroed
+ ***********************************************/
+typedef struct rate_t
+{
+	uint64_t last_value;
+	uint64_t last_time;	/*!< CLOCK_MONOTONIC in nanoseconds */
+	double rate;		/*!< last computed rate per second */
+	uint8_t state;		/*!< one of enum rate_state_t */
+} rate_t;
+
+/*******************************************/ /**
+ * @brief States of a counter
+ ***********************************************/
+enum rate_state_t
+{
+	RATE_EMPTY = 0,		/*!< no sample yet */
+	RATE_PRIMED,		/*!< one sample, no rate yet */
+	RATE_VALID		/*!< 'rate' is valid */
+};
+
+int rate_sample(rate_t *, uint64_t, uint64_t, double *);
+
+#endif
@@ -0,0 +1,190 @@
+/*******************************************/ /**
+ * @file scheduler.c
+ * @author marsman7 (you@domain.com)
+ * @brief Min-heap of the next deadlines of the publish jobs
+ *
+ * The main loop arms one timer on the deadline of the first
+ * entry, so the process wakes only when a job is due, no
+ * matter how many jobs are configured.
+ *
+ * A fleet of hosts that starts at once would publish in
+ * lockstep. scheduler_phase() gives each host a stable offset
+ * from a hash of its client id, scheduler_slot() places the
+ * first deadline on it, the following ones keep the phase.
+ *
+ * @headerfile scheduler.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdlib.h>
+#include <errno.h>
+
+#include "scheduler.h"
+
+/*******************************************/ /**
+ * @brief Insert a job
+ *
+ * @param sched - The scheduler
+ * @param job - Index of the job
+ * @param deadline - Time the job is due
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int scheduler_push(scheduler_t *sched, int job, uint64_t deadline)
+{
+	if (sched->count == sched->size)
+	{
+		size_t size = sched->size ? sched->size * 2 : 8;
+		scheduler_entry_t *entries = realloc(sched->entries, size * sizeof(scheduler_entry_t));
+		if (! entries)
+		{
+			return -1;
+		}
+		sched->entries = entries;
+		sched->size = size;
+	}
+
+	// sift up
+	size_t i = sched->count++;
+	while (i > 0)
+	{
+		size_t parent = (i - 1) / 2;
+		if (sched->entries[parent].deadline <= deadline)
+		{
+			break;
+		}
+		sched->entries[i] = sched->entries[parent];
+		i = parent;
+	}
+	sched->entries[i].deadline = deadline;
+	sched->entries[i].job = job;
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the job with the earliest deadline
+ *
+ * @param sched - The scheduler
+ * @param deadline - Stores the deadline, may be NULL
+ * @return int - Index of the job or -1 if empty
+ ***********************************************/
+int scheduler_peek(const scheduler_t *sched, uint64_t *deadline)
+{
+	if (! sched->count)
+	{
+		return -1;
+	}
+	if (deadline)
+	{
+		*deadline = sched->entries[0].deadline;
+	}
+	return sched->entries[0].job;
+}
+
+/*******************************************/ /**
+ * @brief Remove the job with the earliest deadline
+ *
+ * @param sched - The scheduler
+ * @param deadline - Stores the deadline, may be NULL
+ * @return int - Index of the job or -1 if empty
+ ***********************************************/
+int scheduler_pop(scheduler_t *sched, uint64_t *deadline)
+{
+	int job = scheduler_peek(sched, deadline);
+	if (job < 0)
+	{
+		return -1;
+	}
+
+	// sift down the last entry from the top
+	scheduler_entry_t last = sched->entries[--sched->count];
+	size_t i = 0;
+	for (;;)
+	{
+		size_t child = 2 * i + 1;
+		if (child >= sched->count)
+		{
+			break;
+		}
+		if ((child + 1 < sched->count) && 
+				(sched->entries[child + 1].deadline < sched->entries[child].deadline))
+		{
+			child++;
+		}
+		if (last.deadline <= sched->entries[child].deadline)
+		{
+			break;
+		}
+		sched->entries[i] = sched->entries[child];
+		i = child;
+	}
+	if (sched->count)
+	{
+		sched->entries[i] = last;
+	}
+
+	return job;
+}
+
+/*******************************************/ /**
+ * @brief Remove all jobs, the memory is kept
+ ***********************************************/
+void scheduler_clear(scheduler_t *sched)
+{
+	sched->count = 0;
+}
+
+/*******************************************/ /**
+ * @brief Give free the memory of the scheduler
+ ***********************************************/
+void scheduler_free(scheduler_t *sched)
+{
+	free(sched->entries);
+	sched->entries = NULL;
+	sched->count = 0;
+	sched->size = 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the phase of a host from a hash of its id, the
+ *        same id gets the same phase on each start
+ *
+ * @param id - The id of the host, e.g. the MQTT client id
+ * @param span - Width of the phases in nanoseconds
+ * @return uint64_t - The phase, 0 to span - 1, ZERO if span is ZERO
+ ***********************************************/
+uint64_t scheduler_phase(const char *id, uint64_t span)
+{
+	// FNV-1a with the final mix of MurmurHash3, ids that differ 
+	// in the last character only get unrelated phases
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (const unsigned char *c = (const unsigned char *)id; *c; c++)
+	{
+		hash ^= *c;
+		hash *= 0x100000001b3ULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return span ? hash % span : 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the first deadline of a job on its phase, it is
+ *        at most one interval from now
+ *
+ * @param now - The current time
+ * @param position - Time since the start of the current cycle
+ *        of the interval, ZERO starts the cycles now
+ * @param interval - Interval of the job, not ZERO
+ * @param phase - Offset of the deadlines in the cycle
+ * @return uint64_t - The deadline, 'now' + 1 to 'now' + 'interval'
+ ***********************************************/
+uint64_t scheduler_slot(uint64_t now, uint64_t position, uint64_t interval, uint64_t phase)
+{
+	uint64_t delay = (phase % interval + interval - position % interval) % interval;
+	return now + (delay ? delay : interval);
+}
@@ -0,0 +1,41 @@
+/*******************************************/ /**
+ * @file scheduler.h
+ * @author marsman7 (you@domain.com)
+ * @brief Min-heap of the next deadlines of the publish jobs
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*******************************************/ /**
+ * @brief One scheduled job
+ ***********************************************/
+typedef struct scheduler_entry_t
+{
+	uint64_t deadline;	/*!< CLOCK_MONOTONIC in nanoseconds */
+	int job;		/*!< index of the job */
+} scheduler_entry_t;
+
+/*******************************************/ /**
+ * @brief The heap, the entry with the earliest deadline is first
+ ***********************************************/
+typedef struct scheduler_t
+{
+	scheduler_entry_t *entries;
+	size_t count;
+	size_t size;
+} scheduler_t;
+
+int scheduler_push(scheduler_t *, int, uint64_t);
+int scheduler_peek(const scheduler_t *, uint64_t *);
+int scheduler_pop(scheduler_t *, uint64_t *);
+void scheduler_clear(scheduler_t *);
+void scheduler_free(scheduler_t *);
+uint64_t scheduler_phase(const char *, uint64_t);
+uint64_t scheduler_slot(uint64_t, uint64_t, uint64_t, uint64_t);
+
+#endif
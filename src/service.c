@@ -0,0 +1,547 @@
+/*******************************************/ /**
+ * @file service.c
+ * @author marsman7 (you@domain.com)
+ * @brief Cached and batched state of the services
+ *        referenced by %service_<name>% tags.
+ *
+ * The state of all registered services is queried with one
+ * call of the backend and cached until it is older than the
+ * max. age or the backend reports a change. The 'systemctl'
+ * backend runs one 'systemctl is-active' for all units and
+ * watches /run/systemd/units, where systemd creates and removes
+ * a file for each unit that is started or stopped. The 'file'
+ * backend reads the states from a text file with lines of
+ * "<unit> <state>" and is used to drive the daemon in tests.
+ *
+ * The update may run on a collector thread while the states are
+ * read. It queries into a back buffer and publishes it with a
+ * atomic swap, so a reader always sees a complete set of states
+ * and a slow query does not hide the last known ones.
+ *
+ * @headerfile service.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <spawn.h>
+#include <signal.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+
+#include "service.h"
+
+#define SYSTEMD_UNITS_DIR "/run/systemd/units"
+
+extern char **environ;
+
+static const service_backend_t *backend = NULL;
+static void *backend_ctx = NULL;
+static char **units = NULL;
+static char (*states[2])[SERVICE_STATE_SIZE] = { NULL, NULL };
+static atomic_int front = 0;	/*!< index of the published states */
+static int units_count = 0;
+static int max_age = 0;
+static bool valid = false;
+static atomic_uint changes = 0;		/*!< counts the invalidations */
+static unsigned fetched_changes = 0;	/*!< 'changes' at the last query */
+static atomic_bool watched = false;	/*!< the watch fd is read by the caller of service_watch_fd() */
+static struct timespec fetched = {0};
+
+/*******************************************/ /**
+ * @brief Consume all events of a inotify fd
+ *
+ * @param fd - Non blocking inotify fd
+ * @return bool - TRUE if a event was read
+ ***********************************************/
+static bool inotify_drain(int fd)
+{
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+
+	while (read(fd, events, sizeof(events)) > 0)
+	{
+		changed = true;
+	}
+	return changed;
+}
+
+/*******************************************/ /**
+ * @brief Copy one line of text as state string
+ ***********************************************/
+static void copy_state(char *dst, const char *line, size_t length)
+{
+	if (length >= SERVICE_STATE_SIZE)
+	{
+		length = SERVICE_STATE_SIZE - 1;
+	}
+	memcpy(dst, line, length);
+	dst[length] = '\0';
+}
+
+//-----------------------------------------------
+// Backend 'systemctl'
+
+static int systemctl_open(void **ctx, const char *arg)
+{
+	int *fd = malloc(sizeof(int));
+	if (! fd)
+	{
+		return -1;
+	}
+
+	*fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if ((*fd >= 0) && (inotify_add_watch(*fd, SYSTEMD_UNITS_DIR,
+			IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_CLOSE_WRITE) < 0))
+	{
+		// without the directory the states are refreshed by max. age only
+		close(*fd);
+		*fd = -1;
+	}
+	*ctx = fd;
+	return 0;
+}
+
+static int systemctl_query(void *ctx, char *const *units, size_t count, char (*states)[SERVICE_STATE_SIZE])
+{
+	int pipe_fd[2];
+	if (pipe2(pipe_fd, O_CLOEXEC))
+	{
+		return -1;
+	}
+
+	// systemctl is-active -- <unit> ... <NULL>
+	char **argv = calloc(count + 4, sizeof(char *));
+	if (! argv)
+	{
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+		return -1;
+	}
+	argv[0] = "systemctl";
+	argv[1] = "is-active";
+	argv[2] = "--";
+	memcpy(&argv[3], units, count * sizeof(char *));
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipe_fd[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+	// The daemon blocks the signals it reads from a signalfd
+	posix_spawnattr_t attr;
+	sigset_t no_signals;
+	sigemptyset(&no_signals);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &no_signals);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	pid_t pid;
+	int err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	free(argv);
+	close(pipe_fd[1]);
+	if (err)
+	{
+		close(pipe_fd[0]);
+		errno = err;
+		return -1;
+	}
+
+	// One line per unit in the order of the arguments
+	char buffer[4096];
+	size_t filled = 0;
+	size_t index = 0;
+	ssize_t bytes;
+	while ((bytes = read(pipe_fd[0], buffer + filled, sizeof(buffer) - filled)) > 0)
+	{
+		filled += bytes;
+		char *line = buffer;
+		char *eol;
+		while ((eol = memchr(line, '\n', buffer + filled - line)))
+		{
+			if (index < count)
+			{
+				copy_state(states[index++], line, eol - line);
+			}
+			line = eol + 1;
+		}
+		filled = buffer + filled - line;
+		memmove(buffer, line, filled);
+		if (filled == sizeof(buffer))
+		{
+			// overlong line, discard it
+			filled = 0;
+		}
+	}
+	close(pipe_fd[0]);
+	waitpid(pid, NULL, 0);
+
+	if (! index)
+	{
+		errno = EIO;
+		return -1;
+	}
+	for (; index < count; index++)
+	{
+		copy_state(states[index], "unknown", 7);
+	}
+	return 0;
+}
+
+static int systemctl_watch_fd(void *ctx)
+{
+	return *(int *)ctx;
+}
+
+static bool systemctl_watch_read(void *ctx)
+{
+	int fd = *(int *)ctx;
+	return (fd >= 0) ? inotify_drain(fd) : false;
+}
+
+static void systemctl_close(void *ctx)
+{
+	int fd = *(int *)ctx;
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	free(ctx);
+}
+
+const service_backend_t service_backend_systemctl = {
+	"systemctl", systemctl_open, systemctl_query,
+	systemctl_watch_fd, systemctl_watch_read, systemctl_close
+};
+
+//-----------------------------------------------
+// Backend 'file'
+
+typedef struct file_ctx_t
+{
+	int fd;
+	char *path;
+} file_ctx_t;
+
+static int file_open(void **ctx, const char *arg)
+{
+	if ((! arg) || (! *arg))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	file_ctx_t *file = malloc(sizeof(file_ctx_t));
+	if ((! file) || (! (file->path = strdup(arg))))
+	{
+		free(file);
+		return -1;
+	}
+
+	file->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if ((file->fd >= 0) && (inotify_add_watch(file->fd, file->path,
+			IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB) < 0))
+	{
+		close(file->fd);
+		file->fd = -1;
+	}
+	*ctx = file;
+	return 0;
+}
+
+static int file_query(void *ctx, char *const *units, size_t count, char (*states)[SERVICE_STATE_SIZE])
+{
+	file_ctx_t *file = ctx;
+	FILE *stream = fopen(file->path, "re");
+	if (! stream)
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		copy_state(states[i], "unknown", 7);
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), stream))
+	{
+		size_t name_length = strcspn(line, " \t\r\n");
+		const char *state = line + name_length;
+		state += strspn(state, " \t");
+		size_t state_length = strcspn(state, " \t\r\n");
+		if ((! name_length) || (! state_length))
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if ((strlen(units[i]) == name_length) && (! strncmp(units[i], line, name_length)))
+			{
+				copy_state(states[i], state, state_length);
+			}
+		}
+	}
+	fclose(stream);
+	return 0;
+}
+
+static int file_watch_fd(void *ctx)
+{
+	return ((file_ctx_t *)ctx)->fd;
+}
+
+static bool file_watch_read(void *ctx)
+{
+	file_ctx_t *file = ctx;
+	return (file->fd >= 0) ? inotify_drain(file->fd) : false;
+}
+
+static void file_close(void *ctx)
+{
+	file_ctx_t *file = ctx;
+	if (file->fd >= 0)
+	{
+		close(file->fd);
+	}
+	free(file->path);
+	free(file);
+}
+
+const service_backend_t service_backend_file = {
+	"file", file_open, file_query,
+	file_watch_fd, file_watch_read, file_close
+};
+
+//-----------------------------------------------
+
+static const service_backend_t *backends[] = {
+	&service_backend_systemctl,
+	&service_backend_file
+};
+
+/*******************************************/ /**
+ * @brief Select and open the backend of the service states
+ *
+ * @param name - Name of the backend ("systemctl" or "file")
+ * @param arg - Backend specific option, for 'file' the path
+ *              of the state file
+ * @param age - Max. age of cached states in seconds, ZERO
+ *              queries on each update
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int service_init(const char *name, const char *arg, int age)
+{
+	if (backend)
+	{
+		backend->close(backend_ctx);
+		backend = NULL;
+	}
+
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+	{
+		if (! strcmp(backends[i]->name, name))
+		{
+			if (backends[i]->open(&backend_ctx, arg))
+			{
+				return -1;
+			}
+			backend = backends[i];
+			max_age = age;
+			valid = false;
+			atomic_store(&watched, false);
+			return 0;
+		}
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Register a service to query its state
+ *
+ * @param name - Name of the unit, not terminated
+ * @param length - Length of the name
+ * @return int - Index of the service or -1 if out of memory
+ ***********************************************/
+int service_register(const char *name, size_t length)
+{
+	for (int i = 0; i < units_count; i++)
+	{
+		if ((strlen(units[i]) == length) && (! strncmp(units[i], name, length)))
+		{
+			return i;
+		}
+	}
+
+	char **new_units = realloc(units, (units_count + 1) * sizeof(char *));
+	if (! new_units)
+	{
+		return -1;
+	}
+	units = new_units;
+
+	for (int i = 0; i < 2; i++)
+	{
+		char (*new_states)[SERVICE_STATE_SIZE] = realloc(states[i], (units_count + 1) * SERVICE_STATE_SIZE);
+		if (! new_states)
+		{
+			return -1;
+		}
+		states[i] = new_states;
+		states[i][units_count][0] = '\0';
+	}
+
+	if (! (units[units_count] = strndup(name, length)))
+	{
+		return -1;
+	}
+	valid = false;
+
+	return units_count++;
+}
+
+/*******************************************/ /**
+ * @brief Count of registered services
+ ***********************************************/
+int service_count()
+{
+	return units_count;
+}
+
+/*******************************************/ /**
+ * @brief Refresh the states if the cache is older than the
+ *        max. age or the backend reports a change. All services
+ *        are queried with one call.
+ *
+ * @return int - ZERO at successfully, otherwise -1 and errno is
+ *               set, the previous states are kept
+ ***********************************************/
+int service_update()
+{
+	if ((! backend) || (! units_count))
+	{
+		return 0;
+	}
+
+	if ((! atomic_load(&watched)) && backend->watch_read(backend_ctx))
+	{
+		service_invalidate();
+	}
+
+	// a invalidation while the query runs is seen by the next update
+	unsigned current = atomic_load(&changes);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (valid && (current == fetched_changes) && ((now.tv_sec - fetched.tv_sec) < max_age))
+	{
+		return 0;
+	}
+
+	// a backend may leave the state of a unit unchanged
+	int back = ! atomic_load_explicit(&front, memory_order_relaxed);
+	memcpy(states[back], states[! back], units_count * SERVICE_STATE_SIZE);
+	if (backend->query(backend_ctx, units, units_count, states[back]))
+	{
+		return -1;
+	}
+	atomic_store_explicit(&front, back, memory_order_release);
+	fetched = now;
+	fetched_changes = current;
+	valid = true;
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Force a query on the next update, can be called
+ *        while a update runs on a other thread
+ ***********************************************/
+void service_invalidate()
+{
+	atomic_fetch_add(&changes, 1);
+}
+
+/*******************************************/ /**
+ * @brief Get the fd that gets readable on a state change.
+ *        From now on the caller watches the fd and calls
+ *        service_watch_read() if it is readable, the update
+ *        does not read it anymore.
+ *
+ * @return int - The fd or -1 if the backend can't watch
+ ***********************************************/
+int service_watch_fd()
+{
+	int fd = backend ? backend->watch_fd(backend_ctx) : -1;
+	if (fd >= 0)
+	{
+		atomic_store(&watched, true);
+	}
+	return fd;
+}
+
+/*******************************************/ /**
+ * @brief Consume the events of the watch fd
+ *
+ * @return bool - TRUE if a unit is changed, the states are
+ *                queried again on the next update
+ ***********************************************/
+bool service_watch_read()
+{
+	if (backend && backend->watch_read(backend_ctx))
+	{
+		service_invalidate();
+		return true;
+	}
+	return false;
+}
+
+/*******************************************/ /**
+ * @brief Get the cached state of a service
+ *
+ * @param index - Index returned by service_register()
+ * @return const char* - The state, empty if unknown
+ ***********************************************/
+const char *service_state(int index)
+{
+	if ((index < 0) || (index >= units_count))
+	{
+		return "";
+	}
+	return states[atomic_load_explicit(&front, memory_order_acquire)][index];
+}
+
+/*******************************************/ /**
+ * @brief Close the backend and forget all services
+ ***********************************************/
+void service_free()
+{
+	if (backend)
+	{
+		backend->close(backend_ctx);
+		backend = NULL;
+		backend_ctx = NULL;
+	}
+
+	for (int i = 0; i < units_count; i++)
+	{
+		free(units[i]);
+	}
+	free(units); units = NULL;
+	free(states[0]); states[0] = NULL;
+	free(states[1]); states[1] = NULL;
+	units_count = 0;
+	valid = false;
+	atomic_store(&watched, false);
+}
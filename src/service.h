@@ -0,0 +1,47 @@
+/*******************************************/ /**
+ * @file service.h
+ * @author marsman7 (you@domain.com)
+ * @brief Cached and batched state of the services
+ *        referenced by %service_<name>% tags.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SERVICE_STATE_SIZE 32	/*!< max. length of a state string incl. zero */
+
+/*******************************************/ /**
+ * @brief A source of service states
+ ***********************************************/
+typedef struct service_backend_t
+{
+	const char *name;
+	/*! Open the backend, 'arg' is the backend specific option */
+	int (*open)(void **ctx, const char *arg);
+	/*! Query the state of all units at once */
+	int (*query)(void *ctx, char *const *units, size_t count, char (*states)[SERVICE_STATE_SIZE]);
+	/*! Returns a fd that gets readable on a state change or -1 */
+	int (*watch_fd)(void *ctx);
+	/*! Consume the pending change events, returns true if a unit is changed */
+	bool (*watch_read)(void *ctx);
+	void (*close)(void *ctx);
+} service_backend_t;
+
+extern const service_backend_t service_backend_systemctl;
+extern const service_backend_t service_backend_file;
+
+int service_init(const char *, const char *, int);
+int service_register(const char *, size_t);
+int service_count();
+int service_update();
+void service_invalidate();
+int service_watch_fd();
+bool service_watch_read();
+const char *service_state(int);
+void service_free();
+
+#endif
@@ -0,0 +1,360 @@
+/*******************************************/ /**
+ * @file spool.c
+ * @author marsman7 (you@domain.com)
+ * @brief Bounded on-disk ring of messages rendered while
+ *        the broker is not connected.
+ *
+ * The file is a header followed by a ring of records and is
+ * mapped into memory, so appending is a memcpy without a
+ * system call. Head and tail are byte positions that only
+ * grow, the position in the ring is the remainder of the 
+ * capacity. A record is written before the tail is moved, 
+ * so a record that is interrupted by a crash is not seen on
+ * the next start. If the ring is full, the oldest records
+ * are dropped. The length of a record is checked against the
+ * used part of the ring before it is read, a damaged file 
+ * empties the ring instead of reading out of it.
+ *
+ * @headerfile spool.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+
+#define SPOOL_MAGIC "MHBSPOOL"
+#define SPOOL_VERSION 1
+
+/*******************************************/ /**
+ * @brief Header at the begin of the file
+ ***********************************************/
+typedef struct spool_header_t
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t capacity;	/*!< size of the ring in bytes */
+	uint64_t head;		/*!< position of the oldest record */
+	uint64_t tail;		/*!< position after the newest record */
+	uint64_t count;		/*!< count of records */
+} spool_header_t;
+
+/*******************************************/ /**
+ * @brief Header of each record, followed by topic and payload
+ ***********************************************/
+typedef struct spool_record_t
+{
+	uint32_t topic_length;
+	uint32_t payload_length;
+	int64_t time;
+	uint8_t qos;
+	uint8_t retain;
+	uint16_t reserved;
+	uint32_t expiry;	/*!< seconds after 'time', ZERO never */
+} spool_record_t;
+
+/*******************************************/ /**
+ * @brief Copy into the ring at a position, wraps at the end
+ ***********************************************/
+static void ring_write(spool_t *spool, uint64_t position, const void *src, size_t length)
+{
+	uint64_t capacity = spool->header->capacity;
+	size_t offset = position % capacity;
+	size_t first = (length < capacity - offset) ? length : capacity - offset;
+
+	memcpy(spool->data + offset, src, first);
+	memcpy(spool->data, (const uint8_t *)src + first, length - first);
+}
+
+/*******************************************/ /**
+ * @brief Copy from the ring at a position, wraps at the end
+ ***********************************************/
+static void ring_read(const spool_t *spool, uint64_t position, void *dst, size_t length)
+{
+	uint64_t capacity = spool->header->capacity;
+	size_t offset = position % capacity;
+	size_t first = (length < capacity - offset) ? length : capacity - offset;
+
+	memcpy(dst, spool->data + offset, first);
+	memcpy((uint8_t *)dst + first, spool->data, length - first);
+}
+
+/*******************************************/ /**
+ * @brief Read the header of the oldest record and check that
+ *        the record is in the used part of the ring
+ *
+ * @param spool - The spool, not empty
+ * @param record - Stores the header
+ * @return uint64_t - Size of the record with topic and payload,
+ *                    ZERO if it is damaged
+ ***********************************************/
+static uint64_t read_oldest(const spool_t *spool, spool_record_t *record)
+{
+	const spool_header_t *header = spool->header;
+	uint64_t used = header->tail - header->head;
+	if (used < sizeof(*record))
+	{
+		return 0;
+	}
+
+	ring_read(spool, header->head, record, sizeof(*record));
+	uint64_t size = sizeof(*record) + (uint64_t)record->topic_length + record->payload_length;
+	return ((size <= used) && (size <= header->capacity)) ? size : 0;
+}
+
+/*******************************************/ /**
+ * @brief Drop all records of a damaged ring
+ *
+ * @param spool - The spool
+ * @return uint64_t - Count of dropped records
+ ***********************************************/
+static uint64_t reset_ring(spool_t *spool)
+{
+	spool_header_t *header = spool->header;
+	uint64_t count = header->count;
+	header->head = header->tail;
+	header->count = 0;
+	return count;
+}
+
+/*******************************************/ /**
+ * @brief Open or create a spool file. A file with an other
+ *        capacity or format is initialized again.
+ *
+ * @param spool - Spool to fill
+ * @param path - Path of the file
+ * @param capacity - Size of the ring in bytes
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int spool_open(spool_t *spool, const char *path, size_t capacity)
+{
+	memset(spool, 0, sizeof(*spool));
+	if (capacity < sizeof(spool_record_t) * 2)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((spool->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+	{
+		return -1;
+	}
+
+	size_t file_size = sizeof(spool_header_t) + capacity;
+	struct stat st;
+	if (fstat(spool->fd, &st))
+	{
+		goto fail;
+	}
+	if (((size_t)st.st_size != file_size) && ftruncate(spool->fd, file_size))
+	{
+		goto fail;
+	}
+
+	void *map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, spool->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		goto fail;
+	}
+	spool->header = map;
+	spool->data = (uint8_t *)map + sizeof(spool_header_t);
+
+	spool_header_t *header = spool->header;
+	if (memcmp(header->magic, SPOOL_MAGIC, sizeof(header->magic)) || 
+			(header->version != SPOOL_VERSION) || (header->capacity != capacity) ||
+			(header->tail < header->head) || (header->tail - header->head > capacity))
+	{
+		memset(header, 0, sizeof(*header));
+		memcpy(header->magic, SPOOL_MAGIC, sizeof(header->magic));
+		header->version = SPOOL_VERSION;
+		header->capacity = capacity;
+	}
+
+	return 0;
+
+fail:
+	close(spool->fd);
+	spool->fd = -1;
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Append a message, the oldest messages are dropped
+ *        to make room for it.
+ *
+ * @param spool - The spool
+ * @param topic - Topic of the message
+ * @param payload - Payload of the message
+ * @param length - Length of the payload
+ * @param qos - Quality of Service
+ * @param retain - Retain flag
+ * @param time - Time of the message
+ * @param expiry - Seconds after the time the message expires, 
+ *                 ZERO never
+ * @return int - Count of dropped messages, -1 on error and errno is set
+ ***********************************************/
+int spool_append(spool_t *spool, const char *topic, const void *payload, size_t length, 
+		int qos, bool retain, int64_t time, uint32_t expiry)
+{
+	spool_header_t *header = spool->header;
+	if (! header)
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	spool_record_t record = {0};
+	record.topic_length = strlen(topic);
+	record.payload_length = length;
+	record.time = time;
+	record.qos = qos;
+	record.retain = retain;
+	record.expiry = expiry;
+
+	uint64_t size = sizeof(record) + record.topic_length + record.payload_length;
+	if (size > header->capacity)
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	int dropped = 0;
+	while (header->tail - header->head + size > header->capacity)
+	{
+		spool_record_t oldest;
+		uint64_t oldest_size = read_oldest(spool, &oldest);
+		if (! oldest_size)
+		{
+			dropped += reset_ring(spool);
+			break;
+		}
+		header->head += oldest_size;
+		header->count -= (header->count > 0);
+		dropped++;
+	}
+
+	uint64_t position = header->tail;
+	ring_write(spool, position, &record, sizeof(record));
+	ring_write(spool, position + sizeof(record), topic, record.topic_length);
+	ring_write(spool, position + sizeof(record) + record.topic_length, payload, length);
+
+	// publish the record after it is complete
+	__atomic_store_n(&header->tail, position + size, __ATOMIC_RELEASE);
+	header->count++;
+
+	return dropped;
+}
+
+/*******************************************/ /**
+ * @brief Read the oldest message
+ *
+ * @param spool - The spool
+ * @param message - Stores the message
+ * @return int - ZERO at successfully, -1 if the spool is empty,
+ *               a damaged spool is emptied
+ ***********************************************/
+int spool_first(spool_t *spool, spool_message_t *message)
+{
+	spool_header_t *header = spool->header;
+	if ((! header) || (header->head == header->tail))
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	spool_record_t record;
+	if (! read_oldest(spool, &record))
+	{
+		reset_ring(spool);
+		errno = ENOENT;
+		return -1;
+	}
+
+	// topic, zero, payload in one contiguous buffer
+	size_t size = record.topic_length + 1 + record.payload_length;
+	if (size > spool->scratch_size)
+	{
+		uint8_t *scratch = realloc(spool->scratch, size);
+		if (! scratch)
+		{
+			return -1;
+		}
+		spool->scratch = scratch;
+		spool->scratch_size = size;
+	}
+
+	uint64_t position = header->head + sizeof(record);
+	ring_read(spool, position, spool->scratch, record.topic_length);
+	spool->scratch[record.topic_length] = '\0';
+	ring_read(spool, position + record.topic_length, 
+			spool->scratch + record.topic_length + 1, record.payload_length);
+
+	message->topic = (const char *)spool->scratch;
+	message->payload = spool->scratch + record.topic_length + 1;
+	message->payload_length = record.payload_length;
+	message->time = record.time;
+	message->expiry = record.expiry;
+	message->qos = record.qos;
+	message->retain = record.retain;
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Remove the oldest message
+ *
+ * @param spool - The spool
+ ***********************************************/
+void spool_remove_first(spool_t *spool)
+{
+	spool_header_t *header = spool->header;
+	if ((! header) || (header->head == header->tail))
+	{
+		return;
+	}
+
+	spool_record_t record;
+	uint64_t size = read_oldest(spool, &record);
+	if (! size)
+	{
+		reset_ring(spool);
+		return;
+	}
+	header->head += size;
+	header->count -= (header->count > 0);
+}
+
+/*******************************************/ /**
+ * @brief Count of messages in the spool
+ ***********************************************/
+uint64_t spool_count(const spool_t *spool)
+{
+	return spool->header ? spool->header->count : 0;
+}
+
+/*******************************************/ /**
+ * @brief Unmap and close the spool file
+ ***********************************************/
+void spool_close(spool_t *spool)
+{
+	if (spool->header)
+	{
+		munmap(spool->header, sizeof(spool_header_t) + spool->header->capacity);
+	}
+	if (spool->fd >= 0)
+	{
+		close(spool->fd);
+	}
+	free(spool->scratch);
+	memset(spool, 0, sizeof(*spool));
+	spool->fd = -1;
+}
@@ -0,0 +1,50 @@
+/*******************************************/ /**
+ * @file spool.h
+ * @author marsman7 (you@domain.com)
+ * @brief Bounded on-disk ring of messages rendered while
+ *        the broker is not connected.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*******************************************/ /**
+ * @brief A open spool file
+ ***********************************************/
+typedef struct spool_t
+{
+	int fd;
+	struct spool_header_t *header;	/*!< mapped file */
+	uint8_t *data;			/*!< ring after the header */
+	uint8_t *scratch;		/*!< contiguous copy of the first message */
+	size_t scratch_size;
+} spool_t;
+
+/*******************************************/ /**
+ * @brief A message read from the spool, valid until the
+ *        next call of a spool function
+ ***********************************************/
+typedef struct spool_message_t
+{
+	const char *topic;
+	const void *payload;
+	size_t payload_length;
+	int64_t time;		/*!< CLOCK_REALTIME of the render in nanoseconds */
+	uint32_t expiry;	/*!< seconds after 'time' the message expires, ZERO never */
+	int qos;
+	bool retain;
+} spool_message_t;
+
+int spool_open(spool_t *, const char *, size_t);
+int spool_append(spool_t *, const char *, const void *, size_t, int, bool, int64_t, uint32_t);
+int spool_first(spool_t *, spool_message_t *);
+void spool_remove_first(spool_t *);
+uint64_t spool_count(const spool_t *);
+void spool_close(spool_t *);
+
+#endif
@@ -0,0 +1,299 @@
+/*******************************************/ /**
+ * @file template.c
+ * @author marsman7 (you@domain.com)
+ * @brief Compiles message templates into a token program
+ *        that is executed into a pre-sized output buffer.
+ *
+ * A template is plain text with tags surrounded by '%', for
+ * example foo/%bar%/for/%every%. The text between the tags
+ * is stored once in a literal pool. Tags with a constant value
+ * are folded into the literal pool at compile time, so the
+ * render step only copies literal runs and formats the
+ * remaining dynamic tags.
+ *
+ * @headerfile template.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "template.h"
+
+#define TEMPLATE_CONSTANT_SIZE 256
+
+/*******************************************/ /**
+ * @brief Append text to the literal pool, adjacent literal
+ *        runs are merged to a single token.
+ *
+ * @param tmpl - Template to compile in.
+ * @param text - Text to append.
+ * @param length - Length of the text.
+ * @return int - ZERO at successfully, otherwise -1
+ ***********************************************/
+static int append_literal(template_t *tmpl, const char *text, size_t length)
+{
+	if (! length)
+	{
+		return 0;
+	}
+
+	char *literals = realloc(tmpl->literals, tmpl->literals_length + length);
+	if (! literals)
+	{
+		return -1;
+	}
+	tmpl->literals = literals;
+	memcpy(tmpl->literals + tmpl->literals_length, text, length);
+
+	template_token_t *last = tmpl->token_count ? &tmpl->tokens[tmpl->token_count - 1] : NULL;
+	if (last && (last->op == TEMPLATE_OP_LITERAL))
+	{
+		last->length += length;
+	}
+	else
+	{
+		template_token_t *token = &tmpl->tokens[tmpl->token_count++];
+		token->op = TEMPLATE_OP_LITERAL;
+		token->arg = 0;
+		token->offset = tmpl->literals_length;
+		token->length = length;
+	}
+	tmpl->literals_length += length;
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Append the name of a dynamic tag to the name pool
+ *
+ * @param tmpl - Template to compile in.
+ * @param token - Token of the tag, stores the offset of the name.
+ * @param name - Name of the tag, not terminated.
+ * @param length - Length of the name.
+ * @return int - ZERO at successfully, otherwise -1
+ ***********************************************/
+static int append_name(template_t *tmpl, template_token_t *token, const char *name, size_t length)
+{
+	char *names = realloc(tmpl->names, tmpl->names_length + length + 1);
+	if (! names)
+	{
+		return -1;
+	}
+	tmpl->names = names;
+	memcpy(tmpl->names + tmpl->names_length, name, length);
+	tmpl->names[tmpl->names_length + length] = '\0';
+	token->offset = tmpl->names_length;
+	tmpl->names_length += length + 1;
+
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Compile a template string into a token program.
+ *        Unknown tags are dropped. A '%' without a closing
+ *        '%' drops the rest of the string.
+ *
+ * @param tmpl - Template to fill, discarded with template_free().
+ * @param src_string - Template text, NULL results in an empty template.
+ * @param resolve - Callback to resolve the tag names.
+ * @param ctx - User pointer passed to the callback.
+ * @return int - ZERO at successfully, otherwise -1 and errno is set
+ ***********************************************/
+int template_compile(template_t *tmpl, const char *src_string, template_resolve_t resolve, void *ctx)
+{
+	memset(tmpl, 0, sizeof(*tmpl));
+	if (! src_string)
+	{
+		src_string = "";
+	}
+
+	// Each '%' starts or ends a tag, a tag and the text
+	// before it results in two tokens at most
+	size_t max_tokens = 1;
+	for (const char *p = src_string; (p = strchr(p, '%')); p++)
+	{
+		max_tokens++;
+	}
+	if (! (tmpl->tokens = calloc(max_tokens, sizeof(template_token_t))))
+	{
+		return -1;
+	}
+
+	size_t tags_length = 0;
+	char value[TEMPLATE_CONSTANT_SIZE];
+	const char *tag_begin;
+
+	while ((tag_begin = strchr(src_string, '%')))
+	{
+		if (append_literal(tmpl, src_string, tag_begin - src_string))
+		{
+			goto fail;
+		}
+
+		const char *tag_end = strchr(tag_begin + 1, '%');
+		if (! tag_end)
+		{
+			// the tag is not closed
+			src_string = tag_begin + strlen(tag_begin);
+			break;
+		}
+
+		template_token_t token = {0};
+		*value = '\0';
+		switch (resolve(tag_begin + 1, tag_end - tag_begin - 1, &token, value, sizeof(value), ctx))
+		{
+		case TEMPLATE_TAG_CONSTANT:
+			if (append_literal(tmpl, value, strnlen(value, sizeof(value))))
+			{
+				goto fail;
+			}
+			break;
+		case TEMPLATE_TAG_DYNAMIC:
+			if (append_name(tmpl, &token, tag_begin + 1, tag_end - tag_begin - 1))
+			{
+				goto fail;
+			}
+			tmpl->tokens[tmpl->token_count++] = token;
+			tags_length += token.length;
+			break;
+		default:
+			break;
+		}
+
+		src_string = tag_end + 1;
+	}
+
+	if (append_literal(tmpl, src_string, strlen(src_string)))
+	{
+		goto fail;
+	}
+
+	tmpl->buffer_size = tmpl->literals_length + tags_length + 1;
+	if (! (tmpl->buffer = malloc(tmpl->buffer_size)))
+	{
+		goto fail;
+	}
+	*tmpl->buffer = '\0';
+
+	return 0;
+
+fail:
+	template_free(tmpl);
+	errno = ENOMEM;
+	return -1;
+}
+
+/*******************************************/ /**
+ * @brief Execute the token program into the output buffer
+ *        of the template. The buffer is reused by the next
+ *        call of this function.
+ *
+ * @param tmpl - A compiled template.
+ * @param format - Callback to write the dynamic tags, may be
+ *                 NULL if the template has only constant tags.
+ * @param ctx - User pointer passed to the callback.
+ * @param length - Stores the length of the output, may be NULL.
+ * @return const char* - Zero terminated output
+ ***********************************************/
+const char *template_render(template_t *tmpl, template_format_t format, void *ctx, size_t *length)
+{
+	char *dst = tmpl->buffer;
+	if (! dst)
+	{
+		if (length)
+		{
+			*length = 0;
+		}
+		return "";
+	}
+
+	const template_token_t *token = tmpl->tokens;
+	const template_token_t *end = token + tmpl->token_count;
+	for (; token < end; token++)
+	{
+		if (token->op == TEMPLATE_OP_LITERAL)
+		{
+			memcpy(dst, tmpl->literals + token->offset, token->length);
+			dst += token->length;
+		}
+		else if (format)
+		{
+			dst += format(token, dst, ctx);
+		}
+	}
+	*dst = '\0';
+
+	if (length)
+	{
+		*length = dst - tmpl->buffer;
+	}
+	return tmpl->buffer;
+}
+
+/*******************************************/ /**
+ * @brief Give free the memory of a compiled template
+ *
+ * @param tmpl - The template
+ ***********************************************/
+void template_free(template_t *tmpl)
+{
+	free(tmpl->tokens);
+	free(tmpl->literals);
+	free(tmpl->names);
+	free(tmpl->buffer);
+	memset(tmpl, 0, sizeof(*tmpl));
+}
+
+/*******************************************/ /**
+ * @brief Get the name of a dynamic tag as written in the
+ *        template, without the surrounding '%'
+ *
+ * @param tmpl - A compiled template
+ * @param token - A tag token of the template
+ * @return const char* - The name, empty for a literal token
+ ***********************************************/
+const char *template_tag_name(const template_t *tmpl, const template_token_t *token)
+{
+	if ((token->op == TEMPLATE_OP_LITERAL) || (! tmpl->names))
+	{
+		return "";
+	}
+	return tmpl->names + token->offset;
+}
+
+/*******************************************/ /**
+ * @brief Write a integer as decimal text without terminating
+ *        zero. The destination needs 20 bytes at most.
+ *
+ * @param dst - Destination buffer
+ * @param value - The value to write
+ * @return size_t - Count of written bytes
+ ***********************************************/
+size_t template_format_int(char *dst, long long value)
+{
+	char digits[20];
+	size_t count = 0;
+	size_t length = 0;
+	unsigned long long u = value;
+
+	if (value < 0)
+	{
+		dst[length++] = '-';
+		u = -(unsigned long long)value;
+	}
+
+	do
+	{
+		digits[count++] = '0' + (u % 10);
+		u /= 10;
+	} while (u);
+
+	while (count)
+	{
+		dst[length++] = digits[--count];
+	}
+
+	return length;
+}
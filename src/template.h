@@ -0,0 +1,86 @@
+/*******************************************/ /**
+ * @file template.h
+ * @author marsman7 (you@domain.com)
+ * @brief Compiles message templates into a token program
+ *        that is executed into a pre-sized output buffer.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEMPLATE_OP_LITERAL 0	/*!< token opcode of a literal text run */
+
+/*******************************************/ /**
+ * @brief Results of a tag resolver
+ ***********************************************/
+enum template_tag_t
+{
+	TEMPLATE_TAG_UNKNOWN = 0,	/*!< tag is dropped from the output */
+	TEMPLATE_TAG_CONSTANT = 1,	/*!< tag value is folded into the literals */
+	TEMPLATE_TAG_DYNAMIC = 2	/*!< tag is evaluated on every render */
+};
+
+/*******************************************/ /**
+ * @brief One instruction of a compiled template. A literal
+ *        token copies 'length' bytes from the literal pool
+ *        at 'offset'. A tag token is passed to the format
+ *        callback which writes at most 'length' bytes.
+ ***********************************************/
+typedef struct template_token_t
+{
+	uint16_t op;
+	uint16_t arg;
+	uint32_t offset;
+	uint32_t length;
+} template_token_t;
+
+/*******************************************/ /**
+ * @brief A compiled template
+ ***********************************************/
+typedef struct template_t
+{
+	template_token_t *tokens;
+	size_t token_count;
+	char *literals;
+	size_t literals_length;
+	char *names;		/*!< zero terminated names of the dynamic tags */
+	size_t names_length;
+	char *buffer;		/*!< output buffer, sized at compile time */
+	size_t buffer_size;
+} template_t;
+
+/*******************************************/ /**
+ * @brief Resolves the name of a tag at compile time.
+ *
+ * @param name - Tag name without the surrounding '%', not terminated.
+ * @param name_length - Length of the tag name.
+ * @param token - Set 'op', 'arg' and 'length' for a dynamic tag.
+ * @param value - Buffer for the value of a constant tag.
+ * @param value_size - Size of the value buffer.
+ * @param ctx - User pointer given to template_compile().
+ * @return int - One of enum template_tag_t
+ ***********************************************/
+typedef int (*template_resolve_t)(const char *name, size_t name_length,
+		template_token_t *token, char *value, size_t value_size, void *ctx);
+
+/*******************************************/ /**
+ * @brief Writes the value of a dynamic tag at render time.
+ *
+ * @param token - The tag token.
+ * @param dst - Destination, space for at least 'token->length' bytes.
+ * @param ctx - User pointer given to template_render().
+ * @return size_t - Count of written bytes
+ ***********************************************/
+typedef size_t (*template_format_t)(const template_token_t *token, char *dst, void *ctx);
+
+int template_compile(template_t *, const char *, template_resolve_t, void *);
+const char *template_render(template_t *, template_format_t, void *, size_t *);
+void template_free(template_t *);
+const char *template_tag_name(const template_t *, const template_token_t *);
+size_t template_format_int(char *, long long);
+
+#endif
@@ -0,0 +1,410 @@
+/*******************************************/ /**
+ * @file watch.c
+ * @author marsman7 (you@domain.com)
+ * @brief Sources of events that trigger a immediate publish :
+ *        netlink, service state changes, PSI triggers and
+ *        inotify on files.
+ *
+ * Each source is a bit, a job is triggered by a set of them.
+ * The fds are non blocking and watched by the event loop of the
+ * caller, watch_read() consumes the pending events of a fd and
+ * returns the sources that fired.
+ *
+ * Sources :
+ *   "link"    - RTM_NEWLINK/RTM_DELLINK that change the flags
+ *               IFF_UP, IFF_RUNNING or IFF_LOWER_UP
+ *   "address" - RTM_NEWADDR/RTM_DELADDR of IPv4 and IPv6
+ *   "units"   - a service is started or stopped, see service.h
+ *   "psi"     - a PSI trigger crossed its threshold, the triggers
+ *               are registered by psi_trigger(), see psi.h
+ *   "/<path>" - the file is written, replaced or removed. The
+ *               directory is watched, so a file that is replaced
+ *               by a rename or does not exist yet is seen too.
+ *
+ * @headerfile watch.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+
+#include "watch.h"
+#include "service.h"
+
+#ifndef IFF_LOWER_UP
+	#define IFF_LOWER_UP 0x10000	// in linux/if.h, that conflicts with net/if.h
+#endif
+
+#define LINK_FLAGS (IFF_UP | IFF_RUNNING | IFF_LOWER_UP)
+#define FILE_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE)
+
+/*******************************************/ /**
+ * @brief A watched file
+ ***********************************************/
+typedef struct watch_file_t
+{
+	int wd;			/*!< watch of the directory */
+	char *name;		/*!< name in the directory */
+	char *path;
+} watch_file_t;
+
+/*******************************************/ /**
+ * @brief Last known flags of a interface
+ ***********************************************/
+typedef struct watch_link_t
+{
+	int index;
+	unsigned flags;
+} watch_link_t;
+
+static int netlink_fd = -1;
+static uint32_t netlink_sources = 0;
+static int inotify_fd = -1;
+static int units_fd = -1;		/*!< owned by service.c */
+static watch_file_t files[WATCH_MAX_FILES];
+static int file_count = 0;
+static watch_link_t *links = NULL;
+static int link_count = 0;
+
+/*******************************************/ /**
+ * @brief Join a multicast group of rtnetlink
+ ***********************************************/
+static int netlink_join(unsigned group)
+{
+	if (netlink_fd < 0)
+	{
+		netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+		struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+		if ((netlink_fd < 0) || bind(netlink_fd, (struct sockaddr *)&addr, sizeof(addr)))
+		{
+			int error = errno;
+			if (netlink_fd >= 0)
+			{
+				close(netlink_fd);
+			}
+			netlink_fd = -1;
+			errno = error;
+			return -1;
+		}
+	}
+	return setsockopt(netlink_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group));
+}
+
+/*******************************************/ /**
+ * @brief Watch a file by its directory
+ *
+ * @return uint32_t - The source bit, ZERO on error and errno is set
+ ***********************************************/
+static uint32_t watch_file(const char *path, size_t length)
+{
+	for (int i = 0; i < file_count; i++)
+	{
+		if ((strlen(files[i].path) == length) && (! strncmp(files[i].path, path, length)))
+		{
+			return 1u << (WATCH_FIRST_FILE + i);
+		}
+	}
+	if (file_count >= WATCH_MAX_FILES)
+	{
+		errno = ENOSPC;
+		return 0;
+	}
+
+	if (inotify_fd < 0)
+	{
+		if ((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		{
+			return 0;
+		}
+	}
+
+	watch_file_t *file = &files[file_count];
+	char *dir = strndup(path, length);
+	char *base = strndup(path, length);
+	file->path = strndup(path, length);
+	file->name = base ? strdup(basename(base)) : NULL;
+	if ((! dir) || (! base) || (! file->path) || (! file->name))
+	{
+		free(dir);
+		free(base);
+		free(file->path);
+		free(file->name);
+		errno = ENOMEM;
+		return 0;
+	}
+	file->wd = inotify_add_watch(inotify_fd, dirname(dir), FILE_EVENTS);
+	int error = errno;
+	free(dir);
+	free(base);
+	if (file->wd < 0)
+	{
+		free(file->path);
+		free(file->name);
+		errno = error;
+		return 0;
+	}
+
+	return 1u << (WATCH_FIRST_FILE + file_count++);
+}
+
+/*******************************************/ /**
+ * @brief Register a source by its name
+ *
+ * @param name - "link", "address", "units", "psi" or a absolute path,
+ *               not terminated
+ * @param length - Length of the name
+ * @return uint32_t - The source bit, ZERO on error and errno is
+ *                    set, ENOENT for a unknown name
+ ***********************************************/
+uint32_t watch_register(const char *name, size_t length)
+{
+	if (length && (*name == '/'))
+	{
+		return watch_file(name, length);
+	}
+	if ((length == 4) && (! strncasecmp(name, "link", length)))
+	{
+		if ((! (netlink_sources & WATCH_LINK)) && netlink_join(RTNLGRP_LINK))
+		{
+			return 0;
+		}
+		netlink_sources |= WATCH_LINK;
+		return WATCH_LINK;
+	}
+	if ((length == 7) && (! strncasecmp(name, "address", length)))
+	{
+		if ( (! (netlink_sources & WATCH_ADDRESS)) &&
+				(netlink_join(RTNLGRP_IPV4_IFADDR) || netlink_join(RTNLGRP_IPV6_IFADDR)) )
+		{
+			return 0;
+		}
+		netlink_sources |= WATCH_ADDRESS;
+		return WATCH_ADDRESS;
+	}
+	if ((length == 5) && (! strncasecmp(name, "units", length)))
+	{
+		if ((units_fd < 0) && ((units_fd = service_watch_fd()) < 0))
+		{
+			errno = ENOTSUP;
+			return 0;
+		}
+		return WATCH_UNITS;
+	}
+	if ((length == 3) && (! strncasecmp(name, "psi", length)))
+	{
+		int fds[PSI_MAX_TRIGGERS];
+		if (! psi_trigger_fds(fds))
+		{
+			// no trigger is registered
+			errno = ENODATA;
+			return 0;
+		}
+		return WATCH_PSI;
+	}
+
+	errno = ENOENT;
+	return 0;
+}
+
+/*******************************************/ /**
+ * @brief Get the fds to watch
+ *
+ * @param fds - Stores the fds, space for WATCH_MAX_FDS
+ * @param priority - Stores for each fd if it is watched for
+ *                   POLLPRI instead of POLLIN. A PSI trigger is
+ *                   ever readable and reports by POLLPRI.
+ * @return int - Count of stored fds
+ ***********************************************/
+int watch_fds(int *fds, bool *priority)
+{
+	int count = 0;
+	if (netlink_fd >= 0)
+	{
+		fds[count++] = netlink_fd;
+	}
+	if (inotify_fd >= 0)
+	{
+		fds[count++] = inotify_fd;
+	}
+	if (units_fd >= 0)
+	{
+		fds[count++] = units_fd;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		priority[i] = false;
+	}
+	int psi_count = psi_trigger_fds(fds + count);
+	for (int i = 0; i < psi_count; i++)
+	{
+		priority[count++] = true;
+	}
+	return count;
+}
+
+/*******************************************/ /**
+ * @brief Check if the flags of a interface are changed
+ *
+ * @param index - Index of the interface
+ * @param flags - The new flags, ZERO if it is removed
+ * @return bool - TRUE if changed
+ ***********************************************/
+static bool link_changed(int index, unsigned flags)
+{
+	flags &= LINK_FLAGS;
+	for (int i = 0; i < link_count; i++)
+	{
+		if (links[i].index == index)
+		{
+			bool changed = links[i].flags != flags;
+			links[i].flags = flags;
+			return changed;
+		}
+	}
+
+	watch_link_t *new_links = realloc(links, (link_count + 1) * sizeof(watch_link_t));
+	if (new_links)
+	{
+		links = new_links;
+		links[link_count].index = index;
+		links[link_count++].flags = flags;
+	}
+	return true;
+}
+
+/*******************************************/ /**
+ * @brief Consume the messages of the netlink socket
+ ***********************************************/
+static uint32_t read_netlink()
+{
+	char buffer[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	uint32_t fired = 0;
+	ssize_t length;
+
+	while ((length = recv(netlink_fd, buffer, sizeof(buffer), 0)) > 0)
+	{
+		for (struct nlmsghdr *msg = (struct nlmsghdr *)buffer; NLMSG_OK(msg, length); msg = NLMSG_NEXT(msg, length))
+		{
+			switch (msg->nlmsg_type)
+			{
+			case RTM_NEWLINK:
+			case RTM_DELLINK:
+			{
+				const struct ifinfomsg *info = NLMSG_DATA(msg);
+				if ( (netlink_sources & WATCH_LINK) && (msg->nlmsg_len >= NLMSG_LENGTH(sizeof(*info))) &&
+						link_changed(info->ifi_index, (msg->nlmsg_type == RTM_NEWLINK) ? info->ifi_flags : 0) )
+				{
+					fired |= WATCH_LINK;
+				}
+				break;
+			}
+			case RTM_NEWADDR:
+			case RTM_DELADDR:
+				fired |= netlink_sources & WATCH_ADDRESS;
+				break;
+			}
+		}
+	}
+	if ((length < 0) && (errno == ENOBUFS))
+	{
+		// events are lost, something has changed
+		fired |= netlink_sources;
+	}
+	return fired;
+}
+
+/*******************************************/ /**
+ * @brief Consume the events of the inotify fd
+ ***********************************************/
+static uint32_t read_inotify()
+{
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	uint32_t fired = 0;
+	ssize_t length;
+
+	while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (char *p = buffer; p < buffer + length; )
+		{
+			const struct inotify_event *event = (const struct inotify_event *)p;
+			for (int i = 0; i < file_count; i++)
+			{
+				if ((files[i].wd == event->wd) && event->len && (! strcmp(files[i].name, event->name)))
+				{
+					fired |= 1u << (WATCH_FIRST_FILE + i);
+				}
+			}
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				fired |= ((1ull << file_count) - 1) << WATCH_FIRST_FILE;
+			}
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return fired;
+}
+
+/*******************************************/ /**
+ * @brief Consume the pending events of a fd
+ *
+ * @param fd - A fd of watch_fds()
+ * @return uint32_t - Sources that fired, ZERO if none or the fd
+ *                    is not a watch fd
+ ***********************************************/
+uint32_t watch_read(int fd)
+{
+	if (fd < 0)
+	{
+		return 0;
+	}
+	if (fd == netlink_fd)
+	{
+		return read_netlink();
+	}
+	if (fd == inotify_fd)
+	{
+		return read_inotify();
+	}
+	if (fd == units_fd)
+	{
+		return service_watch_read() ? WATCH_UNITS : 0;
+	}
+	return psi_trigger_read(fd) ? WATCH_PSI : 0;
+}
+
+/*******************************************/ /**
+ * @brief Close all sources
+ ***********************************************/
+void watch_free()
+{
+	if (netlink_fd >= 0)
+	{
+		close(netlink_fd);
+	}
+	netlink_fd = -1;
+	netlink_sources = 0;
+	if (inotify_fd >= 0)
+	{
+		close(inotify_fd);
+	}
+	inotify_fd = -1;
+	units_fd = -1;
+	for (int i = 0; i < file_count; i++)
+	{
+		free(files[i].path);
+		free(files[i].name);
+	}
+	file_count = 0;
+	free(links); links = NULL;
+	link_count = 0;
+}
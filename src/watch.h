@@ -0,0 +1,32 @@
+/*******************************************/ /**
+ * @file watch.h
+ * @author marsman7 (you@domain.com)
+ * @brief Sources of events that trigger a immediate publish :
+ *        netlink, service state changes, PSI triggers and
+ *        inotify on files.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "psi.h"
+
+#define WATCH_LINK (1u << 0)		/*!< a interface goes up or down */
+#define WATCH_ADDRESS (1u << 1)		/*!< a IP address is added or removed */
+#define WATCH_UNITS (1u << 2)		/*!< a service is started or stopped */
+#define WATCH_PSI (1u << 3)		/*!< a PSI trigger crossed its threshold */
+#define WATCH_FIRST_FILE 4		/*!< bit of the first watched file */
+#define WATCH_MAX_FILES (32 - WATCH_FIRST_FILE)
+#define WATCH_MAX_FDS (3 + PSI_MAX_TRIGGERS)
+
+uint32_t watch_register(const char *, size_t);
+int watch_fds(int *, bool *);
+uint32_t watch_read(int);
+void watch_free();
+
+#endif
@@ -0,0 +1,108 @@
+/*******************************************/ /**
+ * @file window.c
+ * @author marsman7 (you@domain.com)
+ * @brief Streaming aggregate of the samples of a tag in a 
+ *        window : min, max, mean and quantiles.
+ *
+ * Min., max. and mean are exact. The quantiles come from a 
+ * histogram with logarithmic buckets, each bucket is 4 % wider
+ * than the one before, so a quantile is within 2 % of the true
+ * value. Bucket ZERO takes the values below WINDOW_MIN_VALUE, 
+ * including ZERO and negative values, the last bucket the values
+ * above the range. The result is clamped to min. and max.
+ *
+ * @headerfile window.h
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+#include <math.h>
+
+#include "window.h"
+
+#define WINDOW_MIN_VALUE 1e-3	/*!< lower bound of bucket 1 */
+#define WINDOW_GAMMA 1.04	/*!< ratio of the bounds of two buckets */
+
+/*******************************************/ /**
+ * @brief Get the bucket of a value
+ ***********************************************/
+static int bucket_of(double value)
+{
+	if (! (value >= WINDOW_MIN_VALUE))
+	{
+		return 0;	// also NaN
+	}
+	int bucket = 1 + (int)(log(value / WINDOW_MIN_VALUE) / log(WINDOW_GAMMA));
+	return (bucket < WINDOW_BUCKETS) ? bucket : WINDOW_BUCKETS - 1;
+}
+
+/*******************************************/ /**
+ * @brief Add a sample to the window
+ *
+ * @param window - The window
+ * @param value - The sample
+ ***********************************************/
+void window_add(window_t *window, double value)
+{
+	if (! window->count)
+	{
+		window->min = window->max = value;
+	}
+	window->min = (value < window->min) ? value : window->min;
+	window->max = (value > window->max) ? value : window->max;
+	window->sum += value;
+	window->count++;
+	window->buckets[bucket_of(value)]++;
+}
+
+/*******************************************/ /**
+ * @brief Get a quantile of the samples
+ *
+ * @param window - The window, must have a sample
+ * @param quantile - 0.0 to 1.0, e.g. 0.95
+ * @return double - The estimated value
+ ***********************************************/
+double window_quantile(const window_t *window, double quantile)
+{
+	uint32_t rank = (uint32_t)ceil(quantile * window->count);
+	rank = rank ? rank : 1;
+
+	uint32_t seen = 0;
+	int bucket = 0;
+	for (; bucket < WINDOW_BUCKETS - 1; bucket++)
+	{
+		seen += window->buckets[bucket];
+		if (seen >= rank)
+		{
+			break;
+		}
+	}
+
+	// the middle of the bucket, the outer buckets are open
+	double value;
+	if (bucket == 0)
+	{
+		value = window->min;
+	}
+	else if (bucket == WINDOW_BUCKETS - 1)
+	{
+		value = window->max;
+	}
+	else
+	{
+		value = WINDOW_MIN_VALUE * pow(WINDOW_GAMMA, bucket - 1) * (1 + WINDOW_GAMMA) / 2;
+	}
+
+	value = (value < window->min) ? window->min : value;
+	return (value > window->max) ? window->max : value;
+}
+
+/*******************************************/ /**
+ * @brief Start a new window
+ *
+ * @param window - The window
+ ***********************************************/
+void window_reset(window_t *window)
+{
+	memset(window, 0, sizeof(*window));
+}
@@ -0,0 +1,33 @@
+/*******************************************/ /**
+ * @file window.h
+ * @author marsman7 (you@domain.com)
+ * @brief Streaming aggregate of the samples of a tag in a 
+ *        window : min, max, mean and quantiles.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdint.h>
+
+#define WINDOW_BUCKETS 1024	/*!< log buckets of the quantile sketch, up to 1e14 */
+
+/*******************************************/ /**
+ * @brief Aggregate of a window, the size is fixed and 
+ *        does not depend on the count of samples
+ ***********************************************/
+typedef struct window_t
+{
+	uint32_t count;
+	double min;
+	double max;
+	double sum;
+	uint32_t buckets[WINDOW_BUCKETS];	/*!< counts of the samples per log bucket */
+} window_t;
+
+void window_add(window_t *, double);
+double window_quantile(const window_t *, double);
+void window_reset(window_t *);
+
+#endif
@@ -0,0 +1,27 @@
+/*******************************************/ /**
+ * @file check.h
+ * @author marsman7 (you@domain.com)
+ * @brief Minimal checks of the unit tests, each test is a 
+ *        program of 'make check' that exits with a failure if
+ *        a check failed.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int check_failures = 0;
+
+// Log a failed condition and go on with the test
+#define CHECK(cond) do { if (! (cond)) { \
+		fprintf(stderr, "%s:%d: check failed : %s\n", __FILE__, __LINE__, #cond); \
+		check_failures++; } } while (0)
+
+// Result of main() of a test
+#define CHECK_RESULT(name) (printf("%s : %s\n", name, check_failures ? "FAILED" : "ok"), \
+		check_failures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+#endif
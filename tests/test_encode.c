@@ -0,0 +1,147 @@
+/*******************************************/ /**
+ * @file test_encode.c
+ * @author marsman7 (you@domain.com)
+ * @brief Round trip tests of the CBOR and MessagePack payloads :
+ *        a map of typed values is encoded and decoded again by
+ *        hb-decode, the JSON output has to match the values.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "encode.h"
+
+#ifndef DECODER_PATH
+#define DECODER_PATH "bin/hb-decode"
+#endif
+
+#define LONG_TEXT "0123456789012345678901234567890123456789"	// longer than a fixstr
+
+/*******************************************/ /**
+ * @brief Decode a message with hb-decode
+ *
+ * @param format - Name of the format for hb-decode
+ * @param message - The message
+ * @param length - Length of the message
+ * @param json - Stores the output
+ * @param size - Size of 'json'
+ * @return int - Exit status of hb-decode, -1 if it did not run
+ ***********************************************/
+static int decode(const char *format, const uint8_t *message, size_t length, char *json, size_t size)
+{
+	char path[] = "/tmp/test_encode_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	ssize_t written = write(fd, message, length);
+	close(fd);
+	if (written != (ssize_t)length)
+	{
+		unlink(path);
+		return -1;
+	}
+
+	char command[256];
+	snprintf(command, sizeof(command), "%s %s %s", DECODER_PATH, format, path);
+	FILE *pipe = popen(command, "r");
+	if (! pipe)
+	{
+		unlink(path);
+		return -1;
+	}
+	size_t count = fread(json, 1, size - 1, pipe);
+	json[count] = '\0';
+	json[strcspn(json, "\n")] = '\0';
+	int status = pclose(pipe);
+	unlink(path);
+	return status;
+}
+
+/*******************************************/ /**
+ * @brief Encode a map of all value types and compare the
+ *        decoded JSON
+ ***********************************************/
+static void check_round_trip(enum payload_format_t format, const char *name)
+{
+	static const struct { const char *key; metric_value_t value; } entries[] = {
+		{ "zero", { VALUE_INT, { .i = 0 } } },
+		{ "small", { VALUE_INT, { .i = 23 } } },
+		{ "byte", { VALUE_INT, { .i = 200 } } },
+		{ "word", { VALUE_INT, { .i = 65536 } } },
+		{ "neg", { VALUE_INT, { .i = -1 } } },
+		{ "neg_byte", { VALUE_INT, { .i = -200 } } },
+		{ "max", { VALUE_INT, { .i = LLONG_MAX } } },
+		{ "min", { VALUE_INT, { .i = LLONG_MIN } } },
+		{ "double", { VALUE_DOUBLE, { .d = 1.5 } } },
+		{ "text", { VALUE_TEXT, { .text = "active" } } },
+		{ "long", { VALUE_TEXT, { .text = LONG_TEXT } } },
+		{ "cut", { VALUE_TEXT, { .text = "abcdefgh" } } },
+		{ "none", { VALUE_NONE, { .i = 0 } } }
+	};
+	const char *expected = "{\"zero\":0,\"small\":23,\"byte\":200,\"word\":65536,"
+			"\"neg\":-1,\"neg_byte\":-200,\"max\":9223372036854775807,"
+			"\"min\":-9223372036854775808,\"double\":1.5,\"text\":\"active\","
+			"\"long\":\"" LONG_TEXT "\",\"cut\":\"abcd\",\"none\":null}";
+	size_t count = sizeof(entries) / sizeof(entries[0]);
+
+	uint8_t message[1024];
+	uint8_t *dst = message;
+	dst += encode_map(dst, format, count);
+	for (size_t i = 0; i < count; i++)
+	{
+		dst += encode_text(dst, format, entries[i].key, strlen(entries[i].key));
+		size_t text_size = strcmp(entries[i].key, "cut") ? 64 : 4;
+		dst += encode_value(dst, format, &entries[i].value, text_size);
+	}
+
+	char json[1024];
+	CHECK(decode(name, message, dst - message, json, sizeof(json)) == 0);
+	if (strcmp(json, expected))
+	{
+		fprintf(stderr, "%s decoded to %s\n   expected %s\n", name, json, expected);
+		check_failures++;
+	}
+}
+
+/*******************************************/ /**
+ * @brief The map header of a count that needs more than the
+ *        short form
+ ***********************************************/
+static void check_big_map(enum payload_format_t format, const char *name)
+{
+	static uint8_t message[64 * 1024];
+	const size_t count = 300;
+	char key[16];
+	uint8_t *dst = message;
+
+	dst += encode_map(dst, format, count);
+	for (size_t i = 0; i < count; i++)
+	{
+		metric_value_t value = { VALUE_INT, { .i = i } };
+		dst += encode_text(dst, format, key, snprintf(key, sizeof(key), "k%zu", i));
+		dst += encode_value(dst, format, &value, 0);
+	}
+
+	static char json[64 * 1024];
+	CHECK(decode(name, message, dst - message, json, sizeof(json)) == 0);
+	CHECK(! strncmp(json, "{\"k0\":0,\"k1\":1,", 15));
+	CHECK(strstr(json, ",\"k299\":299}") != NULL);
+}
+
+int main()
+{
+	CHECK(payload_format("cbor") == PAYLOAD_CBOR);
+	CHECK(payload_format("msgpack") == PAYLOAD_MSGPACK);
+	CHECK(payload_format("text") == PAYLOAD_TEXT);
+
+	check_round_trip(PAYLOAD_CBOR, "cbor");
+	check_round_trip(PAYLOAD_MSGPACK, "msgpack");
+	check_big_map(PAYLOAD_CBOR, "cbor");
+	check_big_map(PAYLOAD_MSGPACK, "msgpack");
+	return CHECK_RESULT("encode");
+}
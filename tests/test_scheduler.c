@@ -0,0 +1,152 @@
+/*******************************************/ /**
+ * @file test_scheduler.c
+ * @author marsman7 (you@domain.com)
+ * @brief Tests of the phases and first deadlines of the 
+ *        scheduler : a fleet of hosts that start at once 
+ *        spreads evenly over the interval, the busiest part
+ *        of it gets a bounded share of the publishes, and no
+ *        first publish is later than one interval.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+
+#include "check.h"
+#include "scheduler.h"
+
+#define HOSTS 2000
+#define BUCKETS 20
+#define SECOND 1000000000ULL
+
+/*******************************************/ /**
+ * @brief Hosts with the ids of a fleet get phases spread evenly
+ *        over the span, each bucket gets about its share
+ ***********************************************/
+static void test_spread()
+{
+	uint64_t span = 10 * SECOND;
+	int counts[BUCKETS] = {0};
+	char id[32];
+
+	for (int host = 0; host < HOSTS; host++)
+	{
+		snprintf(id, sizeof(id), "heartbeat-%d", host);
+		uint64_t phase = scheduler_phase(id, span);
+		CHECK(phase < span);
+		counts[phase * BUCKETS / span]++;
+	}
+
+	// the mean is 100, a binomial bucket is within 4 sigma of it
+	for (int i = 0; i < BUCKETS; i++)
+	{
+		CHECK(counts[i] >= HOSTS / BUCKETS * 6 / 10);
+		CHECK(counts[i] <= HOSTS / BUCKETS * 14 / 10);
+	}
+}
+
+/*******************************************/ /**
+ * @brief A fleet that starts at once, with ids like MAC 
+ *        addresses, publishes first over the spread part of the 
+ *        interval. The busiest bucket gets at most 1.4 times the 
+ *        mean, 4 sigma of a binomial bucket.
+ *
+ * @param spread - Percent of the interval, see 'schedule_spread'
+ ***********************************************/
+static void check_arrivals(int spread)
+{
+	const uint64_t interval = 60 * SECOND;
+	const uint64_t span = interval * spread / 100;
+	const uint64_t now = 3600 * SECOND;
+	int counts[BUCKETS] = {0};
+	int max = 0;
+	char id[32];
+
+	for (int host = 0; host < HOSTS; host++)
+	{
+		snprintf(id, sizeof(id), "hb-b8:27:eb:%02x:%02x:%02x", host >> 16, (host >> 8) & 0xff, host & 0xff);
+		uint64_t deadline = scheduler_slot(now, 0, interval, scheduler_phase(id, span));
+		CHECK(deadline - now <= span);
+		int bucket = (deadline - now) * BUCKETS / (span + 1);
+		if (++counts[bucket] > max)
+		{
+			max = counts[bucket];
+		}
+	}
+
+	if (max > HOSTS / BUCKETS * 14 / 10)
+	{
+		fprintf(stderr, "spread %d %% : busiest bucket %d of %d hosts :", spread, max, HOSTS);
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			fprintf(stderr, " %d", counts[i]);
+		}
+		fprintf(stderr, "\n");
+		check_failures++;
+	}
+}
+
+/*******************************************/ /**
+ * @brief The arrivals over the whole interval and over a part
+ ***********************************************/
+static void test_arrivals()
+{
+	check_arrivals(100);
+	check_arrivals(50);
+	check_arrivals(10);
+}
+
+/*******************************************/ /**
+ * @brief The phase depends on the id only, ids that differ in 
+ *        one character get different phases
+ ***********************************************/
+static void test_stable()
+{
+	uint64_t span = 60 * SECOND;
+
+	CHECK(scheduler_phase("host-a", span) == scheduler_phase("host-a", span));
+	CHECK(scheduler_phase("host-a", span) != scheduler_phase("host-b", span));
+	CHECK(scheduler_phase("host-a", 0) == 0);
+	CHECK(scheduler_phase("", span) < span);
+}
+
+/*******************************************/ /**
+ * @brief The first deadline is 1 ns to one interval from now 
+ *        and on the phase of the host in the cycle
+ ***********************************************/
+static void test_latency()
+{
+	const uint64_t intervals[] = { 1, 7, SECOND, 5 * SECOND, 60 * SECOND, 86400 * SECOND };
+	const uint64_t positions[] = { 0, 1, SECOND / 3, 59 * SECOND, 1700000000 * SECOND };
+	const uint64_t nows[] = { 0, 12345, 3600 * SECOND };
+	char id[32];
+
+	for (size_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++)
+	{
+		uint64_t interval = intervals[i];
+		for (int host = 0; host < 100; host++)
+		{
+			snprintf(id, sizeof(id), "host-%d", host);
+			uint64_t phase = scheduler_phase(id, interval);
+			for (size_t p = 0; p < sizeof(positions) / sizeof(positions[0]); p++)
+			{
+				for (size_t n = 0; n < sizeof(nows) / sizeof(nows[0]); n++)
+				{
+					uint64_t now = nows[n];
+					uint64_t deadline = scheduler_slot(now, positions[p], interval, phase);
+					CHECK(deadline > now);
+					CHECK(deadline <= now + interval);
+					CHECK((deadline - now + positions[p]) % interval == phase % interval);
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+	test_spread();
+	test_arrivals();
+	test_stable();
+	test_latency();
+	return CHECK_RESULT("scheduler");
+}
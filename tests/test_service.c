@@ -0,0 +1,117 @@
+/*******************************************/ /**
+ * @file test_service.c
+ * @author marsman7 (you@domain.com)
+ * @brief Tests of the service states with the 'file' backend :
+ *        the states of the file are mapped to the registered
+ *        units, the cache is refreshed on a change of the file
+ *        and a failed query keeps the states before.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "service.h"
+
+static char path[] = "/tmp/test_service_XXXXXX";
+
+/*******************************************/ /**
+ * @brief Replace the content of the state file, the inode is
+ *        kept so the watch of the backend sees the change
+ ***********************************************/
+static void write_states(const char *text)
+{
+	FILE *file = fopen(path, "w");
+	CHECK(file != NULL);
+	if (file)
+	{
+		fputs(text, file);
+		fclose(file);
+	}
+}
+
+/*******************************************/ /**
+ * @brief Each unit gets the state of its line, units without
+ *        a line are 'unknown'
+ ***********************************************/
+static void test_states()
+{
+	write_states("sshd active\nmosquitto \t failed extra\n\n# comment\nsshd-keygen inactive\n");
+	CHECK(service_init("file", path, 0) == 0);
+
+	int sshd = service_register("sshd.service", 4);
+	int mosquitto = service_register("mosquitto", 9);
+	int missing = service_register("cron", 4);
+	CHECK(sshd == 0);
+	CHECK(mosquitto == 1);
+	CHECK(missing == 2);
+	CHECK(service_register("sshd", 4) == sshd);
+	CHECK(service_count() == 3);
+
+	CHECK(*service_state(sshd) == '\0');
+	CHECK(service_update() == 0);
+	CHECK(! strcmp(service_state(sshd), "active"));
+	CHECK(! strcmp(service_state(mosquitto), "failed"));
+	CHECK(! strcmp(service_state(missing), "unknown"));
+	CHECK(! strcmp(service_state(3), ""));
+	CHECK(! strcmp(service_state(-1), ""));
+
+	// a age of ZERO queries on each update
+	write_states("sshd activating\n");
+	CHECK(service_update() == 0);
+	CHECK(! strcmp(service_state(sshd), "activating"));
+	CHECK(! strcmp(service_state(mosquitto), "unknown"));
+
+	service_free();
+	CHECK(service_count() == 0);
+}
+
+/*******************************************/ /**
+ * @brief The cached states are kept until the watch reports a
+ *        change, a failed query keeps them too
+ ***********************************************/
+static void test_cache()
+{
+	write_states("sshd active\n");
+	CHECK(service_init("file", path, 3600) == 0);
+	int sshd = service_register("sshd", 4);
+	CHECK(service_update() == 0);
+	CHECK(! strcmp(service_state(sshd), "active"));
+
+	// the caller reads the watch fd from now on
+	CHECK(service_watch_fd() >= 0);
+	write_states("sshd failed\n");
+	CHECK(service_update() == 0);
+	CHECK(! strcmp(service_state(sshd), "active"));
+
+	CHECK(service_watch_read());
+	CHECK(! service_watch_read());
+	CHECK(service_update() == 0);
+	CHECK(! strcmp(service_state(sshd), "failed"));
+
+	unlink(path);
+	service_invalidate();
+	CHECK(service_update() == -1);
+	CHECK(! strcmp(service_state(sshd), "failed"));
+
+	service_free();
+}
+
+int main()
+{
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	test_states();
+	test_cache();
+	CHECK(service_init("none", path, 0) == -1);
+
+	unlink(path);
+	return CHECK_RESULT("service");
+}
@@ -0,0 +1,176 @@
+/*******************************************/ /**
+ * @file test_spool.c
+ * @author marsman7 (you@domain.com)
+ * @brief Tests of the spool ring : messages are read back in
+ *        order over the wrap of the ring, a full ring drops the
+ *        oldest messages, the ring survives a reopen and a
+ *        damaged record empties it.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "spool.h"
+
+#define CAPACITY 256
+#define RECORD_SIZE 24		// header of a record in the file
+
+static char path[] = "/tmp/test_spool_XXXXXX";
+
+/*******************************************/ /**
+ * @brief Append message 'n', 4 bytes topic and 10 bytes payload
+ ***********************************************/
+static int append(spool_t *spool, int n)
+{
+	char topic[8];
+	char payload[16];
+	snprintf(topic, sizeof(topic), "t/%02d", n);
+	snprintf(payload, sizeof(payload), "payload-%02d", n);
+	return spool_append(spool, topic, payload, strlen(payload), n % 3, n & 1, n * 1000LL, n);
+}
+
+/*******************************************/ /**
+ * @brief Check that the oldest message is message 'n'
+ ***********************************************/
+static void check_first(spool_t *spool, int n)
+{
+	spool_message_t message;
+	char topic[8];
+	char payload[16];
+	snprintf(topic, sizeof(topic), "t/%02d", n);
+	snprintf(payload, sizeof(payload), "payload-%02d", n);
+
+	CHECK(spool_first(spool, &message) == 0);
+	CHECK(! strcmp(message.topic, topic));
+	CHECK(message.payload_length == strlen(payload));
+	CHECK(! memcmp(message.payload, payload, strlen(payload)));
+	CHECK(message.qos == n % 3);
+	CHECK(message.retain == (n & 1));
+	CHECK(message.time == n * 1000LL);
+	CHECK(message.expiry == (uint32_t)n);
+}
+
+/*******************************************/ /**
+ * @brief Messages come back in order, also over the end of the
+ *        ring, and the count follows the appends and removes
+ ***********************************************/
+static void test_order()
+{
+	spool_t spool;
+	CHECK(spool_open(&spool, path, CAPACITY) == 0);
+	CHECK(spool_count(&spool) == 0);
+
+	spool_message_t message;
+	CHECK(spool_first(&spool, &message) == -1);
+
+	// each round moves the records over the end of the ring
+	for (int round = 0; round < 10; round++)
+	{
+		for (int n = 0; n < 3; n++)
+		{
+			CHECK(append(&spool, round * 3 + n) == 0);
+		}
+		CHECK(spool_count(&spool) == 3);
+		for (int n = 0; n < 3; n++)
+		{
+			check_first(&spool, round * 3 + n);
+			spool_remove_first(&spool);
+		}
+		CHECK(spool_count(&spool) == 0);
+	}
+
+	spool_remove_first(&spool);
+	CHECK(spool_count(&spool) == 0);
+	spool_close(&spool);
+}
+
+/*******************************************/ /**
+ * @brief A full ring drops the oldest messages, the messages
+ *        are kept over a reopen
+ ***********************************************/
+static void test_drop_oldest()
+{
+	const int record = RECORD_SIZE + 4 + 10;
+	const int fit = CAPACITY / record;
+	spool_t spool;
+	int dropped = 0;
+
+	CHECK(spool_open(&spool, path, CAPACITY) == 0);
+	for (int n = 0; n < 20; n++)
+	{
+		int result = append(&spool, n);
+		CHECK(result >= 0);
+		dropped += result;
+	}
+	CHECK(spool_count(&spool) == (uint64_t)fit);
+	CHECK(dropped == 20 - fit);
+	spool_close(&spool);
+
+	CHECK(spool_open(&spool, path, CAPACITY) == 0);
+	CHECK(spool_count(&spool) == (uint64_t)fit);
+	for (int n = 20 - fit; n < 20; n++)
+	{
+		check_first(&spool, n);
+		spool_remove_first(&spool);
+	}
+	CHECK(spool_count(&spool) == 0);
+
+	// a message larger than the ring is refused
+	char big[CAPACITY];
+	memset(big, 'x', sizeof(big));
+	CHECK(spool_append(&spool, "t", big, sizeof(big), 0, false, 0, 0) == -1);
+	CHECK(spool_count(&spool) == 0);
+	spool_close(&spool);
+
+	// a other capacity starts empty
+	CHECK(spool_open(&spool, path, CAPACITY * 2) == 0);
+	CHECK(spool_count(&spool) == 0);
+	spool_close(&spool);
+}
+
+/*******************************************/ /**
+ * @brief A record with a damaged length empties the ring, it is
+ *        used again afterwards
+ ***********************************************/
+static void test_damaged()
+{
+	spool_t spool;
+	spool_message_t message;
+
+	unlink(path);
+	CHECK(spool_open(&spool, path, CAPACITY) == 0);
+	CHECK(append(&spool, 1) == 0);
+	CHECK(append(&spool, 2) == 0);
+
+	// the topic length of the oldest record at the begin of the ring
+	memset(spool.data, 0xff, 4);
+	CHECK(spool_first(&spool, &message) == -1);
+	CHECK(spool_count(&spool) == 0);
+
+	CHECK(append(&spool, 3) == 0);
+	CHECK(spool_count(&spool) == 1);
+	check_first(&spool, 3);
+	spool_remove_first(&spool);
+	CHECK(spool_count(&spool) == 0);
+	spool_close(&spool);
+}
+
+int main()
+{
+	int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	test_order();
+	test_drop_oldest();
+	test_damaged();
+
+	unlink(path);
+	return CHECK_RESULT("spool");
+}
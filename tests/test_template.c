@@ -0,0 +1,133 @@
+/*******************************************/ /**
+ * @file test_template.c
+ * @author marsman7 (you@domain.com)
+ * @brief Tests of the template compiler and renderer :
+ *        constant tags are folded into the literals, dynamic
+ *        tags are formatted on each render, unknown tags and
+ *        unclosed tags are dropped.
+ *
+ * @copyright Copyright (c) 2022
+ ***********************************************/
+#include <string.h>
+#include <limits.h>
+
+#include "check.h"
+#include "template.h"
+
+#define OP_COUNTER 1
+
+/*******************************************/ /**
+ * @brief Resolver with the constant tag 'host' and the dynamic
+ *        tag 'counter', counts its calls in 'ctx'
+ ***********************************************/
+static int resolve(const char *name, size_t name_length, template_token_t *token,
+		char *value, size_t value_size, void *ctx)
+{
+	(*(int *)ctx)++;
+
+	if ((name_length == 4) && (! strncmp(name, "host", 4)))
+	{
+		snprintf(value, value_size, "box-1");
+		return TEMPLATE_TAG_CONSTANT;
+	}
+	if ((name_length == 7) && (! strncmp(name, "counter", 7)))
+	{
+		token->op = OP_COUNTER;
+		token->arg = 7;
+		token->length = 20;
+		return TEMPLATE_TAG_DYNAMIC;
+	}
+	return TEMPLATE_TAG_UNKNOWN;
+}
+
+/*******************************************/ /**
+ * @brief Writes the counter given in 'ctx'
+ ***********************************************/
+static size_t format(const template_token_t *token, char *dst, void *ctx)
+{
+	CHECK(token->op == OP_COUNTER);
+	CHECK(token->arg == 7);
+	return template_format_int(dst, *(long long *)ctx);
+}
+
+/*******************************************/ /**
+ * @brief Render a template with a counter and compare it
+ ***********************************************/
+static void check_render(const char *src, long long counter, const char *expected)
+{
+	template_t tmpl;
+	int calls = 0;
+	size_t length = 12345;
+
+	CHECK(template_compile(&tmpl, src, resolve, &calls) == 0);
+	const char *output = template_render(&tmpl, format, &counter, &length);
+	if (strcmp(output, expected))
+	{
+		fprintf(stderr, "'%s' rendered '%s', expected '%s'\n", src ? src : "(null)", output, expected);
+		check_failures++;
+	}
+	CHECK(length == strlen(expected));
+	CHECK(length < tmpl.buffer_size || tmpl.buffer_size == 0);
+	template_free(&tmpl);
+}
+
+/*******************************************/ /**
+ * @brief Output of the tags
+ ***********************************************/
+static void test_render()
+{
+	check_render("plain text", 0, "plain text");
+	check_render("%host%/state", 0, "box-1/state");
+	check_render("a %host% b %counter% c", 42, "a box-1 b 42 c");
+	check_render("%counter%%counter%", -3, "-3-3");
+	check_render("[%counter%]", LLONG_MIN, "[-9223372036854775808]");
+	check_render("[%counter%]", LLONG_MAX, "[9223372036854775807]");
+	check_render("x%nope%y", 1, "xy");
+	check_render("x%%y", 1, "xy");
+	check_render("x %host", 1, "x ");
+	check_render("", 1, "");
+	check_render(NULL, 1, "");
+}
+
+/*******************************************/ /**
+ * @brief Constant tags are folded at compile time, the program
+ *        has one token per literal run and dynamic tag
+ ***********************************************/
+static void test_compile()
+{
+	template_t tmpl;
+	int calls = 0;
+	long long counter = 5;
+
+	CHECK(template_compile(&tmpl, "up %host% since %counter% s %host%", resolve, &calls) == 0);
+	CHECK(calls == 3);
+	CHECK(tmpl.token_count == 3);
+	CHECK(tmpl.tokens[0].op == TEMPLATE_OP_LITERAL);
+	CHECK(tmpl.tokens[1].op == OP_COUNTER);
+	CHECK(tmpl.tokens[2].op == TEMPLATE_OP_LITERAL);
+	CHECK(! strcmp(template_tag_name(&tmpl, &tmpl.tokens[1]), "counter"));
+	CHECK(! strcmp(template_tag_name(&tmpl, &tmpl.tokens[0]), ""));
+
+	// the render does not resolve again and reuses the buffer
+	const char *first = template_render(&tmpl, format, &counter, NULL);
+	CHECK(! strcmp(first, "up box-1 since 5 s box-1"));
+	counter = 123456;
+	const char *second = template_render(&tmpl, format, &counter, NULL);
+	CHECK(second == first);
+	CHECK(! strcmp(second, "up box-1 since 123456 s box-1"));
+	CHECK(calls == 3);
+	template_free(&tmpl);
+	CHECK(tmpl.tokens == NULL);
+
+	// only constant tags, no format callback is needed
+	CHECK(template_compile(&tmpl, "%host%", resolve, &calls) == 0);
+	CHECK(! strcmp(template_render(&tmpl, NULL, NULL, NULL), "box-1"));
+	template_free(&tmpl);
+}
+
+int main()
+{
+	test_render();
+	test_compile();
+	return CHECK_RESULT("template");
+}